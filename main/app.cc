@@ -1,5 +1,7 @@
 #include "app.h"
 
+#include <algorithm>
+#include <cstdlib>
 #include <utility>
 
 #include <time.h>
@@ -10,21 +12,32 @@
 #include <esp_log.h>
 #include <esp_sntp.h>
 #include <esp_spi_flash.h>
+#include <esp_timer.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
 #include <i2clib/master.h>
 #include <nvs_flash.h>
 
+#include "binary_log.h"
 #include "config.h"
 #include "config_reader.h"
+#include "diagnostics.h"
 #include "display.h"
-#include "event_ids.h"
+#include "event_bus.h"
 #include "filesystem.h"
+#include "frame_profiler.h"
 #include "gpio_pins.h"
 #include "http_server.h"
+#include "i2c_bus.h"
 #include "keyboard.h"
 #include "led_controller.h"
+#include "lighting.h"
+#include "power_manager.h"
+#include "request_scheduler.h"
+#include "rotary_encoder.h"
 #include "spotify.h"
+#include "timer_wheel.h"
+#include "touch_controller.h"
 #include "usb_device.h"
 #include "usb_hid.h"
 #include "volume_display.h"
@@ -34,16 +47,24 @@ namespace {
 
 constexpr char TAG[] = "kbd_app";
 
-constexpr uint64_t kMaxMainLoopWaitMSecs = 100;
-constexpr uint32_t kMinMainLoopWaitMSecs = 10;
+// How often task CPU usage is logged.
+constexpr uint32_t kRunTimeStatsPeriodMSecs = 60 * 1000;
+// How often task stack, heap and CPU usage is sampled.
+constexpr uint32_t kDiagnosticsPeriodMSecs = 10 * 1000;
+// vTaskGetRunTimeStats() writes, without a length bound, one line per task:
+// the name padded to configMAX_TASK_NAME_LEN, the run time (up to 10
+// digits) and the percentage, separated by tabs. Allow for more than that.
+constexpr size_t kRunTimeStatsBytesPerTask = configMAX_TASK_NAME_LEN + 48;
+// Allowance for tasks created between sizing the buffer and filling it.
+constexpr UBaseType_t kRunTimeStatsSpareTasks = 4;
+// Most HID volume key presses waiting to be sent.
+constexpr int kMaxHIDVolumeSteps = 10;
+// How far a vertical swipe on the main display seeks.
+constexpr uint32_t kSeekStepMSecs = 15 * 1000;
 // Interrupt allocation flags.
 // Combination of  ESP_INTR_FLAG_* flags.
 constexpr int ESP_INTR_FLAG_DEFAULT = 0x0;  // No flags set.
 
-// Make sure min wait time is at least one tick.
-static_assert((kMinMainLoopWaitMSecs / portTICK_PERIOD_MS) > 0);
-static_assert(kMaxMainLoopWaitMSecs > kMinMainLoopWaitMSecs);
-
 App* g_app;
 
 esp_err_t InitNVRAM() {
@@ -56,16 +77,195 @@ esp_err_t InitNVRAM() {
   return ret;
 }
 
+// Parse a Config::wifi.power_save value.
+esp_err_t ParsePowerSave(const std::string& name, wifi_ps_type_t* type) {
+  if (name == "none")
+    *type = WIFI_PS_NONE;
+  else if (name == "min_modem")
+    *type = WIFI_PS_MIN_MODEM;
+  else if (name == "max_modem")
+    *type = WIFI_PS_MAX_MODEM;
+  else
+    return ESP_ERR_INVALID_ARG;
+  return ESP_OK;
+}
+
 }  // namespace
 
+esp_err_t App::RegisterDebugHandlers() {
+  const httpd_uri_t frames_handler_info{
+      .uri = FrameProfiler::kURI,
+      .method = HTTP_GET,
+      .handler = FrameProfiler::HTTPHandler,
+      .user_ctx = nullptr,
+  };
+  esp_err_t err = https_server_->RegisterURIHandler(&frames_handler_info);
+  if (err != ESP_OK)
+    return err;
+
+  const httpd_uri_t diagnostics_handler_info{
+      .uri = Diagnostics::kURI,
+      .method = HTTP_GET,
+      .handler = Diagnostics::HTTPHandler,
+      .user_ctx = diagnostics_.get(),
+  };
+  return https_server_->RegisterURIHandler(&diagnostics_handler_info);
+}
+
+void App::LogRunTimeStats() {
+#if CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
+  const size_t buf_size =
+      (uxTaskGetNumberOfTasks() + kRunTimeStatsSpareTasks) *
+          kRunTimeStatsBytesPerTask +
+      1;
+  std::unique_ptr<char[]> buf(new char[buf_size]);
+  vTaskGetRunTimeStats(buf.get());
+  ESP_LOGI(TAG, "Task run time stats:\n%s", buf.get());
+#endif
+  i2c_bus_0_->LogStats();
+  i2c_bus_1_->LogStats();
+  PowerManager::LogStats();
+  BinaryLog::LogStats();
+  event_bus_->LogStats();
+  wifi_->LogStats();
+  timer_wheel_->LogStats();
+  diagnostics_->LogStats();
+  if (keyboard_)
+    keyboard_->LogPowerStats();
+  if (spotify_)
+    spotify_->request_scheduler().LogStats();
+}
+
+esp_err_t App::InitializeVolumeEncoder() {
+  volume_encoder_.reset(
+      new RotaryEncoder(kEncoderAGPIO, kEncoderBGPIO, PCNT_UNIT_0));
+  return volume_encoder_->Initialize([this](int steps) {
+    // Turns arriving before Run() gets to them are coalesced.
+    pending_volume_steps_ += steps;
+    if (run_task_)
+      xTaskNotifyGive(run_task_);
+  });
+}
+
+/**
+ * Send the next HID volume key press or release, if the host can take it.
+ *
+ * One report is sent per call so that the main loop isn't blocked while the
+ * host takes them.
+ *
+ * @return true if reports remain to be sent.
+ */
+bool App::SendHIDVolumeReport() {
+  if (!hid_volume_steps_ && !hid_volume_key_down_)
+    return false;
+  if (!usb::Device::Mounted() || usb::Device::Suspended()) {
+    hid_volume_steps_ = 0;
+    hid_volume_key_down_ = false;
+    return false;
+  }
+  if (!usb::HID::Ready())
+    return true;
+
+  // Alternate press and release.
+  uint16_t usage = 0;
+  if (!hid_volume_key_down_) {
+    usage = hid_volume_steps_ > 0 ? HID_USAGE_CONSUMER_VOLUME_INCREMENT
+                                  : HID_USAGE_CONSUMER_VOLUME_DECREMENT;
+  }
+  if (usb::HID::ConsumerReport(REPORT_ID_CONSUMER_CONTROL, usage) != ESP_OK) {
+    ESP_LOGW(TAG, "Unable to send HID volume report.");
+    // Drop the remaining presses, but keep trying to release the key.
+    hid_volume_steps_ = 0;
+    return hid_volume_key_down_;
+  }
+  if (usage)
+    hid_volume_steps_ -= hid_volume_steps_ > 0 ? 1 : -1;
+  hid_volume_key_down_ = usage != 0;
+  return hid_volume_steps_ || hid_volume_key_down_;
+}
+
+/**
+ * Apply a turn of the volume knob.
+ *
+ * This controls the Spotify player's volume when it is active, and the
+ * host's volume (via HID) otherwise.
+ */
+void App::ApplyVolumeSteps(int steps) {
+  const int volume =
+      std::clamp(volume_display_->volume() + steps, /*lo=*/0, /*hi=*/100);
+  volume_display_->SetVolume(volume);
+  if (spotify_->GetPlayerState().is_active)
+    ESP_ERROR_CHECK_WITHOUT_ABORT(spotify_->SetVolume(volume));
+  else
+    hid_volume_steps_ = std::clamp(hid_volume_steps_ + steps,
+                                   -kMaxHIDVolumeSteps, kMaxHIDVolumeSteps);
+}
+
+/**
+ * Control playback with the latest touch gesture on the main display.
+ *
+ * A tap toggles play/pause, swiping left or right skips to the next or
+ * previous track, and swiping up or down seeks forward or back.
+ */
+void App::HandleTouchGesture() {
+  using Gesture = TouchController::Gesture;
+  const Gesture gesture = display_->TakeGesture();
+  if (gesture == Gesture::None)
+    return;
+  const PlayerState state = spotify_->GetPlayerState();
+  if (!state.is_active)
+    return;
+  switch (gesture) {
+    case Gesture::None:
+      break;
+    case Gesture::Tap:
+      ESP_ERROR_CHECK_WITHOUT_ABORT(state.is_playing ? spotify_->Pause()
+                                                     : spotify_->Play());
+      break;
+    case Gesture::SwipeLeft:
+      ESP_ERROR_CHECK_WITHOUT_ABORT(spotify_->Next());
+      break;
+    case Gesture::SwipeRight:
+      ESP_ERROR_CHECK_WITHOUT_ABORT(spotify_->Previous());
+      break;
+    case Gesture::SwipeUp: {
+      uint32_t position_ms = state.progress_ms + kSeekStepMSecs;
+      if (state.duration_ms)
+        position_ms = std::min(position_ms, state.duration_ms);
+      ESP_ERROR_CHECK_WITHOUT_ABORT(spotify_->Seek(position_ms));
+      break;
+    }
+    case Gesture::SwipeDown:
+      ESP_ERROR_CHECK_WITHOUT_ABORT(spotify_->Seek(
+          state.progress_ms > kSeekStepMSecs
+              ? state.progress_ms - kSeekStepMSecs
+              : 0));
+      break;
+  }
+}
+
 App::App() : config_(new Config()) {
   g_app = this;
 }
 
 App::~App() {
   g_app = nullptr;
-  if (event_group_)
-    vEventGroupDelete(event_group_);
+}
+
+// static
+void App::StatsTimerCb(void* arg) {
+  App* app = static_cast<App*>(arg);
+  app->log_stats_ = true;
+  if (app->run_task_)
+    xTaskNotifyGive(app->run_task_);
+}
+
+// static
+void App::DiagnosticsTimerCb(void* arg) {
+  App* app = static_cast<App*>(arg);
+  app->sample_diagnostics_ = true;
+  if (app->run_task_)
+    xTaskNotifyGive(app->run_task_);
 }
 
 esp_err_t App::SetTimezone() {
@@ -83,8 +283,11 @@ esp_err_t App::SetTimezone() {
 
 // static
 void App::SNTPSyncEventHandler(struct timeval* tv) {
-  if (g_app)
-    g_app->uptate_display_time_ = true;
+  if (!g_app)
+    return;
+  g_app->uptate_display_time_ = true;
+  if (g_app->run_task_)
+    xTaskNotifyGive(g_app->run_task_);
 }
 
 /**
@@ -113,6 +316,11 @@ esp_err_t App::CreateAppEventTask() {
   // TODO: Reduce this size and take the HTTPS requtest out of this task.
   constexpr uint32_t kStackDepthWords = 2048;
 
+  // Subscribe before any event can be posted.
+  event_subscriber_ = event_bus_->Subscribe(EventBus::kAllEvents);
+  if (event_subscriber_ < 0)
+    return ESP_ERR_NO_MEM;
+
   BaseType_t task = xTaskCreate(AppEventTask, "app-event", kStackDepthWords,
                                 this, tskIDLE_PRIORITY, &main_task_);
   if (task != pdPASS)
@@ -125,33 +333,63 @@ void IRAM_ATTR App::AppEventTask(void* arg) {
   App* app = static_cast<App*>(arg);
   ESP_LOGW(TAG, "In Wi-Fi status task handler.");
   while (true) {
-    EventBits_t bits = xEventGroupWaitBits(app->event_group_, EVENT_ALL,
-                                           pdFALSE, pdFALSE, portMAX_DELAY);
-    xEventGroupClearBits(app->event_group_, EVENT_ALL);
-    if (bits & EVENT_NETWORK_GOT_IP) {
+    Event event;
+    if (!app->event_bus_->Take(app->event_subscriber_, &event, portMAX_DELAY))
+      continue;
+    // Wake the main loop so that it handles the event right away.
+    if (app->HandleEvent(event) && app->run_task_)
+      xTaskNotifyGive(app->run_task_);
+  }
+}
+
+bool App::HandleEvent(const Event& event) {
+  switch (event.type) {
+    case EventType::NetworkGotIP:
       ESP_LOGI(TAG, "Wi-Fi is connected.");
-      app->online_ = true;
-      if (!app->sntp_initialized_)
-        app->InitializSNTP();
-    } else if (bits & EVENT_NETWORK_DISCONNECTED) {
-      ESP_LOGW(TAG, "Wi-Fi connection failed.");
-      app->online_ = false;
-      // TODO: Set a timer so that we can retry in a little while.
-    }
-    if (bits & EVENT_SPOTIFY_GOT_AUTHORIZATION_CODE) {
+      online_ = true;
+      if (!sntp_initialized_)
+        InitializSNTP();
+      return true;
+    case EventType::NetworkDisconnected:
+      // WiFi keeps trying to reconnect.
+      ESP_LOGW(TAG, "Wi-Fi disconnected: reason %u.",
+               event.network_disconnected.reason);
+      online_ = false;
+      return true;
+    case EventType::SpotifyGotAuthorizationCode:
       ESP_LOGI(TAG, "Have authorization code");
-    }
-    if (bits & EVENT_SPOTIFY_ACCESS_TOKEN_GOOD) {
-      ESP_LOGI(TAG, "Have access token");
-    }
-    if (bits & EVENT_SPOTIFY_ACCESS_TOKEN_EXPIRE) {
+      return true;
+    case EventType::SpotifyAccessTokenGood:
+      ESP_LOGI(TAG, "Have access token, good for %d secs.",
+               event.access_token_good.expires_in_secs);
+      return true;
+    case EventType::SpotifyAccessTokenFailure:
+      ESP_LOGW(TAG, "Access token request failed: %s",
+               esp_err_to_name(event.access_token_failure.err));
+      spotify_->request_scheduler().LogStats();
+      return true;
+    case EventType::SpotifyAccessTokenExpire:
       ESP_LOGI(TAG, "Access token needs refresh");
-      app->spotify_need_access_token_refresh_ = true;
-    }
-    if (bits & EVENT_KEYBOARD_EVENT) {
-      app->keyboard_->HandleEvents();
-    }
+      spotify_need_access_token_refresh_ = true;
+      return true;
+    case EventType::SpotifyPlayerStateChanged:
+      update_player_state_ = true;
+      return true;
+    case EventType::KeyboardInterrupt:
+      if (keyboard_)
+        keyboard_->HandleEvents(event.keyboard_interrupt.irq_time_us);
+      // Disabled by KeyboardISR() until the events are handled.
+      gpio_intr_enable(kKeyboardINTGPIO);
+      return false;
+    case EventType::KeyboardLEDsChanged:
+      if (lighting_)
+        lighting_->SetCapsLock(event.keyboard_leds.leds &
+                               KEYBOARD_LED_CAPSLOCK);
+      return false;
+    case EventType::Count:
+      break;
   }
+  return false;
 }
 
 esp_err_t App::CreateKeyboardSimulatorTask() {
@@ -218,23 +456,36 @@ esp_err_t App::CreateUSBTask() {
 // static
 void IRAM_ATTR App::USBTask(void* arg) {
   // App* app = static_cast<App*>(arg);
-  while (true) {
+  // Tick() blocks until the USB stack has an event, so this task doesn't
+  // keep the CPU out of light sleep.
+  while (true)
     usb::Device::Tick();
-    vTaskDelay(pdMS_TO_TICKS(1));
-  }
 }
 
 // static
 void IRAM_ATTR App::KeyboardISR(void* arg) {
+  // The interrupt is level triggered (so it can wake from light sleep), so
+  // keep it from firing again until the keyboard events are handled. The
+  // EventBus always delivers the latest event of each type, even when the
+  // subscriber is behind, so it is always re-enabled.
+  gpio_intr_disable(kKeyboardINTGPIO);
   BaseType_t xHigherPriorityTaskWoken = pdFALSE;
-  BaseType_t xResult = xEventGroupSetBitsFromISR(
-      static_cast<App*>(arg)->event_group_, EVENT_KEYBOARD_EVENT,
+  static_cast<App*>(arg)->event_bus_->PostFromISR(
+      {
+          .type = EventType::KeyboardInterrupt,
+          .keyboard_interrupt = {.irq_time_us = esp_timer_get_time()},
+      },
       &xHigherPriorityTaskWoken);
+  portYIELD_FROM_ISR(xHigherPriorityTaskWoken);
+}
 
-  if (xResult != pdFAIL) {
-    // See https://www.freertos.org/xEventGroupSetBitsFromISR.html
-    portYIELD_FROM_ISR(xHigherPriorityTaskWoken);
-  }
+// static
+void App::KeyboardLEDsChanged(uint8_t leds, void* arg) {
+  // Called from the USB task: update the lighting from the event task.
+  static_cast<App*>(arg)->event_bus_->Post({
+      .type = EventType::KeyboardLEDsChanged,
+      .keyboard_leds = {.leds = leds},
+  });
 }
 
 esp_err_t App::InstallKeyboardISR() {
@@ -244,7 +495,7 @@ esp_err_t App::InstallKeyboardISR() {
       .mode = GPIO_MODE_INPUT,
       .pull_up_en = GPIO_PULLUP_ENABLE,
       .pull_down_en = GPIO_PULLDOWN_DISABLE,
-      .intr_type = GPIO_INTR_ANYEDGE,
+      .intr_type = GPIO_INTR_LOW_LEVEL,
   };
 
   esp_err_t err = gpio_config(&io_conf);
@@ -254,18 +505,16 @@ esp_err_t App::InstallKeyboardISR() {
     return err;
   }
 
-  err = gpio_install_isr_service(ESP_INTR_FLAG_DEFAULT);
-  if (err != ESP_OK) {
-    ESP_LOGE(TAG, "gpio_install_isr_service failure: %s.",
-             esp_err_to_name(err));
-    return err;
-  }
-
   err = gpio_isr_handler_add(kKeyboardINTGPIO, KeyboardISR, this);
   if (err != ESP_OK) {
     ESP_LOGE(TAG, "gpio_isr_handler_add failure: %s.", esp_err_to_name(err));
     return err;
   }
+
+  // A key press wakes the chip from light sleep.
+  err = PowerManager::EnableGPIOWakeup(kKeyboardINTGPIO, /*level=*/0);
+  if (err != ESP_OK)
+    return err;
   ESP_LOGI(TAG, "Keyboard interrupt handler installed on GPIO %u.",
            kKeyboardINTGPIO);
   return ESP_OK;
@@ -294,6 +543,8 @@ esp_err_t App::InitializeI2C() {
   if (!i2c::Master::Initialize(i2c_1_config))
     return ESP_FAIL;
 
+  i2c_bus_0_.reset(new I2CBus(I2C_NUM_0, "i2c0"));
+  i2c_bus_1_.reset(new I2CBus(I2C_NUM_1, "i2c1"));
   return ESP_OK;
 }
 
@@ -302,10 +553,29 @@ esp_err_t App::Initialize() {
   if (err != ESP_OK)
     return err;
 
+  err = BinaryLog::Initialize();
+  if (err != ESP_OK)
+    return err;
+
   err = InitializeI2C();
   if (err != ESP_OK)
     return err;
 
+  // Not fatal, everything works without power management.
+  err = PowerManager::Initialize();
+  if (err != ESP_OK && err != ESP_ERR_NOT_SUPPORTED)
+    ESP_LOGW(TAG, "Power management disabled: %s", esp_err_to_name(err));
+
+  timer_wheel_.reset(new TimerWheel());
+  err = timer_wheel_->Start();
+  if (err != ESP_OK)
+    return err;
+  stats_timer_.reset(
+      new TimerWheel::Timer(timer_wheel_.get(), StatsTimerCb, this));
+  diagnostics_.reset(new Diagnostics());
+  diagnostics_timer_.reset(
+      new TimerWheel::Timer(timer_wheel_.get(), DiagnosticsTimerCb, this));
+
   err = esp_event_loop_create_default();
   if (err != ESP_OK)
     return err;
@@ -325,8 +595,8 @@ esp_err_t App::Initialize() {
   SetTimezone();  // Ignore return value - not critical.
 
   ESP_LOGI(TAG, "Wi-Fi SSID: \"%s\"", config_->wifi.ssid.c_str());
-  event_group_ = xEventGroupCreate();
-  wifi_.reset(new WiFi(event_group_));
+  event_bus_.reset(new EventBus());
+  wifi_.reset(new WiFi(event_bus_.get(), timer_wheel_.get()));
   err = CreateAppEventTask();
   if (err != ESP_OK)
     return err;
@@ -336,16 +606,52 @@ esp_err_t App::Initialize() {
     return err;
 
 #if 0
-  keyboard_.reset(new Keyboard(i2c::Master(I2C_NUM_0, /*mutex=*/nullptr)));
+  keyboard_.reset(new Keyboard(i2c_bus_0_.get(), timer_wheel_.get(),
+                               config_->keyboard.sleep_timeout_ms));
   err = keyboard_->Initialize();
   if (err != ESP_OK)
     return err;
+
+  lighting_.reset(new Lighting(i2c_bus_0_.get()));
+  err = lighting_->Initialize();
+  if (err != ESP_OK)
+    return err;
+  keyboard_->SetLighting(lighting_.get());
+  usb::HID::SetLEDsChangedCallback(KeyboardLEDsChanged, this);
 #endif
 
   err = wifi_->Inititialize();
   if (err != ESP_OK)
     return err;
 
+  if (!config_->wifi.static_ip.empty()) {
+    err = wifi_->SetStaticIP({
+        .ip = config_->wifi.static_ip,
+        .netmask = config_->wifi.netmask,
+        .gateway = config_->wifi.gateway,
+        .dns = config_->wifi.dns,
+    });
+    if (err != ESP_OK)
+      return err;
+  }
+
+  wifi_ps_type_t idle_ps;
+  err = ParsePowerSave(config_->wifi.power_save, &idle_ps);
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "Invalid Wi-Fi power_save \"%s\".",
+             config_->wifi.power_save.c_str());
+    return err;
+  }
+  err = wifi_->SetPowerConfig({
+      .idle_ps = idle_ps,
+      .listen_interval = static_cast<uint8_t>(
+          std::min<uint32_t>(config_->wifi.listen_interval, UINT8_MAX)),
+      .max_tx_power = static_cast<int8_t>(
+          std::min<uint32_t>(config_->wifi.max_tx_power, INT8_MAX)),
+  });
+  if (err != ESP_OK)
+    return err;
+
   err = wifi_->Connect(config_->wifi.ssid, config_->wifi.key);
   if (err != ESP_OK)
     return err;
@@ -356,17 +662,31 @@ esp_err_t App::Initialize() {
 
   https_server_.reset(new HTTPServer());  // Initialize once online.
 
-  display_.reset(new Display(320, 240));
+  // Shared by the touch controller, keyboard and volume knob interrupts.
+  err = gpio_install_isr_service(ESP_INTR_FLAG_DEFAULT);
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "gpio_install_isr_service failure: %s.",
+             esp_err_to_name(err));
+    return err;
+  }
+
+  display_.reset(new Display(
+      320, 240,
+      std::unique_ptr<TouchController>(
+          new TouchController(kTouchCSGPIO, kTouchINTGPIO))));
   if (!display_->Initialize())
     return ESP_FAIL;
 
-  volume_display_.reset(
-      new VolumeDisplay(i2c::Master(I2C_NUM_1, /*mutex=*/nullptr)));
+  volume_display_.reset(new VolumeDisplay(i2c_bus_1_.get()));
   if (!volume_display_->Initialize())
     return ESP_FAIL;
 
+  err = InitializeVolumeEncoder();
+  if (err != ESP_OK)
+    return err;
+
   spotify_.reset(new Spotify(config_.get(), https_server_.get(), wifi_.get(),
-                             event_group_));
+                             event_bus_.get(), timer_wheel_.get()));
 
   CreateKeyboardSimulatorTask();
   if (err != ESP_OK)
@@ -380,9 +700,19 @@ esp_err_t App::Initialize() {
 }
 
 void App::Run() {
+  run_task_ = xTaskGetCurrentTaskHandle();
   display_->Update();
+  display_->SetGestureListener(run_task_);
+  ESP_ERROR_CHECK_WITHOUT_ABORT(display_->StartRenderTask());
+  stats_timer_->StartPeriodic(kRunTimeStatsPeriodMSecs);
+  diagnostics_->TakeSample();
+  diagnostics_timer_->StartPeriodic(kDiagnosticsPeriodMSecs);
   while (true) {
-    if (uptate_display_time_) {
+    if (sample_diagnostics_.exchange(false))
+      diagnostics_->TakeSample();
+    if (log_stats_.exchange(false))
+      LogRunTimeStats();
+    if (uptate_display_time_.exchange(false)) {
       struct tm now_local;
       {
         time_t now_epoch_coordinated_universal = 0;
@@ -393,17 +723,24 @@ void App::Run() {
       asctime_r(&now_local, tmbuf);
       ESP_LOGI(TAG, "Current time: %s", tmbuf);
       // TODO: Actually update the display.
-      uptate_display_time_ = false;
     }
-    uint32_t wait_msecs = display_->HandleTask() / 1000;
-    if (wait_msecs < kMinMainLoopWaitMSecs)
-      wait_msecs = kMinMainLoopWaitMSecs;
-    else if (wait_msecs > kMaxMainLoopWaitMSecs)
-      wait_msecs = kMaxMainLoopWaitMSecs;
-
+    const int volume_steps = pending_volume_steps_.exchange(0);
+    if (volume_steps)
+      ApplyVolumeSteps(volume_steps);
+    const bool sending_hid_volume = SendHIDVolumeReport();
+    HandleTouchGesture();
+    if (update_player_state_.exchange(false)) {
+      const PlayerState state = spotify_->GetPlayerState();
+      display_->SetPlayerState(state);
+      if (state.volume_percent >= 0)
+        volume_display_->SetVolume(state.volume_percent);
+    }
     if (online_) {
       if (!spotify_->initialized()) {
         ESP_ERROR_CHECK_WITHOUT_ABORT(spotify_->Initialize());
+        // Spotify starts the HTTP server.
+        if (spotify_->initialized())
+          ESP_ERROR_CHECK_WITHOUT_ABORT(RegisterDebugHandlers());
         std::string auth_start_url = spotify_->GetAuthStartURL();
         ESP_LOGI(TAG, "To login to Spotify navigate to %s",
                  auth_start_url.c_str());
@@ -413,19 +750,20 @@ void App::Run() {
         if (spotify_->HaveAuthorizatonCode()) {
           ESP_LOGD(TAG, "Got authorization code, getting token.");
           ESP_ERROR_CHECK_WITHOUT_ABORT(spotify_->ContinueLogin());
-        } else if (spotify_need_access_token_refresh_) {
-          spotify_need_access_token_refresh_ = false;
+        } else if (spotify_need_access_token_refresh_.exchange(false)) {
           spotify_->RefreshAccessToken();
-        } else if (!started_spotify_currently_playing_ &&
+        } else if (!started_spotify_player_task_ &&
                    spotify_->HaveAccessToken()) {
-          ESP_LOGD(TAG, "Getting Spotify currently playing info.");
-          started_spotify_currently_playing_ = true;
-          ESP_ERROR_CHECK_WITHOUT_ABORT(spotify_->GetCurrentlyPlaying());
+          ESP_LOGD(TAG, "Starting Spotify player task.");
+          started_spotify_player_task_ = true;
+          ESP_ERROR_CHECK_WITHOUT_ABORT(spotify_->StartPlayerTask());
         }
       }
     }
-    // Need to use vTaskDelay to avoid triggering the task WDT.
-    vTaskDelay(pdMS_TO_TICKS(wait_msecs));
+    // Everything this loop does is triggered by a notification from another
+    // task or a timer, so there is no need to wake up otherwise, except to
+    // send the next HID report once the host has taken the last.
+    ulTaskNotifyTake(pdTRUE, sending_hid_volume ? 1 : portMAX_DELAY);
     taskYIELD();  // Not sure if this is necessary.
   }
 }
@@ -1,17 +1,25 @@
 #pragma once
 
+#include <atomic>
 #include <memory>
 
 #include <esp_err.h>
 #include <freertos/FreeRTOS.h>
-#include <freertos/event_groups.h>
+
+#include "timer_wheel.h"
 
 class Config;
+class Diagnostics;
 class Display;
+class EventBus;
+struct Event;
 class Filesystem;
 class HTTPServer;
+class I2CBus;
 class Keyboard;
+class Lighting;
 class LEDController;
+class RotaryEncoder;
 class Spotify;
 class VolumeDisplay;
 class WiFi;
@@ -24,37 +32,70 @@ class App {
   esp_err_t Initialize();
   void Run();
 
-  bool is_initialized() const { return event_group_ != nullptr; }
+  bool is_initialized() const { return event_bus_ != nullptr; }
 
  private:
   static void IRAM_ATTR AppEventTask(void*);
   static void IRAM_ATTR KeyboardSimulatorTask(void* arg);
   static void IRAM_ATTR USBTask(void* arg);
   static void IRAM_ATTR KeyboardISR(void* arg);
+  static void KeyboardLEDsChanged(uint8_t leds, void* arg);
   static void IRAM_ATTR SNTPSyncEventHandler(struct timeval* tv);
+  static void StatsTimerCb(void* arg);
+  static void DiagnosticsTimerCb(void* arg);
 
   esp_err_t CreateAppEventTask();
+
+  /**
+   * Handle one event on the event task.
+   *
+   * @return true if the main loop should run to act on it.
+   */
+  bool HandleEvent(const Event& event);
   esp_err_t CreateKeyboardSimulatorTask();
   esp_err_t CreateUSBTask();
   esp_err_t InitializSNTP();
   esp_err_t InstallKeyboardISR();
   esp_err_t InitializeI2C();
   esp_err_t SetTimezone();
+  void LogRunTimeStats();
+  esp_err_t RegisterDebugHandlers();
+  esp_err_t InitializeVolumeEncoder();
+  void ApplyVolumeSteps(int steps);
+  bool SendHIDVolumeReport();
+  void HandleTouchGesture();
 
-  std::unique_ptr<Config> config_;    // Application config data.
-  std::unique_ptr<Display> display_;  // Object owning main display.
+  std::unique_ptr<Config> config_;       // Application config data.
+  std::unique_ptr<EventBus> event_bus_;  // Application events.
+  int event_subscriber_ = -1;            // AppEventTask()'s subscription.
+  std::unique_ptr<TimerWheel> timer_wheel_;  // All application timers.
+  std::unique_ptr<TimerWheel::Timer> stats_timer_;  // Run time stats period.
+  std::unique_ptr<Diagnostics> diagnostics_;  // Stack/heap/CPU samples.
+  std::unique_ptr<TimerWheel::Timer> diagnostics_timer_;  // Sample period.
+  std::unique_ptr<I2CBus> i2c_bus_0_;    // Keyboard.
+  std::unique_ptr<I2CBus> i2c_bus_1_;    // Volume OLED.
+  std::unique_ptr<Display> display_;     // Object owning main display.
   std::unique_ptr<VolumeDisplay> volume_display_;
+  std::unique_ptr<RotaryEncoder> volume_encoder_;  // The volume knob.
   std::unique_ptr<Filesystem> fs_;            // Filesystem object.
   std::unique_ptr<HTTPServer> https_server_;  // Local HTTPS server.
   std::unique_ptr<WiFi> wifi_;                // Controls WiFi.
   std::unique_ptr<Spotify> spotify_;          // All interracitons w/Spotify.
   std::unique_ptr<Keyboard> keyboard_;        // All interaction with keyboard.
+  std::unique_ptr<Lighting> lighting_;        // Keyboard LED effects.
   std::unique_ptr<LEDController> led_controller_;
-  EventGroupHandle_t event_group_ = nullptr;  // Application events.
   TaskHandle_t main_task_ = nullptr;          // Event task.
-  bool online_ = false;                       // Is this device on the network?
-  bool started_spotify_currently_playing_ = false;
-  bool spotify_need_access_token_refresh_ = false;
+  TaskHandle_t run_task_ = nullptr;           // Task executing Run().
+  // Set by other tasks and callbacks, and acted on by Run().
+  std::atomic<bool> online_{false};  // Is this device on the network?
+  std::atomic<bool> spotify_need_access_token_refresh_{false};
+  std::atomic<bool> uptate_display_time_{false};
+  std::atomic<bool> update_player_state_{false};
+  bool started_spotify_player_task_ = false;
   bool sntp_initialized_ = false;
-  bool uptate_display_time_ = false;
+  std::atomic<int> pending_volume_steps_{0};  // Knob turns not yet applied.
+  int hid_volume_steps_ = 0;           // HID volume key presses to send.
+  bool hid_volume_key_down_ = false;   // Was a press sent, but no release?
+  std::atomic<bool> log_stats_{false};        // Log run time stats?
+  std::atomic<bool> sample_diagnostics_{false};  // Take a diagnostics sample?
 };
\ No newline at end of file
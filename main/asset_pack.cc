@@ -0,0 +1,288 @@
+#include "asset_pack.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include <esp_log.h>
+#include <esp_partition.h>
+#include <esp_timer.h>
+
+namespace {
+
+constexpr char TAG[] = "kbd_assets";
+constexpr char kMagic[4] = {'K', 'B', 'A', 'P'};
+constexpr uint16_t kVersion = 2;
+
+enum class Encoding : uint8_t {
+  Raw = 0,
+  RLE = 1,
+};
+
+// File structures. See tools/make_assets.py for the format.
+struct __attribute__((packed)) PackHeader {
+  char magic[4];
+  uint16_t version;
+  uint16_t num_entries;
+};
+
+struct __attribute__((packed)) PackEntry {
+  char name[24];
+  uint8_t color_format;  // lv_img_cf_t.
+  uint8_t encoding;      // Encoding.
+  uint16_t reserved;
+  uint16_t width;
+  uint16_t height;
+  uint32_t offset;     // Offset of data from start of file.
+  uint32_t size;       // Size of (encoded) data.
+  uint32_t data_size;  // Size of decoded data.
+};
+
+static_assert(sizeof(PackHeader) == 8);
+static_assert(sizeof(PackEntry) == 44);
+static_assert(sizeof(lv_img_header_t) == sizeof(uint32_t));
+
+// An open file on the asset drive.
+struct AssetFile {
+  const uint8_t* data;
+  uint32_t size;
+  uint32_t pos;
+};
+
+// The pack registered as an LVGL drive.
+const AssetPack* g_drive_pack;
+
+/**
+ * Expand run-length encoded pixels.
+ *
+ * @return true if |src| decoded to exactly |dst_size| bytes.
+ */
+bool RLEDecode(const uint8_t* src,
+               size_t src_size,
+               uint8_t* dst,
+               size_t dst_size,
+               size_t pixel_size) {
+  const uint8_t* const src_end = src + src_size;
+  const uint8_t* const dst_end = dst + dst_size;
+  while (src < src_end) {
+    const uint8_t control = *src++;
+    const size_t count = (control & 0x7f) + 1;
+    const size_t num_bytes = count * pixel_size;
+    if (static_cast<size_t>(dst_end - dst) < num_bytes)
+      return false;
+    if (control & 0x80) {
+      if (static_cast<size_t>(src_end - src) < pixel_size)
+        return false;
+      for (size_t i = 0; i < count; i++, dst += pixel_size)
+        std::memcpy(dst, src, pixel_size);
+      src += pixel_size;
+    } else {
+      if (static_cast<size_t>(src_end - src) < num_bytes)
+        return false;
+      std::memcpy(dst, src, num_bytes);
+      src += num_bytes;
+      dst += num_bytes;
+    }
+  }
+  return dst == dst_end;
+}
+
+}  // namespace
+
+AssetPack::AssetPack() : mmap_handle_(0), mapped_(false), num_assets_(0) {}
+
+AssetPack::~AssetPack() {
+  if (g_drive_pack == this)
+    g_drive_pack = nullptr;
+  if (mapped_)
+    spi_flash_munmap(mmap_handle_);
+}
+
+esp_err_t AssetPack::Map(const char* partition_label) {
+  if (mapped_)
+    return ESP_ERR_INVALID_STATE;
+  const esp_partition_t* partition = esp_partition_find_first(
+      ESP_PARTITION_TYPE_DATA,
+      static_cast<esp_partition_subtype_t>(kPartitionSubtype),
+      partition_label);
+  if (!partition) {
+    ESP_LOGE(TAG, "No \"%s\" partition", partition_label);
+    return ESP_ERR_NOT_FOUND;
+  }
+  const void* data;
+  esp_err_t err = esp_partition_mmap(partition, 0, partition->size,
+                                     SPI_FLASH_MMAP_DATA, &data,
+                                     &mmap_handle_);
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "Unable to map \"%s\": %s", partition_label,
+             esp_err_to_name(err));
+    return err;
+  }
+  mapped_ = true;
+  return Parse(static_cast<const uint8_t*>(data), partition->size);
+}
+
+esp_err_t AssetPack::Parse(const uint8_t* data, size_t size) {
+  const int64_t start = esp_timer_get_time();
+  if (size < sizeof(PackHeader))
+    return ESP_ERR_INVALID_SIZE;
+  const PackHeader* header = reinterpret_cast<const PackHeader*>(data);
+  if (std::memcmp(header->magic, kMagic, sizeof(kMagic)) ||
+      header->version != kVersion) {
+    ESP_LOGE(TAG, "Invalid asset pack header");
+    return ESP_ERR_INVALID_VERSION;
+  }
+  const size_t num_entries = header->num_entries;
+  if (size < sizeof(PackHeader) + num_entries * sizeof(PackEntry))
+    return ESP_ERR_INVALID_SIZE;
+  const PackEntry* entries =
+      reinterpret_cast<const PackEntry*>(data + sizeof(PackHeader));
+
+  std::unique_ptr<Asset[]> assets(new Asset[num_entries]);
+  for (size_t i = 0; i < num_entries; i++) {
+    const PackEntry& entry = entries[i];
+    Asset& asset = assets[i];
+    if (entry.offset > size || entry.size > size - entry.offset) {
+      ESP_LOGE(TAG, "Asset %u out of bounds", i);
+      return ESP_ERR_INVALID_SIZE;
+    }
+    std::memcpy(asset.name, entry.name, kMaxNameLen);
+    asset.name[kMaxNameLen] = '\0';
+
+    const uint8_t* pixels = data + entry.offset;
+    asset.file = nullptr;
+    if (static_cast<Encoding>(entry.encoding) == Encoding::RLE) {
+      const size_t pixel_size =
+          entry.color_format == LV_IMG_CF_TRUE_COLOR_ALPHA
+              ? LV_IMG_PX_SIZE_ALPHA_BYTE
+              : sizeof(lv_color_t);
+      asset.decoded.reset(new uint8_t[entry.data_size]);
+      if (!RLEDecode(pixels, entry.size, asset.decoded.get(), entry.data_size,
+                     pixel_size)) {
+        ESP_LOGE(TAG, "Asset \"%s\" is corrupt", asset.name);
+        return ESP_ERR_INVALID_SIZE;
+      }
+      pixels = asset.decoded.get();
+    } else if (entry.data_size != entry.size ||
+               entry.offset < sizeof(lv_img_header_t)) {
+      return ESP_ERR_INVALID_SIZE;
+    } else {
+      // Raw images are preceded by an LVGL image header.
+      asset.file = pixels - sizeof(lv_img_header_t);
+    }
+
+    asset.dsc.header.always_zero = 0;
+    asset.dsc.header.cf = entry.color_format;
+    asset.dsc.header.w = entry.width;
+    asset.dsc.header.h = entry.height;
+    asset.dsc.data_size = entry.data_size;
+    asset.dsc.data = pixels;
+  }
+
+  assets_ = std::move(assets);
+  num_assets_ = num_entries;
+  ESP_LOGI(TAG, "Indexed %u assets in %lld us", num_assets_,
+           esp_timer_get_time() - start);
+  return ESP_OK;
+}
+
+const AssetPack::Asset* AssetPack::Find(const char* name) const {
+  // Match up to any extension.
+  const size_t name_len = std::strcspn(name, ".");
+  for (size_t i = 0; i < num_assets_; i++) {
+    if (!std::strncmp(assets_[i].name, name, name_len) &&
+        assets_[i].name[name_len] == '\0') {
+      return &assets_[i];
+    }
+  }
+  return nullptr;
+}
+
+const lv_img_dsc_t* AssetPack::GetImage(const char* name) const {
+  const Asset* asset = Find(name);
+  return asset ? &asset->dsc : nullptr;
+}
+
+// static
+lv_fs_res_t AssetPack::FileOpenCb(lv_fs_drv_t* drv,
+                                  void* file_p,
+                                  const char* path,
+                                  lv_fs_mode_t mode) {
+  if (mode != LV_FS_MODE_RD)
+    return LV_FS_RES_DENIED;
+  const Asset* asset = g_drive_pack ? g_drive_pack->Find(path) : nullptr;
+  if (!asset)
+    return LV_FS_RES_NOT_EX;
+  if (!asset->file)
+    return LV_FS_RES_NOT_IMP;  // Encoded, only available via GetImage().
+  AssetFile* file = static_cast<AssetFile*>(file_p);
+  file->data = asset->file;
+  file->size = sizeof(lv_img_header_t) + asset->dsc.data_size;
+  file->pos = 0;
+  return LV_FS_RES_OK;
+}
+
+// static
+lv_fs_res_t AssetPack::FileCloseCb(lv_fs_drv_t* drv, void* file_p) {
+  return LV_FS_RES_OK;
+}
+
+// static
+lv_fs_res_t AssetPack::FileReadCb(lv_fs_drv_t* drv,
+                                  void* file_p,
+                                  void* buf,
+                                  uint32_t btr,
+                                  uint32_t* br) {
+  AssetFile* file = static_cast<AssetFile*>(file_p);
+  *br = std::min(btr, file->size - file->pos);
+  std::memcpy(buf, file->data + file->pos, *br);
+  file->pos += *br;
+  return LV_FS_RES_OK;
+}
+
+// static
+lv_fs_res_t AssetPack::FileSeekCb(lv_fs_drv_t* drv,
+                                  void* file_p,
+                                  uint32_t pos) {
+  AssetFile* file = static_cast<AssetFile*>(file_p);
+  if (pos > file->size)
+    return LV_FS_RES_INV_PARAM;
+  file->pos = pos;
+  return LV_FS_RES_OK;
+}
+
+// static
+lv_fs_res_t AssetPack::FileTellCb(lv_fs_drv_t* drv,
+                                  void* file_p,
+                                  uint32_t* pos_p) {
+  *pos_p = static_cast<AssetFile*>(file_p)->pos;
+  return LV_FS_RES_OK;
+}
+
+// static
+lv_fs_res_t AssetPack::FileSizeCb(lv_fs_drv_t* drv,
+                                  void* file_p,
+                                  uint32_t* size_p) {
+  *size_p = static_cast<AssetFile*>(file_p)->size;
+  return LV_FS_RES_OK;
+}
+
+esp_err_t AssetPack::RegisterDrive(char letter) {
+  if (g_drive_pack)
+    return ESP_ERR_INVALID_STATE;
+  g_drive_pack = this;
+
+  lv_fs_drv_t drv;
+  lv_fs_drv_init(&drv);
+
+  drv.letter = letter;
+  drv.file_size = sizeof(AssetFile);
+  drv.open_cb = FileOpenCb;
+  drv.close_cb = FileCloseCb;
+  drv.read_cb = FileReadCb;
+  drv.seek_cb = FileSeekCb;
+  drv.tell_cb = FileTellCb;
+  drv.size_cb = FileSizeCb;
+
+  lv_fs_drv_register(&drv);
+  return ESP_OK;
+}
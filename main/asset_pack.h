@@ -0,0 +1,88 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+#include <esp_err.h>
+#include <esp_spi_flash.h>
+#include <lvgl.h>
+
+/**
+ * Images pre-converted (by tools/make_assets.py) to LVGL's native color
+ * format, packed into a single indexed image in a dedicated flash
+ * partition.
+ *
+ * The partition is memory-mapped, so images are handed to LVGL as
+ * ready-to-draw descriptors pointing directly at flash: no decoding, no
+ * file I/O and no copying. Run-length encoded images (if any) are expanded
+ * into RAM once, when the pack is mapped.
+ *
+ * The pack can also be registered as an LVGL drive, where each raw image
+ * is a read-only LVGL binary image file ("A:<name>.bin").
+ */
+class AssetPack {
+ public:
+  // Data subtype of the asset partition (see partitions_keyboard.csv).
+  static constexpr uint8_t kPartitionSubtype = 0x40;
+
+  AssetPack();
+  ~AssetPack();
+
+  /**
+   * Map the pack in the data partition named |partition_label|.
+   */
+  esp_err_t Map(const char* partition_label);
+
+  /**
+   * Return the image named |name| (file name without extension), or nullptr
+   * if not found. Valid for the lifetime of this object.
+   */
+  const lv_img_dsc_t* GetImage(const char* name) const;
+
+  /**
+   * Expose this pack's images as files on LVGL drive |letter|. Only one
+   * pack may be registered.
+   */
+  esp_err_t RegisterDrive(char letter);
+
+ private:
+  static constexpr size_t kMaxNameLen = 23;
+
+  struct Asset {
+    char name[kMaxNameLen + 1];
+    lv_img_dsc_t dsc;
+    const uint8_t* file;  // LVGL image file (header + data), or nullptr.
+    std::unique_ptr<uint8_t[]> decoded;  // Expanded RLE data (if encoded).
+  };
+
+  /**
+   * Parse the pack in |data|, which must outlive this object.
+   */
+  esp_err_t Parse(const uint8_t* data, size_t size);
+
+  static lv_fs_res_t FileOpenCb(lv_fs_drv_t* drv,
+                                void* file_p,
+                                const char* path,
+                                lv_fs_mode_t mode);
+  static lv_fs_res_t FileCloseCb(lv_fs_drv_t* drv, void* file_p);
+  static lv_fs_res_t FileReadCb(lv_fs_drv_t* drv,
+                                void* file_p,
+                                void* buf,
+                                uint32_t btr,
+                                uint32_t* br);
+  static lv_fs_res_t FileSeekCb(lv_fs_drv_t* drv, void* file_p, uint32_t pos);
+  static lv_fs_res_t FileTellCb(lv_fs_drv_t* drv,
+                                void* file_p,
+                                uint32_t* pos_p);
+  static lv_fs_res_t FileSizeCb(lv_fs_drv_t* drv,
+                                void* file_p,
+                                uint32_t* size_p);
+
+  const Asset* Find(const char* name) const;
+
+  spi_flash_mmap_handle_t mmap_handle_;
+  bool mapped_;
+  std::unique_ptr<Asset[]> assets_;
+  size_t num_assets_;
+};
@@ -0,0 +1,206 @@
+#include "binary_log.h"
+
+#include <atomic>
+#include <cstdio>
+
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+
+namespace {
+
+constexpr char TAG[] = "kbd_blog";
+constexpr uint32_t kNumEntries = 128;  // Ring size. Must be a power of two.
+// How long recorded entries may wait before being written out. The flush
+// task sleeps until something is recorded, then waits this long so that
+// entries are written out in batches.
+constexpr uint32_t kFlushPeriodMSecs = 500;
+// Longest formatted message, excluding the ESP_LOG prefix.
+constexpr size_t kMaxMessageLen = 160;
+
+static_assert((kNumEntries & (kNumEntries - 1)) == 0,
+              "Ring indexes must wrap with uint32_t");
+
+struct Entry {
+  // One more than the index of the entry in this slot once completely
+  // written, or zero while being written.
+  std::atomic<uint32_t> seq;
+  uint32_t time_ms;
+  const char* tag;
+  const char* format;
+  uint32_t args[BinaryLog::kMaxArgs];
+  esp_log_level_t level;
+};
+
+Entry g_entries[kNumEntries];
+std::atomic<uint32_t> g_head;  // Count of entries claimed by writers.
+uint32_t g_tail;               // Count of entries read. Guarded by g_mutex.
+uint32_t g_dropped;            // Guarded by g_mutex.
+SemaphoreHandle_t g_mutex;     // Serializes readers.
+TaskHandle_t g_flush_task;
+// Has the flush task been woken for the entries recorded since its last
+// flush?
+std::atomic<bool> g_flush_pending;
+
+char LevelLetter(esp_log_level_t level) {
+  switch (level) {
+    case ESP_LOG_ERROR:
+      return 'E';
+    case ESP_LOG_WARN:
+      return 'W';
+    case ESP_LOG_INFO:
+      return 'I';
+    case ESP_LOG_DEBUG:
+      return 'D';
+    default:
+      return 'V';
+  }
+}
+
+// Format and write one entry, as ESP_LOGx would have.
+void WriteEntry(const Entry& entry) {
+  char message[kMaxMessageLen];
+  // Unused trailing args are ignored by snprintf. Pointers are 32 bits on
+  // this target, so "%s" args can be passed as uint32_t.
+  snprintf(message, sizeof(message), entry.format, entry.args[0],
+           entry.args[1], entry.args[2], entry.args[3]);
+  esp_log_write(entry.level, entry.tag, "%c (%u) %s: %s\n",
+                LevelLetter(entry.level), entry.time_ms, entry.tag, message);
+}
+
+}  // namespace
+
+// static
+void IRAM_ATTR BinaryLog::Record(esp_log_level_t level,
+                                 const char* tag,
+                                 const char* format,
+                                 const uint32_t* args) {
+  const uint32_t idx = g_head.fetch_add(1, std::memory_order_relaxed);
+  Entry& entry = g_entries[idx & (kNumEntries - 1)];
+  entry.seq.store(0, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  entry.time_ms = static_cast<uint32_t>(esp_timer_get_time() / 1000);
+  entry.tag = tag;
+  entry.format = format;
+  for (int i = 0; i < kMaxArgs; i++)
+    entry.args[i] = args[i];
+  entry.level = level;
+  entry.seq.store(idx + 1, std::memory_order_release);
+
+  // Only the first entry after a flush wakes the task. Before Initialize()
+  // the flag is left set: the task flushes once when it starts.
+  if (g_flush_pending.load(std::memory_order_relaxed) ||
+      g_flush_pending.exchange(true, std::memory_order_acq_rel)) {
+    return;
+  }
+  const TaskHandle_t task = g_flush_task;
+  if (!task)
+    return;
+  if (xPortInIsrContext()) {
+    BaseType_t higher_priority_task_woken = pdFALSE;
+    vTaskNotifyGiveFromISR(task, &higher_priority_task_woken);
+    portYIELD_FROM_ISR(higher_priority_task_woken);
+  } else {
+    xTaskNotifyGive(task);
+  }
+}
+
+// static
+void BinaryLog::Flush() {
+  FlushEntries();
+}
+
+// static
+bool BinaryLog::FlushEntries() {
+  if (!g_mutex)
+    return true;
+  bool give_mutex = xSemaphoreTake(g_mutex, portMAX_DELAY) == pdTRUE;
+  const uint32_t head = g_head.load(std::memory_order_acquire);
+  if (head - g_tail > kNumEntries) {
+    g_dropped += head - g_tail - kNumEntries;
+    g_tail = head - kNumEntries;
+  }
+  while (g_tail != head) {
+    const Entry& slot = g_entries[g_tail & (kNumEntries - 1)];
+    const uint32_t seq = slot.seq.load(std::memory_order_acquire);
+    if (seq == 0 || seq == g_tail + 1 - kNumEntries) {
+      // Still being written (possibly by a preempted task): retry later.
+      break;
+    }
+    Entry copy;
+    copy.time_ms = slot.time_ms;
+    copy.tag = slot.tag;
+    copy.format = slot.format;
+    for (int i = 0; i < kMaxArgs; i++)
+      copy.args[i] = slot.args[i];
+    copy.level = slot.level;
+    std::atomic_thread_fence(std::memory_order_acquire);
+    // A writer which lapped the ring may have overwritten the entry while
+    // it was copied.
+    if (seq != g_tail + 1 ||
+        slot.seq.load(std::memory_order_relaxed) != seq) {
+      g_dropped++;
+    } else {
+      WriteEntry(copy);
+    }
+    g_tail++;
+  }
+  const bool done = g_tail == head;
+  if (give_mutex)
+    xSemaphoreGive(g_mutex);
+  return done;
+}
+
+// static
+void BinaryLog::FlushTask(void* arg) {
+  while (true) {
+    vTaskDelay(pdMS_TO_TICKS(kFlushPeriodMSecs));
+    // Cleared first so that entries recorded while flushing wake the task
+    // again.
+    g_flush_pending.store(false, std::memory_order_release);
+    // The writer of an entry still being written (by a preempted task) may
+    // already have found the task woken, so poll until it is done.
+    const bool done = FlushEntries();
+    ulTaskNotifyTake(pdTRUE, done ? portMAX_DELAY
+                                  : pdMS_TO_TICKS(kFlushPeriodMSecs));
+  }
+}
+
+// static
+esp_err_t BinaryLog::Initialize() {
+  if (g_flush_task)
+    return ESP_ERR_INVALID_STATE;
+  g_mutex = xSemaphoreCreateMutex();
+  if (!g_mutex)
+    return ESP_ERR_NO_MEM;
+  // https://www.freertos.org/FAQMem.html#StackSize
+  constexpr uint32_t kStackDepthWords = 2048;
+  // Formatting is the lowest priority work there is.
+  return xTaskCreate(FlushTask, "blog-flush", kStackDepthWords, nullptr,
+                     tskIDLE_PRIORITY, &g_flush_task) == pdPASS
+             ? ESP_OK
+             : ESP_FAIL;
+}
+
+// static
+BinaryLog::Stats BinaryLog::GetStats() {
+  Stats stats = {
+      .recorded = g_head.load(std::memory_order_relaxed),
+      .dropped = 0,
+  };
+  if (!g_mutex)
+    return stats;
+  bool give_mutex = xSemaphoreTake(g_mutex, portMAX_DELAY) == pdTRUE;
+  stats.dropped = g_dropped;
+  if (give_mutex)
+    xSemaphoreGive(g_mutex);
+  return stats;
+}
+
+// static
+void BinaryLog::LogStats() {
+  const Stats stats = GetStats();
+  ESP_LOGI(TAG, "Binary log: %u recorded, %u dropped.", stats.recorded,
+           stats.dropped);
+}
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <cstdint>
+#include <type_traits>
+
+#include <esp_attr.h>
+#include <esp_err.h>
+#include <esp_log.h>
+
+/**
+ * Deferred logging for hot paths.
+ *
+ * ESP_LOGx formats its message and writes it to the console UART before
+ * returning, which can take milliseconds. BinaryLog instead records the
+ * format string's address and the raw argument values in a lock-free RAM
+ * ring, which costs well under a microsecond, and a low priority task
+ * formats and writes the entries later. The format string address is
+ * constant for a given build, so it also identifies the message for offline
+ * (host) decoding.
+ *
+ * Because formatting is deferred:
+ *
+ *   - Arguments are limited to kMaxArgs integers or pointers (no floats).
+ *   - A "%s" argument must point to a string which outlives the entry, e.g.
+ *     a string literal. Never pass a buffer or std::string::c_str().
+ *   - If the ring overflows before being flushed the oldest entries are
+ *     lost (and counted).
+ *
+ * Use via the BLOGx() macros, which honor LOG_LOCAL_LEVEL like ESP_LOGx().
+ * Safe to call from any task or ISR, and before Initialize(). The flush
+ * task only runs after entries are recorded.
+ */
+class BinaryLog {
+ public:
+  static constexpr int kMaxArgs = 4;
+
+  struct Stats {
+    uint32_t recorded;  // Entries recorded.
+    uint32_t dropped;   // Entries overwritten before they were written out.
+  };
+
+  BinaryLog() = delete;
+  ~BinaryLog() = delete;
+
+  /**
+   * Start the task which writes out recorded entries.
+   */
+  static esp_err_t Initialize();
+
+  template <typename... Args>
+  static void Log(esp_log_level_t level,
+                  const char* tag,
+                  const char* format,
+                  Args... args) {
+    static_assert(sizeof...(Args) <= kMaxArgs, "Too many BinaryLog args");
+    const uint32_t values[kMaxArgs] = {ToArg(args)...};
+    Record(level, tag, format, values);
+  }
+
+  /**
+   * Write out all recorded entries now, e.g. before a restart.
+   */
+  static void Flush();
+
+  static Stats GetStats();
+  static void LogStats();
+
+ private:
+  template <typename T>
+  static uint32_t ToArg(T value) {
+    static_assert(!std::is_floating_point<T>::value,
+                  "BinaryLog can't record floating point args");
+    static_assert(sizeof(T) <= sizeof(uint32_t),
+                  "BinaryLog args must be 32 bits or smaller");
+    if constexpr (std::is_pointer<T>::value)
+      return reinterpret_cast<uintptr_t>(value);
+    else
+      return static_cast<uint32_t>(value);
+  }
+
+  static void IRAM_ATTR Record(esp_log_level_t level,
+                               const char* tag,
+                               const char* format,
+                               const uint32_t* args);
+  static void FlushTask(void* arg);
+
+  /**
+   * @return true if every recorded entry was written out (or dropped),
+   *         false if one was still being written.
+   */
+  static bool FlushEntries();
+};
+
+#define BLOG_LEVEL(level, tag, format, ...)              \
+  do {                                                   \
+    if (LOG_LOCAL_LEVEL >= level)                        \
+      BinaryLog::Log(level, tag, format, ##__VA_ARGS__); \
+  } while (0)
+
+#define BLOGE(tag, format, ...) \
+  BLOG_LEVEL(ESP_LOG_ERROR, tag, format, ##__VA_ARGS__)
+#define BLOGW(tag, format, ...) \
+  BLOG_LEVEL(ESP_LOG_WARN, tag, format, ##__VA_ARGS__)
+#define BLOGI(tag, format, ...) \
+  BLOG_LEVEL(ESP_LOG_INFO, tag, format, ##__VA_ARGS__)
+#define BLOGD(tag, format, ...) \
+  BLOG_LEVEL(ESP_LOG_DEBUG, tag, format, ##__VA_ARGS__)
+#define BLOGV(tag, format, ...) \
+  BLOG_LEVEL(ESP_LOG_VERBOSE, tag, format, ##__VA_ARGS__)
@@ -1,10 +1,21 @@
+#pragma once
 
+#include <cstdint>
 #include <string>
 
 struct Config {
   struct {
-    std::string ssid;  // The SSID.
-    std::string key;   // The pre-shared key.
+    std::string ssid;       // The SSID.
+    std::string key;        // The pre-shared key.
+    std::string static_ip;  // Use DHCP if empty.
+    std::string netmask;    // Used with |static_ip|.
+    std::string gateway;    // Used with |static_ip|.
+    std::string dns;        // Optional, used with |static_ip|.
+
+    // Modem sleep mode while idle: "none", "min_modem" or "max_modem".
+    std::string power_save = "min_modem";
+    uint32_t listen_interval = 3;  // Beacons between "max_modem" wakes.
+    uint32_t max_tx_power = 0;     // In 0.25 dBm units, 0 for the default.
   } wifi;
   struct {
     std::string client_id;
@@ -14,4 +25,7 @@ struct Config {
     std::string timezone;
     std::string ntp_server;
   } time;
+  struct {
+    uint32_t sleep_timeout_ms = 5000;  // Idle time before the LM8330 sleeps.
+  } keyboard;
 };
\ No newline at end of file
@@ -1,5 +1,6 @@
 #include "config_reader.h"
 
+#include <cstdlib>
 #include <cstring>
 
 #include <esp_log.h>
@@ -27,6 +28,20 @@ int handler(void* user,
       config->wifi.ssid = value;
     else if (streq(name, "key"))
       config->wifi.key = value;
+    else if (streq(name, "static_ip"))
+      config->wifi.static_ip = value;
+    else if (streq(name, "netmask"))
+      config->wifi.netmask = value;
+    else if (streq(name, "gateway"))
+      config->wifi.gateway = value;
+    else if (streq(name, "dns"))
+      config->wifi.dns = value;
+    else if (streq(name, "power_save"))
+      config->wifi.power_save = value;
+    else if (streq(name, "listen_interval"))
+      config->wifi.listen_interval = strtoul(value, nullptr, 10);
+    else if (streq(name, "max_tx_power"))
+      config->wifi.max_tx_power = strtoul(value, nullptr, 10);
     else
       return 1;  // Unknown key.
   }
@@ -35,6 +50,9 @@ int handler(void* user,
       config->time.ntp_server = value;
     else if (streq(name, "timezone"))
       config->time.timezone = value;
+  } else if (streq(section, "keyboard")) {
+    if (streq(name, "sleep_timeout_ms"))
+      config->keyboard.sleep_timeout_ms = strtoul(value, nullptr, 10);
   } else {
     return 1;  // Unknown section.
   }
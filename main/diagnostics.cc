@@ -0,0 +1,244 @@
+#include "diagnostics.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <string>
+
+#include <esp_heap_caps.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+
+namespace {
+
+constexpr char TAG[] = "kbd_diag";
+
+// Warn when a task has less than this much stack left unused.
+constexpr uint32_t kMinStackFreeBytes = 512;
+
+struct HeapInfo {
+  const char* name;
+  uint32_t caps;            // MALLOC_CAP_* flags.
+  uint32_t alert;           // Diagnostics::kAlertHeap* bit.
+  uint32_t min_free_bytes;  // Warn when less than this is free.
+};
+
+// Indexed by Diagnostics::Heap.
+constexpr HeapInfo kHeaps[] = {
+    {"internal", MALLOC_CAP_INTERNAL, Diagnostics::kAlertHeapInternal,
+     16 * 1024},
+    {"dma", MALLOC_CAP_DMA, Diagnostics::kAlertHeapDMA, 8 * 1024},
+    {"spiram", MALLOC_CAP_SPIRAM, Diagnostics::kAlertHeapSPIRAM, 256 * 1024},
+};
+
+}  // namespace
+
+Diagnostics::Diagnostics()
+    : mutex_(xSemaphoreCreateMutex()),
+      samples_(new Sample[kNumSamples]),
+      next_sample_(0),
+      num_samples_(0),
+      prev_total_run_time_(0),
+      num_prev_tasks_(0) {}
+
+Diagnostics::~Diagnostics() {
+  vSemaphoreDelete(mutex_);
+}
+
+void Diagnostics::SampleHeaps(Sample* sample) const {
+  static_assert(sizeof(kHeaps) / sizeof(kHeaps[0]) == kNumHeaps);
+
+  for (int i = 0; i < kNumHeaps; i++) {
+    multi_heap_info_t info;
+    heap_caps_get_info(&info, kHeaps[i].caps);
+    sample->heaps[i] = {
+        .free_bytes = info.total_free_bytes,
+        .min_free_bytes = info.minimum_free_bytes,
+        .largest_block = info.largest_free_block,
+    };
+    // An absent heap (no PSRAM fitted) is not low on memory.
+    if (info.total_allocated_bytes + info.total_free_bytes &&
+        info.total_free_bytes < kHeaps[i].min_free_bytes) {
+      sample->alerts |= kHeaps[i].alert;
+    }
+  }
+}
+
+void Diagnostics::SampleTasks(Sample* sample) {
+#if CONFIG_FREERTOS_USE_TRACE_FACILITY
+  // Allow for a few tasks being created while this one is preempted.
+  const UBaseType_t max_tasks = uxTaskGetNumberOfTasks() + 4;
+  std::unique_ptr<TaskStatus_t[]> status(new TaskStatus_t[max_tasks]);
+  uint32_t total_run_time = 0;
+  const UBaseType_t num_tasks =
+      uxTaskGetSystemState(status.get(), max_tasks, &total_run_time);
+  const uint32_t elapsed = total_run_time - prev_total_run_time_;
+
+  TaskRunTime run_times[kMaxTasks];
+  sample->num_tasks = std::min<UBaseType_t>(num_tasks, kMaxTasks);
+  sample->num_skipped_tasks = num_tasks - sample->num_tasks;
+  for (int i = 0; i < sample->num_tasks; i++) {
+    const TaskStatus_t& task = status[i];
+    TaskStats& stats = sample->tasks[i];
+    snprintf(stats.name, sizeof(stats.name), "%s", task.pcTaskName);
+    // ESP-IDF stacks are measured in bytes, not words.
+    stats.stack_free_bytes = task.usStackHighWaterMark;
+    stats.priority = task.uxCurrentPriority;
+
+    // A task not in the previous sample has run since it was created.
+    const TaskRunTime* prev =
+        std::find_if(prev_tasks_, prev_tasks_ + num_prev_tasks_,
+                     [&task](const TaskRunTime& prev) {
+                       return prev.handle == task.xHandle;
+                     });
+    const bool known = prev != prev_tasks_ + num_prev_tasks_;
+    const uint32_t ran = task.ulRunTimeCounter - (known ? prev->run_time : 0);
+    stats.cpu_permille =
+        elapsed ? std::min<uint64_t>(ran * 1000ULL / elapsed, 1000) : 0;
+
+    const bool low_stack = stats.stack_free_bytes < kMinStackFreeBytes;
+    if (low_stack) {
+      sample->alerts |= kAlertTaskStack;
+      if (!known || !prev->low_stack) {
+        ESP_LOGW(TAG, "Task \"%s\" stack low: %u bytes unused.", stats.name,
+                 stats.stack_free_bytes);
+      }
+    }
+    run_times[i] = {
+        .handle = task.xHandle,
+        .run_time = task.ulRunTimeCounter,
+        .low_stack = low_stack,
+    };
+  }
+
+  std::copy(run_times, run_times + sample->num_tasks, prev_tasks_);
+  num_prev_tasks_ = sample->num_tasks;
+  prev_total_run_time_ = total_run_time;
+#else
+  sample->num_tasks = 0;
+  sample->num_skipped_tasks = uxTaskGetNumberOfTasks();
+#endif
+}
+
+void Diagnostics::LogNewAlerts(const Sample& sample,
+                               uint32_t prev_alerts) const {
+  for (int i = 0; i < kNumHeaps; i++) {
+    if ((sample.alerts & kHeaps[i].alert) && !(prev_alerts & kHeaps[i].alert)) {
+      ESP_LOGW(TAG, "Heap \"%s\" low: %u bytes free, largest block %u.",
+               kHeaps[i].name, sample.heaps[i].free_bytes,
+               sample.heaps[i].largest_block);
+    }
+  }
+}
+
+void Diagnostics::TakeSample() {
+  bool give_mutex = xSemaphoreTake(mutex_, portMAX_DELAY) == pdTRUE;
+  const uint32_t prev_alerts =
+      num_samples_
+          ? samples_[(next_sample_ + kNumSamples - 1) % kNumSamples].alerts
+          : 0;
+  Sample& sample = samples_[next_sample_];
+  sample.time_ms = static_cast<uint32_t>(esp_timer_get_time() / 1000);
+  sample.alerts = 0;
+  SampleHeaps(&sample);
+  SampleTasks(&sample);
+  LogNewAlerts(sample, prev_alerts);
+  next_sample_ = (next_sample_ + 1) % kNumSamples;
+  if (num_samples_ < kNumSamples)
+    num_samples_++;
+  if (give_mutex)
+    xSemaphoreGive(mutex_);
+}
+
+size_t Diagnostics::GetSamples(Sample* samples, size_t max_samples) const {
+  bool give_mutex = xSemaphoreTake(mutex_, portMAX_DELAY) == pdTRUE;
+  const size_t count = std::min(max_samples, num_samples_);
+  size_t idx = (next_sample_ + kNumSamples - count) % kNumSamples;
+  for (size_t i = 0; i < count; i++) {
+    samples[i] = samples_[idx];
+    idx = (idx + 1) % kNumSamples;
+  }
+  if (give_mutex)
+    xSemaphoreGive(mutex_);
+  return count;
+}
+
+void Diagnostics::LogStats() const {
+  std::unique_ptr<Sample> sample(new Sample);
+  if (!GetSamples(sample.get(), 1))
+    return;
+  for (int i = 0; i < kNumHeaps; i++) {
+    const HeapStats& heap = sample->heaps[i];
+    ESP_LOGI(TAG, "Heap %s: %u free, %u min free, %u largest block.",
+             kHeaps[i].name, heap.free_bytes, heap.min_free_bytes,
+             heap.largest_block);
+  }
+  for (int i = 0; i < sample->num_tasks; i++) {
+    const TaskStats& task = sample->tasks[i];
+    ESP_LOGI(TAG, "Task %-16s pri %2u, %5u stack bytes unused, %u.%u%% CPU.",
+             task.name, task.priority, task.stack_free_bytes,
+             task.cpu_permille / 10, task.cpu_permille % 10);
+  }
+}
+
+// static
+esp_err_t Diagnostics::HTTPHandler(httpd_req_t* request) {
+  const Diagnostics* diagnostics =
+      static_cast<const Diagnostics*>(request->user_ctx);
+  httpd_resp_set_type(request, "application/json");
+
+  // Samples are sent one chunk each to keep the response buffer small.
+  std::unique_ptr<Sample> sample(new Sample);
+  std::string json;
+  for (size_t i = 0;; i++) {
+    {
+      bool give_mutex =
+          xSemaphoreTake(diagnostics->mutex_, portMAX_DELAY) == pdTRUE;
+      const size_t count = diagnostics->num_samples_;
+      if (i < count) {
+        const size_t idx =
+            (diagnostics->next_sample_ + kNumSamples - count + i) %
+            kNumSamples;
+        *sample = diagnostics->samples_[idx];
+      }
+      if (give_mutex)
+        xSemaphoreGive(diagnostics->mutex_);
+      if (i >= count)
+        break;
+    }
+
+    char buf[160];
+    snprintf(buf, sizeof(buf), "%s{\"time_ms\":%u,\"alerts\":%u,\"heaps\":{",
+             i ? "," : "{\"samples\":[", sample->time_ms, sample->alerts);
+    json = buf;
+    for (int h = 0; h < kNumHeaps; h++) {
+      const HeapStats& heap = sample->heaps[h];
+      snprintf(buf, sizeof(buf),
+               "%s\"%s\":{\"free\":%u,\"min_free\":%u,\"largest_block\":%u}",
+               h ? "," : "", kHeaps[h].name, heap.free_bytes,
+               heap.min_free_bytes, heap.largest_block);
+      json += buf;
+    }
+    snprintf(buf, sizeof(buf), "},\"skipped_tasks\":%u,\"tasks\":[",
+             sample->num_skipped_tasks);
+    json += buf;
+    for (int t = 0; t < sample->num_tasks; t++) {
+      const TaskStats& task = sample->tasks[t];
+      snprintf(buf, sizeof(buf),
+               "%s{\"name\":\"%s\",\"priority\":%u,\"stack_free\":%u,"
+               "\"cpu_permille\":%u}",
+               t ? "," : "", task.name, task.priority, task.stack_free_bytes,
+               task.cpu_permille);
+      json += buf;
+    }
+    json += "]}";
+    esp_err_t err = httpd_resp_send_chunk(request, json.data(), json.length());
+    if (err != ESP_OK)
+      return err;
+  }
+
+  json = json.empty() ? "{\"samples\":[]}" : "]}";
+  esp_err_t err = httpd_resp_send_chunk(request, json.data(), json.length());
+  if (err != ESP_OK)
+    return err;
+  return httpd_resp_send_chunk(request, nullptr, 0);
+}
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+#include <esp_err.h>
+#include <esp_http_server.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+
+/**
+ * Periodic samples of task stack, heap and CPU usage.
+ *
+ * Each call to TakeSample() records, for every task, its stack high water
+ * mark and the share of CPU time it used since the previous sample, and for
+ * each heap (internal, DMA capable and PSRAM) the free, minimum ever free
+ * and largest free block sizes. Samples are kept in a fixed size ring
+ * buffer which is served as JSON over HTTP, and a warning is logged when a
+ * task's unused stack or a heap's free space first falls below its
+ * threshold.
+ *
+ * The samples show how much of each reservation is really used, so stack
+ * and heap sizes can be reduced with some confidence.
+ */
+class Diagnostics {
+ public:
+  enum class Heap : uint8_t { Internal, DMA, SPIRAM };
+
+  static constexpr int kNumHeaps = 3;
+  static constexpr int kMaxTasks = 24;      // Tasks recorded per sample.
+  static constexpr size_t kNumSamples = 32;  // Ring buffer size.
+  static constexpr char kURI[] = "/debug/diagnostics";
+
+  // Sample::alerts bits.
+  static constexpr uint32_t kAlertTaskStack = 1u << 0;
+  static constexpr uint32_t kAlertHeapInternal = 1u << 1;
+  static constexpr uint32_t kAlertHeapDMA = 1u << 2;
+  static constexpr uint32_t kAlertHeapSPIRAM = 1u << 3;
+
+  struct HeapStats {
+    uint32_t free_bytes;      // Currently free.
+    uint32_t min_free_bytes;  // Least ever free (since boot).
+    uint32_t largest_block;   // Largest allocation which would succeed.
+  };
+
+  struct TaskStats {
+    char name[configMAX_TASK_NAME_LEN];
+    uint32_t stack_free_bytes;  // Least unused stack (since task creation).
+    uint16_t cpu_permille;      // CPU used since the previous sample.
+    uint8_t priority;
+  };
+
+  struct Sample {
+    uint32_t time_ms;  // When sampled (since boot).
+    uint32_t alerts;   // kAlert* bits of the thresholds exceeded.
+    HeapStats heaps[kNumHeaps];
+    uint16_t num_tasks;
+    uint16_t num_skipped_tasks;  // Tasks beyond kMaxTasks, not recorded.
+    TaskStats tasks[kMaxTasks];
+  };
+
+  Diagnostics();
+  ~Diagnostics();
+
+  /**
+   * Record a sample. Walks every task and heap, so call from a task which
+   * can spare the time (not a timer callback).
+   */
+  void TakeSample();
+
+  /**
+   * Copy up to |max_samples| of the most recent samples, oldest first.
+   *
+   * @return The number of samples copied.
+   */
+  size_t GetSamples(Sample* samples, size_t max_samples) const;
+
+  /**
+   * Log a summary of the most recent sample.
+   */
+  void LogStats() const;
+
+  /**
+   * HTTP GET handler for kURI returning all samples as JSON. |user_ctx| must
+   * be the Diagnostics instance.
+   */
+  static esp_err_t HTTPHandler(httpd_req_t* request);
+
+ private:
+  // Run time of a task at the previous sample, to compute CPU usage.
+  struct TaskRunTime {
+    TaskHandle_t handle;
+    uint32_t run_time;
+    bool low_stack;  // Was the task's stack below the threshold?
+  };
+
+  void SampleHeaps(Sample* sample) const;
+  void SampleTasks(Sample* sample);
+  void LogNewAlerts(const Sample& sample, uint32_t prev_alerts) const;
+
+  SemaphoreHandle_t mutex_;  // Synchronize access to following members.
+  std::unique_ptr<Sample[]> samples_;
+  size_t next_sample_;
+  size_t num_samples_;
+  uint32_t prev_total_run_time_;
+  int num_prev_tasks_;
+  TaskRunTime prev_tasks_[kMaxTasks];
+};
@@ -1,80 +1,177 @@
 #include "display.h"
 
+#include <algorithm>
+#include <utility>
+
 #include <esp_err.h>
-#include <esp_idf_version.h>
 #include <esp_log.h>
-#include <esp_timer.h>
 #include <lv_lib_png/lv_png.h>
 #include <lv_lib_split_jpg/lv_sjpg.h>
 #include <lvgl.h>
 #include <lvgl_helpers.h>
 
 #include "lvgl_drive.h"
+#include "lvgl_lock.h"
 #include "main_screen.h"
+#include "player_state.h"
+#include "power_manager.h"
+#include "touch_controller.h"
 
 namespace {
 
 const char TAG[] = "display";
-const uint64_t kTickTimerPeriodUsec = 1000;
-const uint16_t kNumBufferRows = 20;
+const char kAssetPartition[] = "assets";
+const char kAssetDriveLetter = 'A';
+// Each buffer is 320 * 40 * 2 = 25 KiB. Allocated from internal DMA capable
+// RAM so that the SPI driver sends it directly instead of first copying
+// (large malloc's otherwise land in PSRAM).
+const uint16_t kNumBufferRows = 40;
+const uint32_t kMinRenderWaitMSecs = 1;
+const uint32_t kMaxRenderWaitMSecs = 100;
+
+// Set once the touch controller is successfully initialized.
+const TouchController* g_touch_controller = nullptr;
 
-bool my_touchpad_read(lv_indev_drv_t* indev_driver, lv_indev_data_t* data) {
-  return false;
+lv_color_t* AllocDMABuffer(uint32_t num_pixels) {
+  return static_cast<lv_color_t*>(
+      heap_caps_malloc(num_pixels * sizeof(lv_color_t), MALLOC_CAP_DMA));
 }
 
 }  // namespace
 
-Display::Display(uint16_t width, uint16_t height)
-    : initialized_(false),
-      last_tick_time_(-1),
-      tick_timer_(nullptr),
+// LVGL reads its tick directly from esp_timer_get_time() (see the
+// LV_TICK_CUSTOM settings in sdkconfig) instead of being incremented by a
+// periodic timer which would wake the CPU every millisecond.
+#if !LV_TICK_CUSTOM
+#error "CONFIG_LV_TICK_CUSTOM must be enabled."
+#endif
+
+Display::Display(uint16_t width,
+                 uint16_t height,
+                 std::unique_ptr<TouchController> touch_controller)
+    : touch_controller_(std::move(touch_controller)),
+      initialized_(false),
       width_(width),
       height_(height),
-      display_buf_1_(new lv_color_t[width * kNumBufferRows]),
-      display_buf_2_(new lv_color_t[width * kNumBufferRows]),
+      display_buf_1_(AllocDMABuffer(width * kNumBufferRows)),
+      display_buf_2_(AllocDMABuffer(width * kNumBufferRows)),
       disp_driver_(nullptr),
       lv_screen_(nullptr),
-      input_driver_(nullptr) {
+      input_driver_(nullptr),
+      render_task_(nullptr),
+      profiler_("main") {
   ESP_LOGD(TAG, "Created display %ux%u.", width, height);
 
+  lvgl::Lock::Initialize();
   lv_init();
   lvgl_driver_init();
   lv_png_init();
   lv_split_jpeg_init();
 }
 
-Display::~Display() = default;
+Display::~Display() {
+  if (g_touch_controller) {
+    touch_controller_->SetListener(nullptr);
+    touch_controller_->SetGestureListener(nullptr);
+  }
+  if (render_task_)
+    vTaskDelete(render_task_);
+  g_touch_controller = nullptr;
+}
 
-void Display::Tick() {
-  int64_t now = esp_timer_get_time();
-  uint32_t tick_period = last_tick_time_ == -1 ? 0 : now - last_tick_time_;
-  lv_tick_inc(tick_period);
-  last_tick_time_ = now;
+// static
+bool Display::TouchpadRead(lv_indev_drv_t* indev_driver,
+                           lv_indev_data_t* data) {
+  if (!g_touch_controller) {
+    data->state = LV_INDEV_STATE_REL;
+    return false;
+  }
+  const TouchController::Point point = g_touch_controller->GetPoint();
+  // The panel is mounted in landscape: rotate the portrait touch point.
+  const lv_coord_t height = lv_disp_get_ver_res(indev_driver->disp);
+  data->point.x = point.y;
+  data->point.y = height - 1 - point.x;
+  data->state = point.pressed ? LV_INDEV_STATE_PR : LV_INDEV_STATE_REL;
+  // Once released (LVGL has seen the release) stop reading until the touch
+  // controller reports the next press, so the render task can sleep.
+  if (!point.pressed)
+    lv_task_set_prio(indev_driver->read_task, LV_TASK_PRIO_OFF);
+  return false;  // No more data to read.
 }
 
-void Display::TickTimerCb(void* arg) {
-  static_cast<Display*>(arg)->Tick();
+void Display::SetGestureListener(TaskHandle_t task) {
+  if (g_touch_controller)
+    touch_controller_->SetGestureListener(task);
 }
 
-esp_err_t Display::CreateTickTimer() {
-  const esp_timer_create_args_t timer_args = {
-    .callback = TickTimerCb,
-    .arg = this,
-    .dispatch_method = ESP_TIMER_TASK,
-    .name = "RadioDisplay::TickTimer",
-#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(4, 3, 0)
-    .skip_unhandled_events = true,
-#endif
-  };
-  esp_err_t err = esp_timer_create(&timer_args, &tick_timer_);
-  if (err != ESP_OK) {
-    ESP_LOGE(TAG, "Unable to create the periodic tick timer");
-    return err;
+TouchController::Gesture Display::TakeGesture() {
+  using Gesture = TouchController::Gesture;
+  if (!g_touch_controller)
+    return Gesture::None;
+  // Rotate as in TouchpadRead(): the panel's +y is the screen's +x, and the
+  // panel's +x is the screen's -y.
+  switch (touch_controller_->TakeGesture()) {
+    case Gesture::None:
+      return Gesture::None;
+    case Gesture::Tap:
+      return Gesture::Tap;
+    case Gesture::SwipeUp:
+      return Gesture::SwipeLeft;
+    case Gesture::SwipeRight:
+      return Gesture::SwipeUp;
+    case Gesture::SwipeDown:
+      return Gesture::SwipeRight;
+    case Gesture::SwipeLeft:
+      return Gesture::SwipeDown;
+  }
+  return Gesture::None;
+}
+
+// static
+void Display::RenderTask(void* arg) {
+  Display* display = static_cast<Display*>(arg);
+  bool touched = false;
+  while (true) {
+    uint32_t wait_msecs;
+    {
+      lvgl::Lock lock;
+      PowerManager::Lock cpu_lock(PowerManager::Lock::Type::CPUMax);
+      if (touched) {
+        // Read the input device until it is released again.
+        lv_task_t* read_task = display->input_driver_->driver.read_task;
+        lv_task_set_prio(read_task, LV_TASK_PRIO_MID);
+        lv_task_ready(read_task);
+      }
+      FrameProfiler::BeginTaskHandler();
+      wait_msecs = lv_task_handler();
+      FrameProfiler::EndTaskHandler();
+    }
+    wait_msecs = std::min(std::max(wait_msecs, kMinRenderWaitMSecs),
+                          kMaxRenderWaitMSecs);
+    const TickType_t wait_ticks =
+        std::max<TickType_t>(1, pdMS_TO_TICKS(wait_msecs));
+    // Woken early by the touch controller when the panel is pressed.
+    touched = ulTaskNotifyTake(pdTRUE, wait_ticks) != 0;
+  }
+}
+
+esp_err_t Display::StartRenderTask() {
+  // https://www.freertos.org/FAQMem.html#StackSize
+  constexpr uint32_t kStackDepthWords = 4096;
+
+  if (!initialized_)
+    return ESP_ERR_INVALID_STATE;
+  if (render_task_)
+    return ESP_OK;
+  // Above the main (Run) task so that frame pacing is independent of
+  // network and login processing.
+  if (xTaskCreate(RenderTask, "lvgl-render", kStackDepthWords, this,
+                  tskIDLE_PRIORITY + 2, &render_task_) != pdPASS) {
+    return ESP_FAIL;
   }
-  err = esp_timer_start_periodic(tick_timer_, kTickTimerPeriodUsec);
-  if (err != ESP_OK)
-    ESP_LOGE(TAG, "Unable to install the periodic tick timer");
-  return err;
+  if (g_touch_controller)
+    touch_controller_->SetListener(render_task_);
+  return ESP_OK;
 }
 
 bool Display::Initialize() {
@@ -84,6 +181,11 @@ bool Display::Initialize() {
     return true;
   }
 
+  if (!display_buf_1_ || !display_buf_2_) {
+    ESP_LOGE(TAG, "Unable to allocate DMA display buffers");
+    return false;
+  }
+
   const uint32_t num_pixels = width_ * kNumBufferRows;
   lv_disp_buf_init(&disp_buf_, display_buf_1_.get(), display_buf_2_.get(),
                    num_pixels);
@@ -91,17 +193,31 @@ bool Display::Initialize() {
   lv_disp_drv_t disp_drv;
   lv_disp_drv_init(&disp_drv);
 
+  // disp_driver_flush() queues the stripe as an asynchronous SPI (DMA)
+  // transaction and returns; the SPI post-transaction callback calls
+  // lv_disp_flush_ready(). Meanwhile LVGL renders into the other buffer.
   disp_drv.flush_cb = disp_driver_flush;
   disp_drv.buffer = &disp_buf_;
   disp_driver_ = lv_disp_drv_register(&disp_drv);
   if (!disp_driver_)
     return false;
 
+  if (profiler_.Attach(disp_driver_) != ESP_OK)
+    ESP_LOGW(TAG, "Unable to profile display");
+
+  // Not fatal, the display works without touch. The touch controller
+  // shares the display's SPI bus, initialized by lvgl_driver_init().
+  if (touch_controller_ &&
+      ESP_ERROR_CHECK_WITHOUT_ABORT(
+          touch_controller_->Initialize(TFT_SPI_HOST)) == ESP_OK) {
+    g_touch_controller = touch_controller_.get();
+  }
+
   lv_indev_drv_t indev_drv;
   lv_indev_drv_init(&indev_drv);
 
   indev_drv.type = LV_INDEV_TYPE_POINTER;
-  indev_drv.read_cb = my_touchpad_read;
+  indev_drv.read_cb = TouchpadRead;
   input_driver_ = lv_indev_drv_register(&indev_drv);
   if (!input_driver_)
     return false;
@@ -110,30 +226,35 @@ bool Display::Initialize() {
   if (!lv_screen_)
     return false;
 
-  if (CreateTickTimer() != ESP_OK)
-    return false;
-
   if (lvgl::Drive::Initialize() != ESP_OK)
     return false;
 
+  // Not fatal, screens draw without images.
+  if (ESP_ERROR_CHECK_WITHOUT_ABORT(assets_.Map(kAssetPartition)) == ESP_OK)
+    ESP_ERROR_CHECK_WITHOUT_ABORT(assets_.RegisterDrive(kAssetDriveLetter));
+
   initialized_ = true;
   ESP_LOGD(TAG, "Display successfully initialized");
   return true;
 }
 
-uint32_t Display::HandleTask() {
-  return lv_task_handler();
-}
-
 bool Display::Update() {
   if (!initialized_) {
     ESP_LOGE(TAG, "Display not initialized (or failed).");
     return false;
   }
 
+  lvgl::Lock lock;
   if (!screen_)
     screen_.reset(new MainScreen(*this));
 
   screen_->Update();
   return true;
 }
+
+void Display::SetPlayerState(const PlayerState& state) {
+  lvgl::Lock lock;
+  if (!screen_)
+    return;
+  screen_->SetPlayerState(state);
+}
@@ -3,37 +3,80 @@
 #include <cstdint>
 #include <memory>
 
-#include <esp_timer.h>
+#include <esp_err.h>
+#include <esp_heap_caps.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
 #include <lvgl.h>
 
+#include "asset_pack.h"
+#include "frame_profiler.h"
+#include "touch_controller.h"
+
 class MainScreen;
+struct PlayerState;
 
+/**
+ * The main (SPI TFT) display.
+ *
+ * Once started, a dedicated render task runs LVGL (for all displays). Any
+ * other task calling LVGL must hold an lvgl::Lock.
+ */
 class Display {
  public:
-  Display(uint16_t width, uint16_t height);
+  Display(uint16_t width,
+          uint16_t height,
+          std::unique_ptr<TouchController> touch_controller);
   ~Display();
 
   bool Initialize();
+
+  /**
+   * Start the task which runs lv_task_handler().
+   */
+  esp_err_t StartRenderTask();
+
   bool Update();
-  uint32_t HandleTask();
+  void SetPlayerState(const PlayerState& state);
+
+  /**
+   * Notify |task| (via xTaskNotifyGive) each time a touch gesture is
+   * recognized.
+   */
+  void SetGestureListener(TaskHandle_t task);
+
+  /**
+   * Return the most recent touch gesture, in screen orientation, if any,
+   * and reset it to None.
+   */
+  TouchController::Gesture TakeGesture();
+
   lv_obj_t* screen() { return lv_screen_; }
+  FrameProfiler& profiler() { return profiler_; }
+  const AssetPack& assets() const { return assets_; }
 
  private:
-  static void TickTimerCb(void* arg);
+  struct HeapCapsDeleter {
+    void operator()(lv_color_t* buf) const { heap_caps_free(buf); }
+  };
+  using DMABuffer = std::unique_ptr<lv_color_t, HeapCapsDeleter>;
 
-  esp_err_t CreateTickTimer();
-  void Tick();
+  static void RenderTask(void* arg);
+  static bool TouchpadRead(lv_indev_drv_t* indev_driver,
+                           lv_indev_data_t* data);
 
   std::unique_ptr<MainScreen> screen_;
+  std::unique_ptr<TouchController> touch_controller_;
   bool initialized_;
-  int64_t last_tick_time_;
-  esp_timer_handle_t tick_timer_;
   const uint16_t width_;
   const uint16_t height_;
-  std::unique_ptr<lv_color_t[]> display_buf_1_;
-  std::unique_ptr<lv_color_t[]> display_buf_2_;
+  DMABuffer display_buf_1_;  // Rendered into while |display_buf_2_| is sent.
+  DMABuffer display_buf_2_;  // ... and vice versa.
   lv_disp_buf_t disp_buf_;
   lv_disp_t* disp_driver_;
   lv_obj_t* lv_screen_;
   lv_indev_t* input_driver_;
+  TaskHandle_t render_task_;
+  FrameProfiler profiler_;
+  AssetPack assets_;  // Pre-decoded images, mapped from flash.
 };
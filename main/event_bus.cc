@@ -0,0 +1,147 @@
+#include "event_bus.h"
+
+#include <esp_log.h>
+
+namespace {
+constexpr char TAG[] = "kbd_events";
+}  // namespace
+
+EventBus::EventBus()
+    : mux_(portMUX_INITIALIZER_UNLOCKED), num_subscribers_(0), next_seq_(0) {}
+
+EventBus::~EventBus() {
+  for (int i = 0; i < num_subscribers_; i++)
+    vSemaphoreDelete(subscribers_[i].ready);
+}
+
+int EventBus::Subscribe(Filter filter) {
+  portENTER_CRITICAL(&mux_);
+  const int id = num_subscribers_;
+  portEXIT_CRITICAL(&mux_);
+  if (id == kMaxSubscribers)
+    return -1;
+
+  // Not visible to Enqueue() until |num_subscribers_| is incremented.
+  Subscriber& subscriber = subscribers_[id];
+  subscriber.filter = filter;
+  subscriber.head = 0;
+  subscriber.tail = 0;
+  subscriber.overflowed = 0;
+  subscriber.stats = {};
+  subscriber.ready = xSemaphoreCreateCountingStatic(
+      kQueueSize + kNumEventTypes, 0, &subscriber.ready_buffer);
+
+  portENTER_CRITICAL(&mux_);
+  num_subscribers_++;
+  portEXIT_CRITICAL(&mux_);
+  return id;
+}
+
+bool IRAM_ATTR EventBus::Enqueue(const Event& event,
+                                 bool from_isr,
+                                 BaseType_t* higher_priority_task_woken) {
+  const Filter mask = Mask(event.type);
+  const int type = static_cast<int>(event.type);
+  SemaphoreHandle_t ready[kMaxSubscribers];
+  int num_ready = 0;
+  bool all_kept = true;
+
+  portENTER_CRITICAL_SAFE(&mux_);
+  const uint32_t seq = next_seq_++;
+  for (int i = 0; i < num_subscribers_; i++) {
+    Subscriber& subscriber = subscribers_[i];
+    if (!(subscriber.filter & mask))
+      continue;
+    const uint32_t depth = subscriber.head - subscriber.tail;
+    // Once anything has overflowed, later events overflow too so that they
+    // aren't delivered before it.
+    if (depth == kQueueSize || subscriber.overflowed) {
+      subscriber.overflow[type] = event;
+      subscriber.overflow_seq[type] = seq;
+      if (subscriber.overflowed & mask) {
+        // Replaces an event already counted by |ready|.
+        subscriber.stats.replaced++;
+        all_kept = false;
+        continue;
+      }
+      subscriber.overflowed |= mask;
+    } else {
+      subscriber.events[subscriber.head % kQueueSize] = event;
+      subscriber.head++;
+      if (depth + 1 > subscriber.stats.max_depth)
+        subscriber.stats.max_depth = depth + 1;
+    }
+    subscriber.stats.delivered++;
+    ready[num_ready++] = subscriber.ready;
+  }
+  portEXIT_CRITICAL_SAFE(&mux_);
+
+  // Given after the event is written, so a taken count is always backed by
+  // a queued event.
+  for (int i = 0; i < num_ready; i++) {
+    if (from_isr)
+      xSemaphoreGiveFromISR(ready[i], higher_priority_task_woken);
+    else
+      xSemaphoreGive(ready[i]);
+  }
+  return all_kept;
+}
+
+bool EventBus::Post(const Event& event) {
+  return Enqueue(event, /*from_isr=*/false, nullptr);
+}
+
+bool IRAM_ATTR EventBus::PostFromISR(const Event& event,
+                                     BaseType_t* higher_priority_task_woken) {
+  return Enqueue(event, /*from_isr=*/true, higher_priority_task_woken);
+}
+
+// static
+Event EventBus::TakeOverflow(Subscriber* subscriber) {
+  int oldest = -1;
+  for (int type = 0; type < kNumEventTypes; type++) {
+    if (!(subscriber->overflowed & (1u << type)))
+      continue;
+    // Compared by difference so that sequence wrap-around is harmless.
+    const uint32_t seq = subscriber->overflow_seq[type];
+    if (oldest == -1 ||
+        static_cast<int32_t>(seq - subscriber->overflow_seq[oldest]) < 0) {
+      oldest = type;
+    }
+  }
+  subscriber->overflowed &= ~(1u << oldest);
+  return subscriber->overflow[oldest];
+}
+
+bool EventBus::Take(int subscriber_id, Event* event, TickType_t timeout) {
+  Subscriber& subscriber = subscribers_[subscriber_id];
+  if (xSemaphoreTake(subscriber.ready, timeout) != pdTRUE)
+    return false;
+  portENTER_CRITICAL(&mux_);
+  if (subscriber.head != subscriber.tail) {
+    *event = subscriber.events[subscriber.tail % kQueueSize];
+    subscriber.tail++;
+  } else {
+    *event = TakeOverflow(&subscriber);
+  }
+  portEXIT_CRITICAL(&mux_);
+  return true;
+}
+
+EventBus::Stats EventBus::GetStats(int subscriber_id) const {
+  portENTER_CRITICAL(&mux_);
+  const Stats stats = subscribers_[subscriber_id].stats;
+  portEXIT_CRITICAL(&mux_);
+  return stats;
+}
+
+void EventBus::LogStats() const {
+  portENTER_CRITICAL(&mux_);
+  const int num_subscribers = num_subscribers_;
+  portEXIT_CRITICAL(&mux_);
+  for (int i = 0; i < num_subscribers; i++) {
+    const Stats stats = GetStats(i);
+    ESP_LOGI(TAG, "Subscriber %d: delivered=%u replaced=%u max_depth=%u/%u",
+             i, stats.delivered, stats.replaced, stats.max_depth, kQueueSize);
+  }
+}
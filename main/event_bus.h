@@ -0,0 +1,108 @@
+#pragma once
+
+#include <cstdint>
+
+#include <esp_attr.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+
+#include "event_ids.h"
+
+/**
+ * Delivers application events, with their data, to subscribers.
+ *
+ * Each subscriber has a fixed size ring of the events matching its filter,
+ * so no event is lost or merged with another of the same type while the
+ * subscriber keeps up. If it falls a whole ring behind, later events
+ * overflow into one slot per event type, where a newer event replaces an
+ * undelivered one of the same type (and is counted). Overflowed events are
+ * delivered after the ring, in the order they were (last) posted. So the
+ * latest event of every type is always delivered, e.g. an interrupt that is
+ * disabled until its event is handled is always re-enabled. Posting never
+ * blocks or allocates and is safe from an ISR.
+ */
+class EventBus {
+ public:
+  typedef uint32_t Filter;  // A bit per EventType.
+
+  static constexpr int kMaxSubscribers = 4;
+  static constexpr uint32_t kQueueSize = 16;  // Events per subscriber.
+  static constexpr int kNumEventTypes = static_cast<int>(EventType::Count);
+  static constexpr Filter kAllEvents = (1u << kNumEventTypes) - 1;
+
+  static_assert((kQueueSize & (kQueueSize - 1)) == 0,
+                "Ring indexes must wrap with uint32_t");
+
+  static constexpr Filter Mask(EventType type) {
+    return 1u << static_cast<int>(type);
+  }
+
+  /**
+   * Delivery counters of one subscriber.
+   */
+  struct Stats {
+    uint32_t delivered;  // Events queued for the subscriber.
+    uint32_t replaced;   // Overflowed events replaced by a newer one.
+    uint32_t max_depth;  // Most events queued in the ring at once.
+  };
+
+  EventBus();
+  ~EventBus();
+
+  /**
+   * Start queuing the events in |filter| for a new subscriber.
+   *
+   * Subscribers are added during start-up, from one task.
+   *
+   * @return The subscriber ID, or -1 if there are already kMaxSubscribers.
+   */
+  int Subscribe(Filter filter);
+
+  /**
+   * Post an event to every subscriber whose filter matches it.
+   *
+   * @return false if, for any subscriber, the event replaced an undelivered
+   *         event of the same type.
+   */
+  bool Post(const Event& event);
+  bool IRAM_ATTR PostFromISR(const Event& event,
+                             BaseType_t* higher_priority_task_woken);
+
+  /**
+   * Take |subscriber|'s oldest event, waiting up to |timeout| for one.
+   *
+   * @return true if |event| was set.
+   */
+  bool Take(int subscriber, Event* event, TickType_t timeout);
+
+  Stats GetStats(int subscriber) const;
+  void LogStats() const;
+
+ private:
+  struct Subscriber {
+    Filter filter;
+    uint32_t head;      // Count of events written.
+    uint32_t tail;      // Count of events read.
+    Filter overflowed;  // Types with an event in |overflow|.
+    Stats stats;
+    SemaphoreHandle_t ready;  // Counts the queued and overflowed events.
+    StaticSemaphore_t ready_buffer;
+    Event events[kQueueSize];
+    Event overflow[kNumEventTypes];         // Indexed by EventType.
+    uint32_t overflow_seq[kNumEventTypes];  // When each was posted.
+  };
+
+  bool IRAM_ATTR Enqueue(const Event& event,
+                         bool from_isr,
+                         BaseType_t* higher_priority_task_woken);
+
+  /**
+   * Remove |subscriber|'s oldest overflowed event. Call with |mux_| held.
+   */
+  static Event TakeOverflow(Subscriber* subscriber);
+
+  mutable portMUX_TYPE mux_;  // Synchronize access to following members.
+  int num_subscribers_;
+  uint32_t next_seq_;  // Orders overflowed events.
+  Subscriber subscribers_[kMaxSubscribers];
+};
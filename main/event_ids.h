@@ -1,13 +1,48 @@
 #pragma once
 
-#include <event_groups.h>
-
-constexpr EventBits_t EVENT_NETWORK_GOT_IP = BIT0;
-constexpr EventBits_t EVENT_NETWORK_DISCONNECTED = BIT1;
-constexpr EventBits_t EVENT_SPOTIFY_GOT_AUTHORIZATION_CODE = BIT2;
-constexpr EventBits_t EVENT_SPOTIFY_ACCESS_TOKEN_GOOD = BIT3;
-constexpr EventBits_t EVENT_SPOTIFY_ACCESS_TOKEN_FAILURE = BIT4;
-constexpr EventBits_t EVENT_SPOTIFY_ACCESS_TOKEN_EXPIRE = BIT5;
-constexpr EventBits_t EVENT_KEYBOARD_EVENT = BIT6;
-constexpr EventBits_t EVENT_ALL =
-    BIT0 | BIT1 | BIT2 | BIT3 | BIT4 | BIT5 | BIT6;
+#include <cstdint>
+
+#include <esp_err.h>
+
+/**
+ * Application events posted to the EventBus.
+ */
+enum class EventType : uint8_t {
+  NetworkGotIP,
+  NetworkDisconnected,
+  SpotifyGotAuthorizationCode,
+  SpotifyAccessTokenGood,
+  SpotifyAccessTokenFailure,
+  SpotifyAccessTokenExpire,
+  SpotifyPlayerStateChanged,
+  KeyboardInterrupt,
+  KeyboardLEDsChanged,
+  Count,
+};
+
+/**
+ * An event and its (type specific) data.
+ */
+struct Event {
+  EventType type;
+  union {
+    struct {
+      uint32_t ip;  // IPv4 address, network byte order.
+    } network_got_ip;
+    struct {
+      uint8_t reason;  // wifi_err_reason_t of the last attempt.
+    } network_disconnected;
+    struct {
+      int32_t expires_in_secs;  // Time until the token is refreshed.
+    } access_token_good;
+    struct {
+      esp_err_t err;
+    } access_token_failure;
+    struct {
+      int64_t irq_time_us;  // When the INT line fired.
+    } keyboard_interrupt;
+    struct {
+      uint8_t leds;  // KEYBOARD_LED_* set by the host.
+    } keyboard_leds;
+  };
+};
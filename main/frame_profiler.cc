@@ -0,0 +1,306 @@
+#include "frame_profiler.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+
+#include <esp_log.h>
+#include <esp_timer.h>
+
+#include "lvgl_lock.h"
+
+namespace {
+
+constexpr char TAG[] = "kbd_frames";
+constexpr int64_t kLogPeriodUsecs = 10 * 1000 * 1000;
+constexpr int64_t kOverlayPeriodUsecs = 1000 * 1000;
+// Number of recent frames summarized by the overlay.
+constexpr size_t kOverlayFrames = 16;
+
+uint32_t AreaPixels(const lv_area_t* area) {
+  return (area->x2 - area->x1 + 1) * (area->y2 - area->y1 + 1);
+}
+
+}  // namespace
+
+// static
+FrameProfiler* FrameProfiler::profilers_[kMaxProfilers];
+
+// static
+int64_t FrameProfiler::frame_start_us_;
+
+// static
+int64_t FrameProfiler::last_log_us_;
+
+// static
+int64_t FrameProfiler::last_overlay_us_;
+
+FrameProfiler::FrameProfiler(const char* name)
+    : name_(name),
+      disp_(nullptr),
+      flush_cb_(nullptr),
+      overlay_(nullptr),
+      flush_us_(0),
+      pixels_(0),
+      num_areas_(0),
+      waiting_(false),
+      wait_start_us_(0),
+      last_wait_us_(0),
+      next_frame_(0),
+      num_frames_(0),
+      log_frames_(0),
+      log_render_us_(0),
+      log_flush_us_(0),
+      log_max_frame_us_(0),
+      log_pixels_(0) {}
+
+FrameProfiler::~FrameProfiler() {
+  lvgl::Lock lock;
+  for (size_t i = 0; i < kMaxProfilers; i++) {
+    if (profilers_[i] == this)
+      profilers_[i] = nullptr;
+  }
+  if (disp_)
+    disp_->driver.flush_cb = flush_cb_;
+}
+
+esp_err_t FrameProfiler::Attach(lv_disp_t* disp) {
+  lvgl::Lock lock;
+  if (disp_)
+    return ESP_ERR_INVALID_STATE;
+  FrameProfiler** slot =
+      std::find(profilers_, profilers_ + kMaxProfilers, nullptr);
+  if (slot == profilers_ + kMaxProfilers)
+    return ESP_ERR_NO_MEM;
+  *slot = this;
+
+  disp_ = disp;
+  flush_cb_ = disp->driver.flush_cb;
+  disp->driver.flush_cb = FlushCb;
+  disp->driver.monitor_cb = MonitorCb;
+  disp->driver.wait_cb = WaitCb;
+  return ESP_OK;
+}
+
+// static
+FrameProfiler* FrameProfiler::Find(const lv_disp_drv_t* disp_drv) {
+  for (FrameProfiler* profiler : profilers_) {
+    if (profiler && &profiler->disp_->driver == disp_drv)
+      return profiler;
+  }
+  return nullptr;
+}
+
+void FrameProfiler::EndWait() {
+  if (!waiting_)
+    return;
+  // WaitCb is called in a tight loop, so the last call is (very nearly)
+  // when the flush completed.
+  flush_us_ += last_wait_us_ - wait_start_us_;
+  waiting_ = false;
+}
+
+// static
+void FrameProfiler::WaitCb(lv_disp_drv_t* disp_drv) {
+  FrameProfiler* profiler = Find(disp_drv);
+  if (!profiler)
+    return;
+  const int64_t now = esp_timer_get_time();
+  if (!profiler->waiting_) {
+    profiler->waiting_ = true;
+    profiler->wait_start_us_ = now;
+  }
+  profiler->last_wait_us_ = now;
+}
+
+// static
+void FrameProfiler::FlushCb(lv_disp_drv_t* disp_drv,
+                            const lv_area_t* area,
+                            lv_color_t* color_p) {
+  FrameProfiler* profiler = Find(disp_drv);
+  if (!profiler)
+    return;
+  profiler->EndWait();
+  const int64_t start = esp_timer_get_time();
+  profiler->flush_cb_(disp_drv, area, color_p);
+  profiler->flush_us_ += esp_timer_get_time() - start;
+  profiler->pixels_ += AreaPixels(area);
+  profiler->num_areas_++;
+}
+
+// static
+void FrameProfiler::MonitorCb(lv_disp_drv_t* disp_drv,
+                              uint32_t time,
+                              uint32_t px) {
+  FrameProfiler* profiler = Find(disp_drv);
+  if (!profiler)
+    return;
+  profiler->EndWait();
+  const int64_t now = esp_timer_get_time();
+  const uint32_t frame_us = now - frame_start_us_;
+  const uint32_t flush_us = std::min(profiler->flush_us_, frame_us);
+  profiler->AddFrame(Frame{
+      .time_ms = static_cast<uint32_t>(now / 1000),
+      .render_us = frame_us - flush_us,
+      .flush_us = flush_us,
+      .pixels = profiler->pixels_,
+      .num_areas = profiler->num_areas_,
+  });
+  profiler->flush_us_ = 0;
+  profiler->pixels_ = 0;
+  profiler->num_areas_ = 0;
+  // The next display's frame (if any) starts now.
+  frame_start_us_ = now;
+}
+
+void FrameProfiler::AddFrame(const Frame& frame) {
+  frames_[next_frame_] = frame;
+  next_frame_ = (next_frame_ + 1) % kNumFrames;
+  if (num_frames_ < kNumFrames)
+    num_frames_++;
+
+  log_frames_++;
+  log_render_us_ += frame.render_us;
+  log_flush_us_ += frame.flush_us;
+  log_max_frame_us_ =
+      std::max(log_max_frame_us_, frame.render_us + frame.flush_us);
+  log_pixels_ += frame.pixels;
+}
+
+size_t FrameProfiler::GetFrames(Frame* frames, size_t max_frames) const {
+  const size_t count = std::min(max_frames, num_frames_);
+  size_t idx = (next_frame_ + kNumFrames - count) % kNumFrames;
+  for (size_t i = 0; i < count; i++) {
+    frames[i] = frames_[idx];
+    idx = (idx + 1) % kNumFrames;
+  }
+  return count;
+}
+
+void FrameProfiler::LogSummary(int64_t elapsed_us) {
+  if (log_frames_) {
+    // LVGL only refreshes invalidated areas, so this is the redraw rate.
+    const uint32_t fps_x10 = log_frames_ * 10000000LL / elapsed_us;
+    ESP_LOGI(TAG,
+             "%s: %u frames, %u.%u fps, render avg %llu us, flush avg %llu us, "
+             "max frame %u us, %llu px/frame",
+             name_, log_frames_, fps_x10 / 10, fps_x10 % 10,
+             log_render_us_ / log_frames_, log_flush_us_ / log_frames_,
+             log_max_frame_us_, log_pixels_ / log_frames_);
+  }
+  log_frames_ = 0;
+  log_render_us_ = 0;
+  log_flush_us_ = 0;
+  log_max_frame_us_ = 0;
+  log_pixels_ = 0;
+}
+
+void FrameProfiler::SetOverlayEnabled(bool enabled) {
+  lvgl::Lock lock;
+  if (!disp_ || enabled == (overlay_ != nullptr))
+    return;
+  if (!enabled) {
+    lv_obj_del(overlay_);
+    overlay_ = nullptr;
+    return;
+  }
+  overlay_ = lv_label_create(lv_disp_get_layer_top(disp_), nullptr);
+  if (!overlay_)
+    return;
+  lv_label_set_text(overlay_, "");
+  lv_obj_align(overlay_, nullptr, LV_ALIGN_IN_BOTTOM_RIGHT, 0, 0);
+}
+
+void FrameProfiler::UpdateOverlay() {
+  if (!overlay_)
+    return;
+  Frame frames[kOverlayFrames];
+  const size_t count = GetFrames(frames, kOverlayFrames);
+  if (!count)
+    return;
+  uint32_t render_us = 0;
+  uint32_t flush_us = 0;
+  for (size_t i = 0; i < count; i++) {
+    render_us += frames[i].render_us;
+    flush_us += frames[i].flush_us;
+  }
+  lv_label_set_text_fmt(overlay_, "r%u f%u us", render_us / count,
+                        flush_us / count);
+  lv_obj_align(overlay_, nullptr, LV_ALIGN_IN_BOTTOM_RIGHT, 0, 0);
+}
+
+// static
+void FrameProfiler::BeginTaskHandler() {
+  frame_start_us_ = esp_timer_get_time();
+}
+
+// static
+void FrameProfiler::EndTaskHandler() {
+  const int64_t now = esp_timer_get_time();
+  if (now - last_overlay_us_ >= kOverlayPeriodUsecs) {
+    last_overlay_us_ = now;
+    for (FrameProfiler* profiler : profilers_) {
+      if (profiler)
+        profiler->UpdateOverlay();
+    }
+  }
+  if (now - last_log_us_ >= kLogPeriodUsecs) {
+    for (FrameProfiler* profiler : profilers_) {
+      if (profiler)
+        profiler->LogSummary(now - last_log_us_);
+    }
+    last_log_us_ = now;
+  }
+}
+
+// static
+esp_err_t FrameProfiler::HTTPHandler(httpd_req_t* request) {
+  char query[32];
+  char value[4];
+  if (httpd_req_get_url_query_str(request, query, sizeof(query)) == ESP_OK &&
+      httpd_query_key_value(query, "overlay", value, sizeof(value)) ==
+          ESP_OK) {
+    const bool enabled = std::strcmp(value, "0") != 0;
+    lvgl::Lock lock;
+    for (FrameProfiler* profiler : profilers_) {
+      if (profiler)
+        profiler->SetOverlayEnabled(enabled);
+    }
+  }
+
+  std::unique_ptr<Frame[]> frames(new Frame[kNumFrames]);
+  std::string json = "{";
+  for (size_t p = 0; p < kMaxProfilers; p++) {
+    const char* name;
+    size_t count;
+    {
+      lvgl::Lock lock;
+      if (!profilers_[p])
+        continue;
+      name = profilers_[p]->name();
+      count = profilers_[p]->GetFrames(frames.get(), kNumFrames);
+    }
+    if (json.length() > 1)
+      json += ',';
+    json += '"';
+    json += name;
+    json += "\":[";
+    for (size_t i = 0; i < count; i++) {
+      const Frame& frame = frames[i];
+      char buf[112];
+      snprintf(buf, sizeof(buf),
+               "%s{\"time_ms\":%u,\"render_us\":%u,\"flush_us\":%u,"
+               "\"pixels\":%u,\"areas\":%u}",
+               i ? "," : "", frame.time_ms, frame.render_us, frame.flush_us,
+               frame.pixels, frame.num_areas);
+      json += buf;
+    }
+    json += ']';
+  }
+  json += '}';
+
+  httpd_resp_set_type(request, "application/json");
+  return httpd_resp_send(request, json.data(), json.length());
+}
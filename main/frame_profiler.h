@@ -0,0 +1,121 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include <esp_err.h>
+#include <esp_http_server.h>
+#include <lvgl.h>
+
+/**
+ * Records per-frame render and flush timing for an LVGL display.
+ *
+ * Attaching to a display wraps its flush callback and installs monitor and
+ * wait callbacks. Each refresh produces a Frame which is stored in a fixed
+ * size ring buffer:
+ *
+ *   flush_us:  Time spent in the display's flush callback plus time LVGL
+ *              was blocked waiting for a previous (asynchronous) flush.
+ *   render_us: The rest of the frame, i.e. LVGL drawing (and any other LVGL
+ *              work done in the same lv_task_handler() call).
+ *
+ * All profiler state is accessed from within lv_task_handler(), or while
+ * holding an lvgl::Lock.
+ */
+class FrameProfiler {
+ public:
+  struct Frame {
+    uint32_t time_ms;    // When the frame completed (since boot).
+    uint32_t render_us;  // Render time.
+    uint32_t flush_us;   // Flush time.
+    uint32_t pixels;     // Number of pixels flushed.
+    uint16_t num_areas;  // Number of areas flushed.
+  };
+
+  static constexpr size_t kNumFrames = 64;  // Ring buffer size.
+  static constexpr char kURI[] = "/debug/frames";
+
+  explicit FrameProfiler(const char* name);
+  ~FrameProfiler();
+
+  /**
+   * Start profiling |disp|, which must already be registered.
+   */
+  esp_err_t Attach(lv_disp_t* disp);
+
+  /**
+   * Show (or hide) a one line summary on the display's top layer.
+   *
+   * Note: Updating the overlay causes (small) refreshes of its own.
+   */
+  void SetOverlayEnabled(bool enabled);
+
+  /**
+   * Copy up to |max_frames| of the most recent frames, oldest first.
+   *
+   * @return The number of frames copied.
+   */
+  size_t GetFrames(Frame* frames, size_t max_frames) const;
+
+  const char* name() const { return name_; }
+
+  /**
+   * Must be called immediately before calling lv_task_handler().
+   */
+  static void BeginTaskHandler();
+
+  /**
+   * Must be called immediately after calling lv_task_handler() (while still
+   * holding the lvgl::Lock). Periodically logs and updates overlays.
+   */
+  static void EndTaskHandler();
+
+  /**
+   * HTTP GET handler for kURI returning all profilers' frames as JSON.
+   * Query "?overlay=1" (or 0) shows (or hides) the overlays.
+   */
+  static esp_err_t HTTPHandler(httpd_req_t* request);
+
+ private:
+  static constexpr size_t kMaxProfilers = 2;
+
+  static FrameProfiler* Find(const lv_disp_drv_t* disp_drv);
+  static void FlushCb(lv_disp_drv_t* disp_drv,
+                      const lv_area_t* area,
+                      lv_color_t* color_p);
+  static void MonitorCb(lv_disp_drv_t* disp_drv, uint32_t time, uint32_t px);
+  static void WaitCb(lv_disp_drv_t* disp_drv);
+
+  void EndWait();
+  void AddFrame(const Frame& frame);
+  void LogSummary(int64_t elapsed_us);
+  void UpdateOverlay();
+
+  static FrameProfiler* profilers_[kMaxProfilers];
+  static int64_t frame_start_us_;  // Start of the current frame.
+  static int64_t last_log_us_;
+  static int64_t last_overlay_us_;
+
+  const char* name_;
+  lv_disp_t* disp_;
+  // The display driver's original flush callback.
+  void (*flush_cb_)(lv_disp_drv_t*, const lv_area_t*, lv_color_t*);
+  lv_obj_t* overlay_;
+  // The in-progress frame.
+  uint32_t flush_us_;
+  uint32_t pixels_;
+  uint16_t num_areas_;
+  bool waiting_;          // Is LVGL waiting for a flush to complete?
+  int64_t wait_start_us_;
+  int64_t last_wait_us_;  // Last time WaitCb was called.
+  // Completed frames.
+  Frame frames_[kNumFrames];
+  size_t next_frame_;
+  size_t num_frames_;
+  // Totals since |last_log_us_|.
+  uint32_t log_frames_;
+  uint64_t log_render_us_;
+  uint64_t log_flush_us_;
+  uint32_t log_max_frame_us_;
+  uint64_t log_pixels_;
+};
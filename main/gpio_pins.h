@@ -13,17 +13,26 @@ constexpr gpio_num_t kI2C0SCL = GPIO_NUM_9;           // I2C port 0 SCL GPIO.
 constexpr gpio_num_t kKeyboardINTGPIO = GPIO_NUM_38;  // Keyboard event INT.
 constexpr gpio_num_t kI2C1SDA = GPIO_NUM_1;           // I2C port 1 SDA GPIO.
 constexpr gpio_num_t kI2C1SCL = GPIO_NUM_3;           // I2C port 1 SCL GPIO.
+constexpr gpio_num_t kEncoderAGPIO = GPIO_NUM_6;      // Volume knob CLK (A).
+constexpr gpio_num_t kEncoderBGPIO = GPIO_NUM_12;     // Volume knob DT (B).
+constexpr gpio_num_t kTouchCSGPIO = GPIO_NUM_10;      // Touch SPI CS.
+constexpr gpio_num_t kTouchINTGPIO = GPIO_NUM_11;     // Touch PENIRQ.
 
 /*
  * The SPI pins, used for display/touch, are specified in sdkconfig.
  *
  * SPI-CS-DISP  = 7
  * SPI-CS-TOUCH = 10
- * SPI-MOSI     = 35 (used for touch, but not display)
+ * SPI-MOSI     = 35
  * SPI-SCK      = 36
- * SPI-MISO     = 37
+ * SPI-MISO     = 37 (used for touch, but not display)
  * DC           = 5
  * Reset        = 0 (TODO: verify this)
+ *
+ * The volume knob's push switch (SW) is wired to GPIO 13, which is also the
+ * activity LED, so it is not used.
+ *
+ * The resistive touch controller (XPT2046) shares the display's SPI bus.
  */
 
 #elif (BOARD_CUCUMBER == 1)
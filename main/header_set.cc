@@ -0,0 +1,67 @@
+#include "header_set.h"
+
+#include <cstring>
+
+// static
+std::atomic<uint32_t> HeaderSet::next_generation_(1);
+
+HeaderSet::HeaderSet()
+    : num_headers_(0), arena_used_(0), generation_(next_generation_++) {}
+
+int HeaderSet::Append(const char* str, size_t len, size_t extra) {
+  if (arena_used_ + len + extra + 1 > kArenaSize)
+    return -1;
+  const int offset = arena_used_;
+  std::memcpy(arena_ + offset, str, len);
+  arena_[offset + len] = '\0';
+  arena_used_ += len + extra + 1;
+  return offset;
+}
+
+esp_err_t HeaderSet::Add(const char* name, const char* value) {
+  size_t slot;
+  return AddSlot(name, value, 0, &slot);
+}
+
+esp_err_t HeaderSet::AddSlot(const char* name,
+                             const char* prefix,
+                             size_t capacity,
+                             size_t* slot) {
+  if (num_headers_ == kMaxHeaders)
+    return ESP_ERR_NO_MEM;
+  const size_t prefix_len = std::strlen(prefix);
+  const int name_offset = Append(name, std::strlen(name), 0);
+  if (name_offset < 0)
+    return ESP_ERR_NO_MEM;
+  const int value_offset = Append(prefix, prefix_len, capacity);
+  if (value_offset < 0) {
+    arena_used_ = name_offset;
+    return ESP_ERR_NO_MEM;
+  }
+  entries_[num_headers_] = {
+      .name = static_cast<uint16_t>(name_offset),
+      .value = static_cast<uint16_t>(value_offset),
+      .prefix_len = static_cast<uint16_t>(prefix_len),
+      .slot_capacity = static_cast<uint16_t>(capacity),
+  };
+  *slot = num_headers_++;
+  generation_ = next_generation_++;
+  return ESP_OK;
+}
+
+esp_err_t HeaderSet::SetSlot(size_t slot, const char* value, size_t value_len) {
+  if (slot >= num_headers_)
+    return ESP_ERR_INVALID_ARG;
+  const Entry& entry = entries_[slot];
+  if (value_len > entry.slot_capacity)
+    return ESP_ERR_INVALID_SIZE;
+  char* dst = arena_ + entry.value + entry.prefix_len;
+  std::memcpy(dst, value, value_len);
+  dst[value_len] = '\0';
+  generation_ = next_generation_++;
+  return ESP_OK;
+}
+
+HeaderSet::Header HeaderSet::operator[](size_t idx) const {
+  return Header{arena_ + entries_[idx].name, arena_ + entries_[idx].value};
+}
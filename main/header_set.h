@@ -0,0 +1,83 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#include <esp_err.h>
+
+/**
+ * A fixed-capacity set of HTTP request headers.
+ *
+ * Header names and values are stored in an inline arena so that a set can
+ * be built once and reused for every request without allocating. A header
+ * may reserve a fixed-capacity value "slot" that is later overwritten in
+ * place (e.g. the bearer token after a refresh).
+ *
+ * Every modification assigns the set a new, process-wide unique generation
+ * so that an HTTPClient can skip re-applying headers it has already sent.
+ */
+class HeaderSet {
+ public:
+  // A non-owning view of one header. Valid until the set is modified.
+  struct Header {
+    const char* name;
+    const char* value;
+  };
+
+  static constexpr size_t kMaxHeaders = 4;
+  static constexpr size_t kArenaSize = 768;
+
+  HeaderSet();
+
+  /**
+   * Add a header with a fixed value.
+   */
+  esp_err_t Add(const char* name, const char* value);
+
+  /**
+   * Add a header whose value is |prefix| followed by an updatable part of
+   * up to |capacity| characters (initially empty).
+   *
+   * @param slot Receives the index passed to SetSlot().
+   */
+  esp_err_t AddSlot(const char* name,
+                    const char* prefix,
+                    size_t capacity,
+                    size_t* slot);
+
+  /**
+   * Replace the updatable part of a slot's value.
+   *
+   * @return ESP_ERR_INVALID_SIZE if |value_len| exceeds the slot capacity.
+   */
+  esp_err_t SetSlot(size_t slot, const char* value, size_t value_len);
+
+  size_t size() const { return num_headers_; }
+  Header operator[](size_t idx) const;
+  uint32_t generation() const { return generation_; }
+
+ private:
+  struct Entry {
+    uint16_t name;           // Arena offset of the name.
+    uint16_t value;          // Arena offset of the value.
+    uint16_t prefix_len;     // Length of the fixed value prefix.
+    uint16_t slot_capacity;  // Capacity of the updatable part.
+  };
+
+  static std::atomic<uint32_t> next_generation_;
+
+  /**
+   * Copy |len| characters of |str| into the arena, leaving room for
+   * |extra| more characters and a terminator.
+   *
+   * @return The arena offset, or -1 if the arena is full.
+   */
+  int Append(const char* str, size_t len, size_t extra);
+
+  Entry entries_[kMaxHeaders];
+  size_t num_headers_;
+  size_t arena_used_;
+  uint32_t generation_;
+  char arena_[kArenaSize];
+};
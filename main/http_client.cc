@@ -1,12 +1,21 @@
-#define LOG_LOCAL_LEVEL ESP_LOG_VERBOSE
+#define LOG_LOCAL_LEVEL ESP_LOG_INFO
 
 #include "http_client.h"
 
+#include <cstdlib>
+#include <utility>
+
+#include <strings.h>
+
 #include <esp_crt_bundle.h>
 #include <esp_http_client.h>
 #include <esp_log.h>
 #include <esp_tls.h>
 
+#include "binary_log.h"
+#include "header_set.h"
+#include "power_manager.h"
+
 namespace {
 constexpr char TAG[] = "kbd_httpc";
 }  // namespace
@@ -53,8 +62,14 @@ esp_err_t HTTPClient::EventHandler(esp_http_client_event_t* evt) {
       break;
     case HTTP_EVENT_ON_CONNECTED:
       break;
+    case HTTP_EVENT_ON_HEADER:
+      // Only the delta-seconds form is used by the servers we talk to.
+      if (!strcasecmp(evt->header_key, "Retry-After"))
+        client->retry_after_secs_ =
+            std::strtoul(evt->header_value, nullptr, 10);
+      break;
     case HTTP_EVENT_ON_DATA:
-      ESP_LOGI(TAG, "HTTP_EVENT_ON_DATA, len=%d", evt->data_len);
+      BLOGD(TAG, "HTTP_EVENT_ON_DATA, len=%d", evt->data_len);
       if (client->data_callback_)
         client->data_callback_(evt->data, evt->data_len);
       break;
@@ -65,72 +80,123 @@ esp_err_t HTTPClient::EventHandler(esp_http_client_event_t* evt) {
   return ESP_OK;
 }
 
-HTTPClient::HTTPClient() = default;
+HTTPClient::HTTPClient()
+    : client_(nullptr),
+      retry_after_secs_(0),
+      applied_headers_(nullptr),
+      applied_headers_generation_(0) {}
+
+HTTPClient::~HTTPClient() {
+  Close();
+}
+
+void HTTPClient::Close() {
+  if (!client_)
+    return;
+  esp_http_client_cleanup(client_);
+  client_ = nullptr;
+  applied_headers_ = nullptr;
+  applied_headers_generation_ = 0;
+}
 
-HTTPClient::~HTTPClient() = default;
+esp_err_t HTTPClient::ApplyHeaders(const HeaderSet& headers) {
+  if (&headers == applied_headers_ &&
+      headers.generation() == applied_headers_generation_) {
+    return ESP_OK;
+  }
+  for (size_t i = 0; i < headers.size(); i++) {
+    const HeaderSet::Header header = headers[i];
+    const esp_err_t err =
+        esp_http_client_set_header(client_, header.name, header.value);
+    if (err != ESP_OK)
+      return err;
+  }
+  applied_headers_ = &headers;
+  applied_headers_generation_ = headers.generation();
+  return ESP_OK;
+}
 
 esp_err_t HTTPClient::DoSSLCheck() {
   int status;
   return DoGET(
-      "https://www.howsmyssl.com/a/check", std::vector<HeaderValue>(),
+      "https://www.howsmyssl.com/a/check", HeaderSet(),
       [](const void*, int) { return ESP_OK; }, &status);
 }
 
-esp_err_t HTTPClient::DoGET(const std::string& url,
-                            const std::vector<HeaderValue>& header_values,
-                            DataCallback data_callback,
-                            int* status_code) {
-  data_callback_ = data_callback;
-  const esp_http_client_config_t config =
-      CreateClientConfig(url, HTTP_METHOD_GET);
-  esp_http_client_handle_t client = esp_http_client_init(&config);
-  if (!client)
-    return ESP_FAIL;
+esp_err_t HTTPClient::DoRequest(esp_http_client_method_t method,
+                                const std::string& url,
+                                const std::string* content,
+                                const HeaderSet& headers,
+                                DataCallback data_callback,
+                                int* status_code) {
+  // The TLS handshake and record encryption are CPU bound.
+  PowerManager::Lock cpu_lock(PowerManager::Lock::Type::CPUMax);
   esp_err_t err = ESP_OK;
-  for (const auto& value : header_values) {
-    err = esp_http_client_set_header(client, value.first.c_str(),
-                                     value.second.c_str());
+  // Headers from a different set can't be removed individually, so start
+  // over on a new connection.
+  if (client_ && applied_headers_ && &headers != applied_headers_)
+    Close();
+  if (client_) {
+    // Changing the URL to one on a different host closes the connection.
+    err = esp_http_client_set_url(client_, url.c_str());
+    if (err != ESP_OK)
+      goto exit;
+    err = esp_http_client_set_method(client_, method);
     if (err != ESP_OK)
       goto exit;
+  } else {
+    const esp_http_client_config_t config = CreateClientConfig(url, method);
+    client_ = esp_http_client_init(&config);
+    if (!client_)
+      return ESP_FAIL;
+  }
+
+  data_callback_ = data_callback;
+  retry_after_secs_ = 0;
+  err = ApplyHeaders(headers);
+  if (err != ESP_OK)
+    goto exit;
+  if (content) {
+    err = esp_http_client_set_post_field(client_, content->data(),
+                                         content->length());
+  } else {
+    err = esp_http_client_set_post_field(client_, nullptr, 0);
   }
-  err = esp_http_client_perform(client);
+  if (err != ESP_OK)
+    goto exit;
+  err = esp_http_client_perform(client_);
+  if (err == ESP_OK)
+    *status_code = esp_http_client_get_status_code(client_);
 
 exit:
   data_callback_ = nullptr;
-  esp_http_client_cleanup(client);
-  if (err == ESP_OK)
-    *status_code = esp_http_client_get_status_code(client);
+  if (err != ESP_OK)
+    Close();  // Start from a clean connection next time.
   return err;
 }
 
+esp_err_t HTTPClient::DoGET(const std::string& url,
+                            const HeaderSet& headers,
+                            DataCallback data_callback,
+                            int* status_code) {
+  return DoRequest(HTTP_METHOD_GET, url, nullptr, headers,
+                   std::move(data_callback), status_code);
+}
+
 esp_err_t HTTPClient::DoPOST(const std::string& url,
                              const std::string& content,
-                             const std::vector<HeaderValue>& header_values,
+                             const HeaderSet& headers,
                              DataCallback data_callback,
                              int* status_code) {
-  data_callback_ = data_callback;
-  const esp_http_client_config_t config =
-      CreateClientConfig(url, HTTP_METHOD_POST);
-  esp_http_client_handle_t client = esp_http_client_init(&config);
-  if (!client)
-    return ESP_FAIL;
-  esp_err_t err = ESP_OK;
-  for (const auto& value : header_values) {
-    err = esp_http_client_set_header(client, value.first.c_str(),
-                                     value.second.c_str());
-    if (err != ESP_OK)
-      goto exit;
-  }
-  err =
-      esp_http_client_set_post_field(client, content.data(), content.length());
-  if (err != ESP_OK)
-    goto exit;
-  err = esp_http_client_perform(client);
+  return DoRequest(HTTP_METHOD_POST, url, &content, headers,
+                   std::move(data_callback), status_code);
+}
 
-exit:
-  data_callback_ = nullptr;
-  esp_http_client_cleanup(client);
-  if (err == ESP_OK)
-    *status_code = esp_http_client_get_status_code(client);
-  return err;
+esp_err_t HTTPClient::DoPUT(const std::string& url,
+                            const std::string& content,
+                            const HeaderSet& headers,
+                            DataCallback data_callback,
+                            int* status_code) {
+  return DoRequest(HTTP_METHOD_PUT, url, &content, headers,
+                   std::move(data_callback), status_code);
 }
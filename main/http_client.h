@@ -1,39 +1,76 @@
 #pragma once
 
+#include <cstdint>
 #include <functional>
 #include <string>
-#include <tuple>
-#include <vector>
 
 #include <esp_err.h>
 #include <esp_http_client.h>
 
+class HeaderSet;
+
+/**
+ * A simple HTTP(S) client.
+ *
+ * The underlying connection is kept open between requests made on the same
+ * instance so that subsequent requests to the same host skip the TCP and TLS
+ * handshakes (provided the server allows keep-alive).
+ *
+ * Request headers are only (re)applied to the connection when the header
+ * set, or its generation, differs from the last request's.
+ */
 class HTTPClient {
  public:
-  using HeaderValue = std::pair<std::string, std::string>;
   using DataCallback = std::function<esp_err_t(const void*, int)>;
 
   HTTPClient();
   ~HTTPClient();
 
   esp_err_t DoGET(const std::string& url,
-                  const std::vector<HeaderValue>& header_values,
+                  const HeaderSet& headers,
                   DataCallback data_callback,
                   int* status_code);
 
   esp_err_t DoPOST(const std::string& url,
                    const std::string& content,
-                   const std::vector<HeaderValue>& header_values,
+                   const HeaderSet& headers,
                    DataCallback data_callback,
                    int* status_code);
 
+  esp_err_t DoPUT(const std::string& url,
+                  const std::string& content,
+                  const HeaderSet& headers,
+                  DataCallback data_callback,
+                  int* status_code);
+
   esp_err_t DoSSLCheck();
 
+  /**
+   * Close the connection (if open) to the server.
+   */
+  void Close();
+
+  // The Retry-After value (in seconds) of the last response, 0 if none.
+  uint32_t retry_after_secs() const { return retry_after_secs_; }
+
  private:
   static esp_err_t EventHandler(esp_http_client_event_t* evt);
 
   esp_http_client_config_t CreateClientConfig(const std::string& url,
                                               esp_http_client_method_t method);
 
+  esp_err_t DoRequest(esp_http_client_method_t method,
+                      const std::string& url,
+                      const std::string* content,
+                      const HeaderSet& headers,
+                      DataCallback data_callback,
+                      int* status_code);
+
+  esp_err_t ApplyHeaders(const HeaderSet& headers);
+
   DataCallback data_callback_;
-};
\ No newline at end of file
+  esp_http_client_handle_t client_;      // Reused for all requests.
+  uint32_t retry_after_secs_;            // Last response's Retry-After.
+  const HeaderSet* applied_headers_;     // Headers set on |client_|.
+  uint32_t applied_headers_generation_;  // Generation of |applied_headers_|.
+};
@@ -0,0 +1,139 @@
+#include "i2c_bus.h"
+
+#include <algorithm>
+
+#include <esp_log.h>
+#include <esp_timer.h>
+
+namespace {
+
+constexpr char TAG[] = "kbd_i2c";
+
+constexpr const char* kPriorityNames[] = {"bulk", "interactive"};
+
+static_assert(sizeof(kPriorityNames) / sizeof(kPriorityNames[0]) ==
+              I2CBus::kNumPriorities);
+
+}  // namespace
+
+I2CBus::Lease::Lease(I2CBus* bus, Priority priority)
+    : bus_(bus), priority_(priority) {
+  bus_->Acquire(priority_);
+}
+
+I2CBus::Lease::~Lease() {
+  bus_->Release();
+}
+
+void I2CBus::Lease::Yield() {
+  if (!bus_->HigherPriorityWaiting(priority_))
+    return;
+  bus_->Release();
+  bus_->Acquire(priority_);
+  bool give_mutex = xSemaphoreTake(bus_->mutex_, portMAX_DELAY) == pdTRUE;
+  bus_->stats_.yields++;
+  if (give_mutex)
+    xSemaphoreGive(bus_->mutex_);
+}
+
+I2CBus::I2CBus(i2c_port_t port, const char* name)
+    : name_(name),
+      master_(port, /*mutex=*/nullptr),
+      create_time_(esp_timer_get_time()),
+      mutex_(xSemaphoreCreateMutex()),
+      busy_(false),
+      lease_start_us_(0) {
+  for (int i = 0; i < kNumPriorities; i++) {
+    grants_[i] = xSemaphoreCreateCounting(kMaxWaiters, 0);
+    num_waiting_[i] = 0;
+  }
+}
+
+I2CBus::~I2CBus() {
+  for (SemaphoreHandle_t grant : grants_)
+    vSemaphoreDelete(grant);
+  vSemaphoreDelete(mutex_);
+}
+
+void I2CBus::Acquire(Priority priority) {
+  const int idx = static_cast<int>(priority);
+  const int64_t start = esp_timer_get_time();
+
+  bool give_mutex = xSemaphoreTake(mutex_, portMAX_DELAY) == pdTRUE;
+  const bool wait = busy_;
+  if (wait)
+    num_waiting_[idx]++;
+  else
+    busy_ = true;
+  if (give_mutex)
+    xSemaphoreGive(mutex_);
+
+  // Release() hands the bus directly to the waiter it grants.
+  if (wait)
+    xSemaphoreTake(grants_[idx], portMAX_DELAY);
+
+  const int64_t now = esp_timer_get_time();
+  give_mutex = xSemaphoreTake(mutex_, portMAX_DELAY) == pdTRUE;
+  lease_start_us_ = now;
+  stats_.leases[idx]++;
+  if (wait) {
+    const int64_t wait_us = now - start;
+    stats_.contended[idx]++;
+    stats_.total_wait_us[idx] += wait_us;
+    stats_.max_wait_us[idx] = std::max(stats_.max_wait_us[idx], wait_us);
+  }
+  if (give_mutex)
+    xSemaphoreGive(mutex_);
+}
+
+void I2CBus::Release() {
+  bool give_mutex = xSemaphoreTake(mutex_, portMAX_DELAY) == pdTRUE;
+  stats_.busy_us += esp_timer_get_time() - lease_start_us_;
+  busy_ = false;
+  for (int idx = kNumPriorities - 1; idx >= 0; idx--) {
+    if (num_waiting_[idx]) {
+      num_waiting_[idx]--;
+      busy_ = true;
+      xSemaphoreGive(grants_[idx]);
+      break;
+    }
+  }
+  if (give_mutex)
+    xSemaphoreGive(mutex_);
+}
+
+bool I2CBus::HigherPriorityWaiting(Priority priority) const {
+  bool waiting = false;
+  bool give_mutex = xSemaphoreTake(mutex_, portMAX_DELAY) == pdTRUE;
+  for (int idx = static_cast<int>(priority) + 1; idx < kNumPriorities; idx++)
+    waiting |= num_waiting_[idx] != 0;
+  if (give_mutex)
+    xSemaphoreGive(mutex_);
+  return waiting;
+}
+
+I2CBus::Stats I2CBus::GetStats() const {
+  bool give_mutex = xSemaphoreTake(mutex_, portMAX_DELAY) == pdTRUE;
+  Stats stats = stats_;
+  if (give_mutex)
+    xSemaphoreGive(mutex_);
+  stats.elapsed_us = esp_timer_get_time() - create_time_;
+  return stats;
+}
+
+void I2CBus::LogStats() const {
+  const Stats stats = GetStats();
+  ESP_LOGI(TAG, "%s: %lld%% busy, %u yields", name_,
+           stats.elapsed_us ? stats.busy_us * 100 / stats.elapsed_us : 0,
+           stats.yields);
+  for (int i = 0; i < kNumPriorities; i++) {
+    if (!stats.leases[i])
+      continue;
+    ESP_LOGI(TAG, "%s: %s: leases=%u contended=%u avg_wait=%lld us "
+             "max_wait=%lld us",
+             name_, kPriorityNames[i], stats.leases[i], stats.contended[i],
+             stats.contended[i] ? stats.total_wait_us[i] / stats.contended[i]
+                                : 0,
+             stats.max_wait_us[i]);
+  }
+}
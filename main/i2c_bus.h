@@ -0,0 +1,96 @@
+#pragma once
+
+#include <cstdint>
+
+#include <driver/i2c.h>
+#include <esp_err.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <i2clib/master.h>
+
+/**
+ * Arbitrates access to one I2C bus between its clients.
+ *
+ * A client holds a Lease for the duration of a sequence of transactions
+ * (so a sequence is never interleaved with another client's). When the
+ * bus is released it is handed to the highest priority waiter. Clients
+ * sending long transfers split them into chunks and call Lease::Yield()
+ * between chunks, so a waiting higher priority client (e.g. a key read)
+ * waits for at most one chunk.
+ */
+class I2CBus {
+ public:
+  enum class Priority : uint8_t {
+    Bulk,         // Long transfers, e.g. display refreshes.
+    Interactive,  // Latency sensitive reads, e.g. key events.
+    Count,
+  };
+
+  static constexpr int kNumPriorities = static_cast<int>(Priority::Count);
+
+  /**
+   * Usage counters for diagnostics.
+   */
+  struct Stats {
+    uint32_t leases[kNumPriorities] = {};        // Leases granted.
+    uint32_t contended[kNumPriorities] = {};     // Leases that had to wait.
+    int64_t total_wait_us[kNumPriorities] = {};  // Time spent waiting.
+    int64_t max_wait_us[kNumPriorities] = {};    // Longest wait.
+    uint32_t yields = 0;     // Times a lease gave way between chunks.
+    int64_t busy_us = 0;     // Time the bus was leased.
+    int64_t elapsed_us = 0;  // Time since the bus was created.
+  };
+
+  /**
+   * Exclusive use of the bus, held for the lifetime of this object.
+   */
+  class Lease {
+   public:
+    Lease(I2CBus* bus, Priority priority);
+    ~Lease();
+
+    Lease(const Lease&) = delete;
+    Lease& operator=(const Lease&) = delete;
+
+    i2c::Master& master() { return bus_->master_; }
+
+    /**
+     * Let a waiting higher priority client use the bus, then continue.
+     *
+     * Call between the chunks of a long transfer. Does nothing if no
+     * higher priority client is waiting.
+     */
+    void Yield();
+
+   private:
+    I2CBus* bus_;
+    const Priority priority_;
+  };
+
+  /**
+   * @param port The bus, already initialized with i2c::Master::Initialize().
+   * @param name Name used in log messages.
+   */
+  I2CBus(i2c_port_t port, const char* name);
+  ~I2CBus();
+
+  Stats GetStats() const;
+  void LogStats() const;
+
+ private:
+  static constexpr UBaseType_t kMaxWaiters = 8;  // Per priority.
+
+  void Acquire(Priority priority);
+  void Release();
+  bool HigherPriorityWaiting(Priority priority) const;
+
+  const char* name_;
+  i2c::Master master_;  // Unsynchronized: leases provide exclusion.
+  const int64_t create_time_;
+  SemaphoreHandle_t mutex_;  // Synchronize access to following members.
+  SemaphoreHandle_t grants_[kNumPriorities];  // Given to hand over the bus.
+  uint32_t num_waiting_[kNumPriorities];      // Waiters per priority.
+  bool busy_;                                 // Is the bus leased?
+  int64_t lease_start_us_;  // When the current lease started.
+  Stats stats_;
+};
@@ -1,15 +1,20 @@
 #include "keyboard.h"
 
+#include <algorithm>
 #include <cstdint>
 #include <cstring>
-#include <utility>
 
-#define LOG_LOCAL_LEVEL ESP_LOG_VERBOSE
+#define LOG_LOCAL_LEVEL ESP_LOG_INFO
 #include <class/hid/hid.h>
 #include <esp_err.h>
 #include <esp_log.h>
+#include <esp_timer.h>
+#include <freertos/task.h>
 #include <i2clib/operation.h>
 
+#include "binary_log.h"
+#include "i2c_bus.h"
+#include "lighting.h"
 #include "lm8330_registers.h"
 
 namespace {
@@ -17,12 +22,66 @@ constexpr char TAG[] = "kbd_kbd";
 constexpr uint8_t kSlaveAddress = 0x88;  // I2C address of LM8330 IC.
 constexpr uint8_t k12msec = 0x80;
 constexpr uint8_t kInvalidEventCode = 0x7F;
+constexpr uint8_t kEventCodeRelease = 0x80;  // EVTCODE bit set on key up.
+constexpr int kEventFIFOSize = 15;
+// AUTOSLPTI[L/H] together hold the auto-sleep time in milliseconds.
+constexpr uint32_t kMaxSleepTimeoutMSecs = 0xFFFF;
+// The LM8330 may not respond to the first access after waking.
+constexpr uint32_t kWakeRetryDelayMSecs = 2;
 }  // namespace
 
-Keyboard::Keyboard(i2c::Master i2c_master)
-    : i2c_master_(std::move(i2c_master)), key_states_(0xFF, false) {}
+Keyboard::Keyboard(I2CBus* i2c_bus,
+                   TimerWheel* timer_wheel,
+                   uint32_t sleep_timeout_ms)
+    : i2c_bus_(i2c_bus),
+      sleep_timeout_ms_(std::min(sleep_timeout_ms, kMaxSleepTimeoutMSecs)),
+      idle_timer_(timer_wheel, IdleTimerCb, this),
+      auto_sleep_(false),
+      mutex_(xSemaphoreCreateMutex()),
+      key_states_(0xFF, false) {}
 
-Keyboard::~Keyboard() = default;
+Keyboard::~Keyboard() {
+  idle_timer_.Stop();
+  vSemaphoreDelete(mutex_);
+}
+
+// static
+void Keyboard::IdleTimerCb(void* arg) {
+  Keyboard* keyboard = static_cast<Keyboard*>(arg);
+  bool give_mutex = xSemaphoreTake(keyboard->mutex_, portMAX_DELAY) == pdTRUE;
+  // The LM8330 goes to sleep at (about) the same time.
+  keyboard->active_lock_.reset();
+  if (give_mutex)
+    xSemaphoreGive(keyboard->mutex_);
+  BLOGD(TAG, "Keyboard idle.");
+}
+
+esp_err_t Keyboard::ConfigureAutoSleep() {
+  // Any key of the matrix (all KPX/KPY balls) wakes the chip.
+  esp_err_t err = WriteByte(Register::GPIOWAKE0, 0xFF);
+  if (err != ESP_OK)
+    return err;
+  err = WriteByte(Register::GPIOWAKE1, 0xFF);
+  if (err != ESP_OK)
+    return err;
+  err = WriteByte(Register::GPIOWAKE2, 0x00);
+  if (err != ESP_OK)
+    return err;
+  err = WriteByte(Register::AUTOSLPTIL, sleep_timeout_ms_ & 0xFF);
+  if (err != ESP_OK)
+    return err;
+  err = WriteByte(Register::AUTOSLPTIH, sleep_timeout_ms_ >> 8);
+  if (err != ESP_OK)
+    return err;
+  err = WriteByte(Register::AUTOSLP, Register_AUTOSLP{
+                                         .Reserved = 0,
+                                         .ENSLPEN = 1,
+                                     });
+  if (err != ESP_OK)
+    return err;
+  auto_sleep_ = true;
+  return ESP_OK;
+}
 
 esp_err_t Keyboard::Initialize() {
   esp_err_t err = WriteByte(Register::KBDSETTLE, k12msec);
@@ -104,13 +163,17 @@ esp_err_t Keyboard::Initialize() {
     return err;
   err = WriteByte(Register::CLKEN, Register_CLKEN{
                                        .Reserved1 = 0,
-                                       .TIMEN = false,
+                                       .TIMEN = true,  // For Lighting.
                                        .Reserved2 = 0,
                                        .KBDEN = true,
 
                                    });
   if (err != ESP_OK)
     return err;
+  err = ConfigureAutoSleep();
+  if (err != ESP_OK)
+    return err;
+  ESP_LOGI(TAG, "Keyboard auto-sleep after %u ms.", sleep_timeout_ms_);
   return ESP_OK;
 }
 
@@ -118,27 +181,126 @@ esp_err_t Keyboard::ReportHIDEvents() {
   return ESP_OK;
 }
 
-esp_err_t Keyboard::HandleEvents() {
-  event_number_++;
-  return ESP_OK;
+esp_err_t Keyboard::ReadEvents(bool* key_pressed) {
+  // Drain the event FIFO. A key press which woke the chip from auto-sleep
+  // is queued like any other, so the first key after idle is not lost.
+  for (int i = 0; i < kEventFIFOSize; i++) {
+    uint8_t event;
+    esp_err_t err = ReadByte(Register::EVTCODE, &event);
+    if (err != ESP_OK)
+      return err;
+    if (event == kInvalidEventCode)
+      break;
+    event_number_++;
+    if (!(event & kEventCodeRelease))
+      *key_pressed = true;
+    BLOGV(TAG, "Key event 0x%02x", event);
+  }
+  return WriteByte(Register::KBDIC, Register_KBDIC{
+                                        .SFOFF = false,
+                                        .Reserved = 0,
+                                        .EVTIC = true,
+                                        .KBDIC = true,
+                                    });
+}
+
+void Keyboard::OnActivity(int64_t irq_time_us, int64_t report_time_us) {
+  const int64_t latency_us = report_time_us - irq_time_us;
+  bool give_mutex = xSemaphoreTake(mutex_, portMAX_DELAY) == pdTRUE;
+  if (active_lock_) {
+    power_stats_.max_active_latency_us =
+        std::max(power_stats_.max_active_latency_us, latency_us);
+  } else {
+    active_lock_.reset(
+        new PowerManager::Lock(PowerManager::Lock::Type::NoLightSleep));
+    power_stats_.wakeups++;
+    power_stats_.last_wake_latency_us = latency_us;
+    power_stats_.max_wake_latency_us =
+        std::max(power_stats_.max_wake_latency_us, latency_us);
+  }
+  if (give_mutex)
+    xSemaphoreGive(mutex_);
+
+  // Restart the idle countdown.
+  idle_timer_.StartOnce(sleep_timeout_ms_);
+}
+
+esp_err_t Keyboard::HandleEvents(int64_t irq_time_us) {
+  bool key_pressed = false;
+  esp_err_t err = ReadEvents(&key_pressed);
+  if (err != ESP_OK)
+    return err;
+  err = ReportHIDEvents();
+  if (key_pressed && lighting_)
+    lighting_->OnKeyPress();
+  OnActivity(irq_time_us, esp_timer_get_time());
+  return err;
+}
+
+Keyboard::PowerStats Keyboard::GetPowerStats() const {
+  bool give_mutex = xSemaphoreTake(mutex_, portMAX_DELAY) == pdTRUE;
+  const PowerStats stats = power_stats_;
+  if (give_mutex)
+    xSemaphoreGive(mutex_);
+  return stats;
+}
+
+void Keyboard::LogPowerStats() const {
+  const PowerStats stats = GetPowerStats();
+  ESP_LOGI(TAG,
+           "wakeups=%u retries=%u wake_latency=%lld us (max %lld us) "
+           "active_latency_max=%lld us",
+           stats.wakeups, stats.wake_retries, stats.last_wake_latency_us,
+           stats.max_wake_latency_us, stats.max_active_latency_us);
+}
+
+bool Keyboard::MayBeAsleep() const {
+  bool give_mutex = xSemaphoreTake(mutex_, portMAX_DELAY) == pdTRUE;
+  const bool asleep = auto_sleep_ && !active_lock_;
+  if (give_mutex)
+    xSemaphoreGive(mutex_);
+  return asleep;
+}
+
+void Keyboard::WaitForWake() {
+  vTaskDelay(std::max<TickType_t>(pdMS_TO_TICKS(kWakeRetryDelayMSecs), 1));
+  bool give_mutex = xSemaphoreTake(mutex_, portMAX_DELAY) == pdTRUE;
+  power_stats_.wake_retries++;
+  if (give_mutex)
+    xSemaphoreGive(mutex_);
 }
 
 esp_err_t Keyboard::ReadByte(Register reg, void* value) {
-  return i2c_master_.ReadRegister(kSlaveAddress, static_cast<uint8_t>(reg),
-                                  reinterpret_cast<uint8_t*>(value))
-             ? ESP_OK
-             : ESP_FAIL;
+  for (int attempt = 0;; attempt++) {
+    {
+      I2CBus::Lease lease(i2c_bus_, I2CBus::Priority::Interactive);
+      if (lease.master().ReadRegister(kSlaveAddress, static_cast<uint8_t>(reg),
+                                      reinterpret_cast<uint8_t*>(value)))
+        return ESP_OK;
+    }
+    if (attempt || !MayBeAsleep())
+      return ESP_FAIL;
+    WaitForWake();
+  }
 }
 
 esp_err_t Keyboard::WriteByte(Register reg, uint8_t value) {
-  return i2c_master_.WriteRegister(kSlaveAddress, static_cast<uint8_t>(reg),
-                                   value)
-             ? ESP_OK
-             : ESP_FAIL;
+  for (int attempt = 0;; attempt++) {
+    {
+      I2CBus::Lease lease(i2c_bus_, I2CBus::Priority::Interactive);
+      if (lease.master().WriteRegister(kSlaveAddress,
+                                       static_cast<uint8_t>(reg), value))
+        return ESP_OK;
+    }
+    if (attempt || !MayBeAsleep())
+      return ESP_FAIL;
+    WaitForWake();
+  }
 }
 
 esp_err_t Keyboard::WriteWord(Register reg, uint16_t value) {
-  i2c::Operation op = i2c_master_.CreateWriteOp(
+  I2CBus::Lease lease(i2c_bus_, I2CBus::Priority::Interactive);
+  i2c::Operation op = lease.master().CreateWriteOp(
       kSlaveAddress, static_cast<uint8_t>(reg), "Kbd::WriteWord");
   if (!op.ready())
     return ESP_FAIL;
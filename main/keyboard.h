@@ -1,15 +1,45 @@
 #pragma once
 
+#include <cstdint>
+#include <memory>
 #include <vector>
 
 #include <esp_err.h>
-#include <i2clib/master.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
 
+#include "power_manager.h"
+#include "timer_wheel.h"
+
+class I2CBus;
+class Lighting;
 enum class Register : uint8_t;
 
+/**
+ * The LM8330 keyboard matrix controller.
+ *
+ * The LM8330 is put into auto-sleep: after |sleep_timeout_ms| without a key
+ * press it stops scanning until a key press wakes it. The ESP32 side
+ * follows the same policy. While keys are being pressed it keeps the chip
+ * out of light sleep so that a typing burst isn't slowed by wake-ups; once
+ * idle only the (level triggered, light sleep waking) INT line remains.
+ */
 class Keyboard {
  public:
-  Keyboard(i2c::Master i2c_master);
+  /**
+   * Counters for the power policy.
+   */
+  struct PowerStats {
+    uint32_t wakeups = 0;               // Idle to active transitions.
+    uint32_t wake_retries = 0;          // I2C accesses retried after sleep.
+    int64_t last_wake_latency_us = 0;   // INT to report, first key after idle.
+    int64_t max_wake_latency_us = 0;    // Longest |last_wake_latency_us|.
+    int64_t max_active_latency_us = 0;  // INT to report while active.
+  };
+
+  Keyboard(I2CBus* i2c_bus,
+           TimerWheel* timer_wheel,
+           uint32_t sleep_timeout_ms);
   ~Keyboard();
 
   esp_err_t Initialize();
@@ -20,11 +50,37 @@ class Keyboard {
    * Call this function, either polled or when interrupt pin indicates, to
    * handle any queued keyboard events.
    *
+   * @param irq_time_us When the interrupt fired (esp_timer_get_time()).
+   *
    * @return ESP_OK when successful.
    */
-  esp_err_t HandleEvents();
+  esp_err_t HandleEvents(int64_t irq_time_us);
+
+  /**
+   * Replay |lighting|'s key press effect on each key press.
+   */
+  void SetLighting(Lighting* lighting) { lighting_ = lighting; }
+
+  PowerStats GetPowerStats() const;
+  void LogPowerStats() const;
 
  private:
+  static void IdleTimerCb(void* arg);
+
+  esp_err_t ConfigureAutoSleep();
+  esp_err_t ReadEvents(bool* key_pressed);
+  void OnActivity(int64_t irq_time_us, int64_t report_time_us);
+
+  /**
+   * Is the LM8330 possibly in auto-sleep (i.e. idle)?
+   */
+  bool MayBeAsleep() const;
+
+  /**
+   * Give the LM8330 time to wake before an access is retried.
+   */
+  void WaitForWake();
+
   /**
    * Report all HID events to the host via TinyUSB.
    *
@@ -35,7 +91,14 @@ class Keyboard {
   esp_err_t WriteWord(Register reg, uint16_t value);
   esp_err_t ReadByte(Register reg, void* value);
 
-  i2c::Master i2c_master_;
+  I2CBus* i2c_bus_;
+  Lighting* lighting_ = nullptr;  // Optional.
+  const uint32_t sleep_timeout_ms_;
+  TimerWheel::Timer idle_timer_;  // Fires |sleep_timeout_ms_| after a key.
+  bool auto_sleep_;               // Was LM8330 auto-sleep enabled?
+  SemaphoreHandle_t mutex_;       // Synchronize access to following members.
+  std::unique_ptr<PowerManager::Lock> active_lock_;  // Held while active.
+  PowerStats power_stats_;
 
   /**
    * Array used to map TinyUSB's HID KEYCODE value to the button
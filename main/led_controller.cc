@@ -13,60 +13,135 @@
 
 #include "led_controller.h"
 
-#include <driver/gpio.h>
-#include <esp_idf_version.h>
-#include <esp_timer.h>
+#include <algorithm>
 
-#include "gpio_pins.h"
+#include <esp_log.h>
+
+#include "power_manager.h"
 
 namespace {
 
 constexpr char TAG[] = "led-controller";
-constexpr uint64_t kLEDOffDelayUsec = 50 * 1000;
+constexpr ledc_mode_t kSpeedMode = LEDC_LOW_SPEED_MODE;
+constexpr ledc_timer_t kTimer = LEDC_TIMER_0;
+constexpr ledc_channel_t kChannel = LEDC_CHANNEL_0;
+constexpr ledc_timer_bit_t kDutyResolution = LEDC_TIMER_10_BIT;
+constexpr uint32_t kMaxDuty = (1 << kDutyResolution) - 1;
+constexpr uint32_t kPWMFrequencyHz = 5000;
+constexpr uint32_t kFadeMSecs = 50;
+// Fade step count, cycles and scale are all 10-bit fields.
+constexpr uint32_t kMaxFadeField = 0x3FF;
 
 }  // namespace
 
 LEDController::LEDController(gpio_num_t activity_gpio)
-    : activity_gpio_(activity_gpio), led_off_timer_(nullptr) {
-#if (BOARD_FEATHERS2 == 1)
-  const gpio_config_t config = {
-      .pin_bit_mask = (1UL << activity_gpio_),
-      .mode = GPIO_MODE_OUTPUT,
-      .pull_up_en = GPIO_PULLUP_DISABLE,
-      .pull_down_en = GPIO_PULLDOWN_DISABLE,
-      .intr_type = GPIO_INTR_DISABLE,
-  };
-  ESP_ERROR_CHECK_WITHOUT_ABORT(gpio_config(&config));
-#endif
-  gpio_set_level(activity_gpio_, 0);
-  ESP_ERROR_CHECK_WITHOUT_ABORT(CreateActivityTimer());
+    : activity_gpio_(activity_gpio),
+      configured_(false),
+      isr_(nullptr),
+      fading_(false),
+      fade_lock_acquired_(false),
+      fade_steps_(0),
+      fade_step_cycles_(0),
+      fade_step_duty_(0) {
+  // Spread the fade over kFadeMSecs worth of PWM cycles, with as many
+  // (1 duty unit) steps as there are cycles to spend.
+  const uint32_t fade_cycles = kPWMFrequencyHz * kFadeMSecs / 1000;
+  if (fade_cycles >= kMaxDuty) {
+    fade_step_duty_ = 1;
+    fade_steps_ = kMaxDuty;
+    fade_step_cycles_ = std::min(fade_cycles / kMaxDuty, kMaxFadeField);
+  } else {
+    fade_step_cycles_ = 1;
+    fade_step_duty_ = (kMaxDuty + fade_cycles - 1) / fade_cycles;
+    fade_steps_ = kMaxDuty / fade_step_duty_;
+  }
+  ESP_ERROR_CHECK_WITHOUT_ABORT(ConfigureLEDC());
 }
 
 LEDController::~LEDController() {
-  esp_timer_stop(led_off_timer_);
-  gpio_set_level(activity_gpio_, 0);
+  if (configured_)
+    ledc_stop(kSpeedMode, kChannel, /*idle_level=*/0);
+  if (isr_)
+    esp_intr_free(isr_);
+  if (fading_)
+    PowerManager::Release(PowerManager::Lock::Type::NoLightSleep,
+                          fade_lock_acquired_);
 }
 
-// static:
-void IRAM_ATTR LEDController::ActivityTimerCb(void* param) {
-  gpio_set_level(static_cast<LEDController*>(param)->activity_gpio_, 0);
-}
+esp_err_t LEDController::ConfigureLEDC() {
+  const ledc_timer_config_t timer_config = {
+      .speed_mode = kSpeedMode,
+      .duty_resolution = kDutyResolution,
+      .timer_num = kTimer,
+      .freq_hz = kPWMFrequencyHz,
+      .clk_cfg = LEDC_AUTO_CLK,
+  };
+  esp_err_t err = ledc_timer_config(&timer_config);
+  if (err != ESP_OK)
+    return err;
 
-esp_err_t LEDController::CreateActivityTimer() {
-  const esp_timer_create_args_t timer_args = {
-    .callback = ActivityTimerCb,
-    .arg = this,
-    .dispatch_method = ESP_TIMER_TASK,
-    .name = "ActivityTimer",
-#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(4, 3, 0)
-    .skip_unhandled_events = true,
-#endif
+  const ledc_channel_config_t channel_config = {
+      .gpio_num = activity_gpio_,
+      .speed_mode = kSpeedMode,
+      .channel = kChannel,
+      .intr_type = LEDC_INTR_DISABLE,
+      .timer_sel = kTimer,
+      .duty = 0,
+      .hpoint = 0,
   };
-  return esp_timer_create(&timer_args, &led_off_timer_);
+  err = ledc_channel_config(&channel_config);
+  if (err != ESP_OK)
+    return err;
+
+  ledc_hal_init(&hal_, kSpeedMode);
+  err = ledc_isr_register(FadeEndISR, this, ESP_INTR_FLAG_IRAM, &isr_);
+  if (err != ESP_OK)
+    return err;
+  ledc_hal_set_fade_end_intr(&hal_, kChannel, true);
+  configured_ = true;
+  ESP_LOGD(TAG, "Activity fade: %u steps of %u cycles, -%u duty/step.",
+           fade_steps_, fade_step_cycles_, fade_step_duty_);
+  return ESP_OK;
+}
+
+void IRAM_ATTR LEDController::FlashActivityLED() {
+  if (!configured_)
+    return;
+  // The same register sequence as ledc_set_fade() + ledc_update_duty(),
+  // without the driver's fade mutex.
+  portENTER_CRITICAL_SAFE(&mux_);
+  if (!fading_) {
+    fade_lock_acquired_ =
+        PowerManager::Acquire(PowerManager::Lock::Type::NoLightSleep);
+    fading_ = true;
+  }
+  // A pending end of the previous fade no longer applies.
+  ledc_hal_clear_fade_end_intr_status(&hal_, kChannel);
+  // Start so that the last step reaches zero.
+  ledc_hal_set_duty_int_part(&hal_, kChannel, fade_steps_ * fade_step_duty_);
+  ledc_hal_set_duty_direction(&hal_, kChannel, LEDC_DUTY_DIR_DECREASE);
+  ledc_hal_set_duty_num(&hal_, kChannel, fade_steps_);
+  ledc_hal_set_duty_cycle(&hal_, kChannel, fade_step_cycles_);
+  ledc_hal_set_duty_scale(&hal_, kChannel, fade_step_duty_);
+  ledc_hal_set_sig_out_en(&hal_, kChannel, true);
+  ledc_hal_set_duty_start(&hal_, kChannel, true);
+  ledc_hal_ls_channel_update(&hal_, kChannel);
+  portEXIT_CRITICAL_SAFE(&mux_);
 }
 
-void LEDController::FlashActivityLED() {
-  esp_timer_stop(led_off_timer_);
-  gpio_set_level(activity_gpio_, 1);
-  esp_timer_start_once(led_off_timer_, kLEDOffDelayUsec);
+// static
+void IRAM_ATTR LEDController::FadeEndISR(void* arg) {
+  LEDController* controller = static_cast<LEDController*>(arg);
+  portENTER_CRITICAL_ISR(&controller->mux_);
+  uint32_t status = 0;
+  ledc_hal_get_fade_end_intr_status(&controller->hal_, &status);
+  if (status & (1u << kChannel)) {
+    ledc_hal_clear_fade_end_intr_status(&controller->hal_, kChannel);
+    if (controller->fading_) {
+      PowerManager::Release(PowerManager::Lock::Type::NoLightSleep,
+                            controller->fade_lock_acquired_);
+      controller->fading_ = false;
+    }
+  }
+  portEXIT_CRITICAL_ISR(&controller->mux_);
 }
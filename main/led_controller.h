@@ -13,23 +13,51 @@
 
 #pragma once
 
+#include <cstdint>
+
 #include <driver/gpio.h>
+#include <driver/ledc.h>
 #include <esp_attr.h>
 #include <esp_err.h>
-#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <hal/ledc_hal.h>
 
+/**
+ * Drives the activity LED with the LEDC peripheral.
+ *
+ * A flash sets the LED to full brightness and starts a hardware fade to
+ * off, so there is no timer or callback to turn it off. A flash while one
+ * is still fading simply restarts the fade, merging rapid flashes.
+ *
+ * LEDC stops in light sleep, so a NoLightSleep lock is held from the flash
+ * until the fade's end interrupt.
+ */
 class LEDController {
  public:
   LEDController(gpio_num_t activity_gpio);
   ~LEDController();
 
-  void FlashActivityLED();
+  /**
+   * Flash the activity LED.
+   *
+   * Only writes a few LEDC registers and takes the fade's power lock, so is
+   * safe to call from any task or ISR and never blocks.
+   */
+  void IRAM_ATTR FlashActivityLED();
 
  private:
-  static void IRAM_ATTR ActivityTimerCb(void*);
+  static void IRAM_ATTR FadeEndISR(void* arg);
 
-  esp_err_t CreateActivityTimer();
+  esp_err_t ConfigureLEDC();
 
   gpio_num_t activity_gpio_;
-  esp_timer_handle_t led_off_timer_;
-};
\ No newline at end of file
+  bool configured_;            // Was the LEDC channel configured?
+  ledc_isr_handle_t isr_;      // Fade end interrupt.
+  bool fading_;                // Is the fade's NoLightSleep lock held?
+  bool fade_lock_acquired_;    // ... and was it actually acquired?
+  ledc_hal_context_t hal_;     // For ISR safe register access.
+  uint32_t fade_steps_;        // Number of fade steps.
+  uint32_t fade_step_cycles_;  // PWM cycles per fade step.
+  uint32_t fade_step_duty_;    // Duty decrease per fade step.
+  portMUX_TYPE mux_ = portMUX_INITIALIZER_UNLOCKED;  // Guards fade state.
+};
@@ -0,0 +1,126 @@
+#include "lighting.h"
+
+#include <esp_log.h>
+#include <i2clib/operation.h>
+
+#include "i2c_bus.h"
+#include "lm8330_registers.h"
+#include "pwm_script.h"
+
+namespace {
+
+constexpr char TAG[] = "kbd_light";
+constexpr uint8_t kSlaveAddress = 0x88;  // I2C address of LM8330 IC.
+
+// PWMCFG0-2, indexed by Lighting::Channel.
+constexpr Register kPWMCFGRegisters[] = {Register::PWMCFG0, Register::PWMCFG1,
+                                         Register::PWMCFG2};
+
+// Effect parameters.
+constexpr uint32_t kBreathingPeriodMSecs = 4000;
+constexpr uint8_t kBacklightMinLevel = 0x10;
+constexpr uint8_t kBacklightMaxLevel = 0x80;
+constexpr uint8_t kKeyPressLevel = PWMScript::kMaxLevel;
+constexpr uint32_t kKeyPressFadeMSecs = 250;
+constexpr uint32_t kCapsLockBlinkMSecs = 500;
+
+}  // namespace
+
+Lighting::Lighting(I2CBus* i2c_bus) : i2c_bus_(i2c_bus), caps_lock_(false) {}
+
+Lighting::~Lighting() = default;
+
+esp_err_t Lighting::Initialize() {
+  static_assert(sizeof(kPWMCFGRegisters) / sizeof(kPWMCFGRegisters[0]) ==
+                kNumChannels);
+
+  esp_err_t err = Upload(Channel::Backlight,
+                         PWMScript::Breathing(kBreathingPeriodMSecs,
+                                              kBacklightMinLevel,
+                                              kBacklightMaxLevel));
+  if (err != ESP_OK)
+    return err;
+  err = Upload(Channel::KeyPress,
+               PWMScript::Flash(kKeyPressLevel, kKeyPressFadeMSecs));
+  if (err != ESP_OK)
+    return err;
+  err = Upload(Channel::CapsLock,
+               PWMScript::Blink(kCapsLockBlinkMSecs, kCapsLockBlinkMSecs,
+                                PWMScript::kMaxLevel));
+  if (err != ESP_OK)
+    return err;
+  return Restart(Channel::Backlight, /*run=*/true);
+}
+
+esp_err_t Lighting::Upload(Channel channel, const PWMScript& script) {
+  if (script.status() != ESP_OK) {
+    ESP_LOGE(TAG, "Channel %d script invalid: %s", static_cast<int>(channel),
+             esp_err_to_name(script.status()));
+    return script.status();
+  }
+
+  // Each timer has its own kMaxCommands words of script memory. The script
+  // pointer is set before every command, so auto-increment isn't relied on.
+  const uint8_t base = static_cast<uint8_t>(channel) * PWMScript::kMaxCommands;
+  I2CBus::Lease lease(i2c_bus_, I2CBus::Priority::Bulk);
+  for (int i = 0; i < script.size(); i++) {
+    if (!lease.master().WriteRegister(kSlaveAddress,
+                                      static_cast<uint8_t>(Register::PWMWP),
+                                      base + i)) {
+      return ESP_FAIL;
+    }
+    i2c::Operation op = lease.master().CreateWriteOp(
+        kSlaveAddress, static_cast<uint8_t>(Register::PWMCFG), "PWM::Script");
+    if (!op.ready())
+      return ESP_FAIL;
+    const uint16_t command = script.commands()[i];
+    if (!op.WriteByte(command >> 8) || !op.WriteByte(command & 0xFF) ||
+        !op.Execute()) {
+      return ESP_FAIL;
+    }
+    lease.Yield();
+  }
+  ESP_LOGD(TAG, "Channel %d: uploaded %d commands.", static_cast<int>(channel),
+           script.size());
+  return ESP_OK;
+}
+
+esp_err_t Lighting::Restart(Channel channel, bool run) {
+  const int idx = static_cast<int>(channel);
+  esp_err_t err = WriteByte(static_cast<uint8_t>(Register::TIMSWRES),
+                            Register_TIMSWRES{
+                                .Reserved = 0,
+                                .SWRES2 = idx == 2,
+                                .SWRES1 = idx == 1,
+                                .SWRES0 = idx == 0,
+                            });
+  if (err != ESP_OK)
+    return err;
+  // Also written when stopping: the reset alone leaves PWMEN set, so the
+  // script could carry on running. A disabled timer drives its inactive
+  // level, which with active high polarity is off.
+  return WriteByte(static_cast<uint8_t>(kPWMCFGRegisters[idx]),
+                   Register_PWMCFGx{
+                       .Reserved = 0,
+                       .PWMINT = false,
+                       .PWMPOL = false,
+                       .PWMEN = run,
+                   });
+}
+
+esp_err_t Lighting::OnKeyPress() {
+  return Restart(Channel::KeyPress, /*run=*/true);
+}
+
+esp_err_t Lighting::SetCapsLock(bool caps_lock) {
+  if (caps_lock == caps_lock_)
+    return ESP_OK;
+  caps_lock_ = caps_lock;
+  return Restart(Channel::CapsLock, /*run=*/caps_lock);
+}
+
+esp_err_t Lighting::WriteByte(uint8_t reg, uint8_t value) {
+  I2CBus::Lease lease(i2c_bus_, I2CBus::Priority::Interactive);
+  return lease.master().WriteRegister(kSlaveAddress, reg, value) ? ESP_OK
+                                                                 : ESP_FAIL;
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstdint>
+
+#include <esp_err.h>
+
+class I2CBus;
+class PWMScript;
+
+/**
+ * Keyboard lighting effects run by the LM8330's PWM timers.
+ *
+ * Every effect is compiled into a PWMScript and uploaded once by
+ * Initialize(). From then on the LM8330 animates the LEDs by itself: no
+ * ESP32 CPU time and no I2C traffic per frame. Triggering an effect (e.g.
+ * on a key press) is two register writes: a timer reset (TIMSWRES) then
+ * the timer's PWMCFGx.
+ */
+class Lighting {
+ public:
+  /**
+   * The effect on each PWM timer (the index is the timer number).
+   */
+  enum class Channel : uint8_t {
+    Backlight,  // Slow breathing.
+    KeyPress,   // Flash which fades out, replayed on each key press.
+    CapsLock,   // Blinks while caps lock is on.
+    Count,
+  };
+
+  explicit Lighting(I2CBus* i2c_bus);
+  ~Lighting();
+
+  /**
+   * Upload all scripts and start the backlight.
+   *
+   * The LM8330's PWM timer clock (CLKEN.TIMEN) must already be enabled.
+   */
+  esp_err_t Initialize();
+
+  /**
+   * Replay the key press flash.
+   */
+  esp_err_t OnKeyPress();
+
+  /**
+   * Start or stop the caps lock blink.
+   */
+  esp_err_t SetCapsLock(bool caps_lock);
+
+ private:
+  static constexpr int kNumChannels = static_cast<int>(Channel::Count);
+
+  esp_err_t Upload(Channel channel, const PWMScript& script);
+
+  /**
+   * Reset |channel|'s script to its first command, then start it if |run|,
+   * or else disable the timer with its output off.
+   */
+  esp_err_t Restart(Channel channel, bool run);
+
+  esp_err_t WriteByte(uint8_t reg, uint8_t value);
+
+  I2CBus* i2c_bus_;
+  bool caps_lock_;  // Is the caps lock blink running?
+};
@@ -119,6 +119,21 @@ struct Register_CLKEN {
   operator uint8_t() const { return *reinterpret_cast<const uint8_t*>(this); }
 };
 
+/**
+ * Auto-sleep enable.
+ *
+ * When enabled the device enters sleep mode (key scan stopped, only
+ * wake-up pins monitored) once no key has been pressed for the time
+ * programmed in AUTOSLPTIL/AUTOSLPTIH. A key press on a pin enabled in
+ * GPIOWAKE[2:0] wakes the device.
+ */
+struct Register_AUTOSLP {
+  uint8_t Reserved : 7;  // Reserved - set to zero.
+  uint8_t ENSLPEN : 1;   // Auto-sleep enabled.
+
+  operator uint8_t() const { return *reinterpret_cast<const uint8_t*>(this); }
+};
+
 /**
  * Keypad interrupt mask.
  *
@@ -289,6 +304,36 @@ struct Register_KBDIS {
   operator uint8_t() const { return *reinterpret_cast<const uint8_t*>(this); }
 };
 
+/**
+ * PWM timer configuration control (PWMCFG0-2).
+ *
+ * Starts and stops a PWM timer's script.
+ */
+struct Register_PWMCFGx {
+  uint8_t Reserved : 5;  // Reserved - set to zero.
+  uint8_t PWMINT : 1;    // Timer interrupt enabled (script END command).
+  uint8_t PWMPOL : 1;    // Output polarity. 1 = active low.
+  uint8_t PWMEN : 1;     // Timer enabled: script is running.
+
+  operator uint8_t() const { return *reinterpret_cast<const uint8_t*>(this); }
+};
+
+/**
+ * PWM timer software reset.
+ *
+ * Setting a bit stops the timer and resets its script to the first command.
+ */
+struct Register_TIMSWRES {
+  uint8_t Reserved : 5;  // Reserved - set to zero.
+  uint8_t SWRES2 : 1;    // Reset timer 2.
+  uint8_t SWRES1 : 1;    // Reset timer 1.
+  uint8_t SWRES0 : 1;    // Reset timer 0.
+
+  operator uint8_t() const { return *reinterpret_cast<const uint8_t*>(this); }
+};
+
 static_assert(sizeof(Register_IOCFG) == sizeof(uint8_t));
+static_assert(sizeof(Register_PWMCFGx) == sizeof(uint8_t));
+static_assert(sizeof(Register_TIMSWRES) == sizeof(uint8_t));
 static_assert(sizeof(Register_IOPC1) == sizeof(uint16_t));
 static_assert(sizeof(Register_KBDDEDCFG) == sizeof(uint16_t));
\ No newline at end of file
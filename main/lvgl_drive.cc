@@ -1,11 +1,12 @@
 #include "lvgl_drive.h"
 
-#include <memory>
+#include <algorithm>
 
 #include <dirent.h>
 #include <errno.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/stat.h>
 
 #include <esp_err.h>
 #include <esp_log.h>
@@ -16,6 +17,9 @@ namespace lvgl {
 namespace {
 
 constexpr char TAG[] = "kbd_drive";
+constexpr size_t kMaxOpenFiles = 3;
+// Matches the SPIFFS block size (FS_BLOCK_SIZE).
+constexpr uint32_t kBufferSize = 4096;
 
 lv_fs_res_t ErrnoToLVGL(int errno_value) {
   switch (errno_value) {
@@ -33,47 +37,101 @@ bool drive_ready_cb(struct _lv_fs_drv_t*) {
   return true;
 }
 
+// An open file. Reads are served from |buf|, which holds the file contents
+// at [buf_start, buf_start + buf_len). Decoders issue many small sequential
+// reads, which this turns into one read per kBufferSize block.
+struct FileHandle {
+  FILE* f;             // nullptr if this handle is free.
+  uint32_t size;       // Cached file size.
+  uint32_t pos;        // Logical file position.
+  uint32_t file_pos;   // Position of |f|.
+  uint32_t buf_start;  // File offset of |buf|.
+  uint32_t buf_len;    // Valid bytes in |buf|.
+  uint8_t buf[kBufferSize];
+};
+
+// Statically allocated so that opening a file never allocates. Must not
+// exceed the Filesystem's max_files.
+FileHandle g_files[kMaxOpenFiles];
+
+FileHandle* GetHandle(void* file_p) {
+  FileHandle* handle;
+  memcpy(&handle, file_p, sizeof(handle));
+  return handle;
+}
+
+// Move |f| to the logical position (if not already there).
+lv_fs_res_t SyncFilePos(FileHandle* handle) {
+  if (handle->file_pos == handle->pos)
+    return LV_FS_RES_OK;
+  if (fseek(handle->f, handle->pos, SEEK_SET) != 0)
+    return ErrnoToLVGL(errno);
+  handle->file_pos = handle->pos;
+  return LV_FS_RES_OK;
+}
+
 lv_fs_res_t file_open_cb(struct _lv_fs_drv_t* drv,
                          void* file_p,
                          const char* path,
                          lv_fs_mode_t mode) {
-  std::unique_ptr<char> abs_path(new char[LV_FS_MAX_PATH_LENGTH]);
-#if 1
-  // Hack to restore the '/' prefix needed by SPIFFS.
-  abs_path.get()[0] = '/';
-  strcpy(abs_path.get() + 1, path);
-#else
-  // Looks like LVGL strips off the leading '/' prefix, which seems to
-  // be needed by SPIFFS. This fails with errno=ENOENT(2).
-  strcpy(abs_path.get(), path);
-#endif
+  // LVGL strips off the leading '/' needed by SPIFFS, so restore it.
+  char abs_path[LV_FS_MAX_PATH_LENGTH + 1];
+  if (snprintf(abs_path, sizeof(abs_path), "/%s", path) >=
+      static_cast<int>(sizeof(abs_path))) {
+    return LV_FS_RES_INV_PARAM;
+  }
+
+  FileHandle* handle = nullptr;
+  for (FileHandle& h : g_files) {
+    if (!h.f) {
+      handle = &h;
+      break;
+    }
+  }
+  if (!handle) {
+    ESP_LOGW(TAG, "Can't open \"%s\", too many open files", abs_path);
+    return LV_FS_RES_OUT_OF_MEM;
+  }
 
   FILE* f = nullptr;
   if (mode == LV_FS_MODE_WR)
-    f = fopen(abs_path.get(), "w");
+    f = fopen(abs_path, "w");
   else if (mode == LV_FS_MODE_RD)
-    f = fopen(abs_path.get(), "r");
+    f = fopen(abs_path, "r");
   else if (mode == (LV_FS_MODE_WR | LV_FS_MODE_RD))
-    f = fopen(abs_path.get(), "rw");
+    f = fopen(abs_path, "r+");
 
   if (!f) {
-    ESP_LOGW(TAG, "Can't open \"%s\", mode=0x%x, errno=%d", abs_path.get(),
-             mode, errno);
+    ESP_LOGW(TAG, "Can't open \"%s\", mode=0x%x, errno=%d", abs_path, mode,
+             errno);
     return ErrnoToLVGL(errno);
   }
-  memcpy(file_p, &f, sizeof(f));  // Save the file pointer.
-  ESP_LOGD(TAG, "Opened \"%s\"", abs_path.get());
+  // Reads are buffered by the handle, don't have stdio buffer (and allocate)
+  // as well.
+  setvbuf(f, nullptr, _IONBF, 0);
+
+  struct stat st;
+  if (fstat(fileno(f), &st) != 0) {
+    const lv_fs_res_t res = ErrnoToLVGL(errno);
+    fclose(f);
+    return res;
+  }
+
+  handle->f = f;
+  handle->size = st.st_size;
+  handle->pos = 0;
+  handle->file_pos = 0;
+  handle->buf_start = 0;
+  handle->buf_len = 0;
+  memcpy(file_p, &handle, sizeof(handle));  // Save the handle pointer.
   return LV_FS_RES_OK;
 }
 
 lv_fs_res_t file_close_cb(struct _lv_fs_drv_t* drv, void* file_p) {
-  FILE* f;
-  memcpy(&f, file_p, sizeof(f));
-  if (fclose(f) == 0) {
-    ESP_LOGD(TAG, "Closed file");
-    return LV_FS_RES_OK;
-  }
-  return ErrnoToLVGL(errno);
+  FileHandle* handle = GetHandle(file_p);
+  const int result = fclose(handle->f);
+  handle->f = nullptr;
+  return result == 0 ? LV_FS_RES_OK : ErrnoToLVGL(errno);
 }
 
 lv_fs_res_t file_read_cb(struct _lv_fs_drv_t* drv,
@@ -81,16 +139,48 @@ lv_fs_res_t file_read_cb(struct _lv_fs_drv_t* drv,
                          void* buf,
                          uint32_t btr,
                          uint32_t* br) {
-  FILE* f;
-  memcpy(&f, file_p, sizeof(f));
-  *br = fread(buf, sizeof(uint8_t), btr, f);
-  if (*br == btr) {
-    ESP_LOGV(TAG, "Read %u bytes from file.", btr);
+  FileHandle* handle = GetHandle(file_p);
+  uint8_t* dst = static_cast<uint8_t*>(buf);
+  *br = 0;
+  if (handle->pos >= handle->size)
     return LV_FS_RES_OK;
+  btr = std::min(btr, handle->size - handle->pos);
+
+  while (btr) {
+    // Serve what we can from the buffer.
+    if (handle->pos >= handle->buf_start &&
+        handle->pos < handle->buf_start + handle->buf_len) {
+      const uint32_t offset = handle->pos - handle->buf_start;
+      const uint32_t n = std::min(btr, handle->buf_len - offset);
+      memcpy(dst, handle->buf + offset, n);
+      dst += n;
+      btr -= n;
+      handle->pos += n;
+      *br += n;
+      continue;
+    }
+
+    lv_fs_res_t res = SyncFilePos(handle);
+    if (res != LV_FS_RES_OK)
+      return res;
+    if (btr >= kBufferSize) {
+      // Large read: skip the buffer.
+      const size_t n = fread(dst, 1, btr, handle->f);
+      handle->file_pos += n;
+      handle->pos += n;
+      *br += n;
+      return n == btr ? LV_FS_RES_OK : ErrnoToLVGL(errno);
+    }
+    const size_t n = fread(handle->buf, 1, kBufferSize, handle->f);
+    handle->file_pos += n;
+    handle->buf_start = handle->pos;
+    handle->buf_len = n;
+    if (!n) {
+      ESP_LOGW(TAG, "Error reading %u bytes from file.", btr);
+      return ErrnoToLVGL(errno);
+    }
   }
-  const lv_fs_res_t err = ErrnoToLVGL(errno);
-  ESP_LOGW(TAG, "Error %u reading %u bytes from file.", err, btr);
-  return err;
+  return LV_FS_RES_OK;
 }
 
 lv_fs_res_t file_write_cb(struct _lv_fs_drv_t* drv,
@@ -98,45 +188,37 @@ lv_fs_res_t file_write_cb(struct _lv_fs_drv_t* drv,
                           const void* buf,
                           uint32_t btw,
                           uint32_t* bw) {
-  FILE* f;
-  memcpy(&f, file_p, sizeof(f));
-  *bw = fwrite(buf, sizeof(uint8_t), btw, f);
+  FileHandle* handle = GetHandle(file_p);
+  lv_fs_res_t res = SyncFilePos(handle);
+  if (res != LV_FS_RES_OK)
+    return res;
+  handle->buf_len = 0;  // Invalidate, may overlap the written data.
+  *bw = fwrite(buf, sizeof(uint8_t), btw, handle->f);
+  handle->file_pos += *bw;
+  handle->pos += *bw;
+  handle->size = std::max(handle->size, handle->pos);
   if (*bw == btw)
     return LV_FS_RES_OK;
   return ErrnoToLVGL(errno);
 }
 
 lv_fs_res_t file_seek_cb(struct _lv_fs_drv_t* drv, void* file_p, uint32_t pos) {
-  FILE* f;
-  memcpy(&f, file_p, sizeof(f));
-  if (fseek(f, pos, SEEK_SET) == 0)
-    return LV_FS_RES_OK;
-  return ErrnoToLVGL(errno);
+  // Deferred until the next read/write, which may be from the buffer.
+  GetHandle(file_p)->pos = pos;
+  return LV_FS_RES_OK;
 }
 
 lv_fs_res_t file_tell_cb(struct _lv_fs_drv_t* drv,
                          void* file_p,
                          uint32_t* pos_p) {
-  FILE* f;
-  memcpy(&f, file_p, sizeof(f));
-  *pos_p = ftell(f);
-  if (*pos_p == -1)
-    return ErrnoToLVGL(errno);
+  *pos_p = GetHandle(file_p)->pos;
   return LV_FS_RES_OK;
 }
 
 lv_fs_res_t file_size_cb(struct _lv_fs_drv_t* drv,
                          void* file_p,
                          uint32_t* size_p) {
-  FILE* f;
-  memcpy(&f, file_p, sizeof(f));
-  long current_pos = ftell(f);
-  fseek(f, 0L, SEEK_END);
-  long sz = ftell(f);
-  fseek(f, current_pos, SEEK_SET);
-  if (sz == -1)
-    return ErrnoToLVGL(errno);
-  *size_p = sz;
+  *size_p = GetHandle(file_p)->size;
   return LV_FS_RES_OK;
 }
 
@@ -182,7 +264,7 @@ esp_err_t Drive::Initialize() {
   lv_fs_drv_init(&drv);
 
   drv.letter = 'S';
-  drv.file_size = sizeof(FILE*);
+  drv.file_size = sizeof(FileHandle*);
   drv.rddir_size = sizeof(DIR*);
 
   drv.ready_cb = drive_ready_cb;
@@ -0,0 +1,25 @@
+#include "lvgl_lock.h"
+
+namespace lvgl {
+
+// static
+StaticSemaphore_t Lock::mutex_buffer_;
+
+// static
+SemaphoreHandle_t Lock::mutex_ = nullptr;
+
+// static
+void Lock::Initialize() {
+  if (!mutex_)
+    mutex_ = xSemaphoreCreateRecursiveMutexStatic(&mutex_buffer_);
+}
+
+Lock::Lock()
+    : locked_(xSemaphoreTakeRecursive(mutex_, portMAX_DELAY) == pdTRUE) {}
+
+Lock::~Lock() {
+  if (locked_)
+    xSemaphoreGiveRecursive(mutex_);
+}
+
+}  // namespace lvgl
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+
+namespace lvgl {
+
+/**
+ * Serializes access to LVGL, which is not thread safe.
+ *
+ * LVGL state is global (shared by all displays), so a single recursive mutex
+ * guards all LVGL calls. The render task holds it while running
+ * lv_task_handler(); every other task must hold a Lock while calling any
+ * LVGL function. Create an instance on the stack to hold the lock for its
+ * lifetime.
+ */
+class Lock {
+ public:
+  Lock();
+  ~Lock();
+
+  /**
+   * Create the mutex. Must be called once before any Lock is created.
+   */
+  static void Initialize();
+
+ private:
+  static StaticSemaphore_t mutex_buffer_;
+  static SemaphoreHandle_t mutex_;
+
+  const bool locked_;
+};
+
+}  // namespace lvgl
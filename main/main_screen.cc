@@ -6,6 +6,7 @@
 
 #include "display.h"
 #include "main_screen.h"
+#include "player_state.h"
 
 namespace {
 constexpr char TAG[] = "kbd_screen";
@@ -16,15 +17,31 @@ MainScreen::MainScreen(Display& display) : Screen(display) {
   lv_label_set_text(lbl_test_, "Hello World");
   lv_obj_set_pos(lbl_test_, 0, 0);
 
+  constexpr char kImageName[] = "album_2_cover";
+  const lv_img_dsc_t* image = display.assets().GetImage(kImageName);
+  if (!image)
+    ESP_LOGW(TAG, "No image \"%s\".", kImageName);
   img_test_ = lv_img_create(display.screen(), nullptr);
-  if (img_test_) {
-    constexpr char fname[] = "S:/spiffs/album_2_cover.jpg";
-    ESP_LOGI(TAG, "Loading image \"%s\".", fname);
-    lv_img_set_src(img_test_, fname);
+  if (img_test_ && image) {
+    lv_img_set_src(img_test_, image);
     lv_obj_set_pos(img_test_, 20, 0);
   }
+
+  lbl_player_ = lv_label_create(display.screen(), nullptr);
+  lv_label_set_text(lbl_player_, "");
+  lv_obj_set_pos(lbl_player_, 0, 220);
 }
 
 MainScreen::~MainScreen() = default;
 
 void MainScreen::Update() {}
+
+void MainScreen::SetPlayerState(const PlayerState& state) {
+  if (!state.is_active) {
+    lv_label_set_text(lbl_player_, "");
+    return;
+  }
+  lv_label_set_text_fmt(lbl_player_, "%s %s - %s",
+                        state.is_playing ? LV_SYMBOL_PLAY : LV_SYMBOL_PAUSE,
+                        state.artist_name.c_str(), state.song_title.c_str());
+}
@@ -4,14 +4,18 @@
 
 #include "screen.h"
 
+struct PlayerState;
+
 class MainScreen : public Screen {
  public:
   MainScreen(Display& display);
   ~MainScreen();
 
   void Update() override;
+  void SetPlayerState(const PlayerState& state);
 
  private:
   lv_obj_t* lbl_test_ = nullptr;
+  lv_obj_t* lbl_player_ = nullptr;
   lv_obj_t* img_test_ = nullptr;
 };
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+/**
+ * The state of the (remote) media player as known by this device.
+ *
+ * This may be optimistically updated in response to a user command before
+ * the command has been acknowledged by the player.
+ */
+struct PlayerState {
+  bool is_active = false;    // Is there an active player device?
+  bool is_playing = false;   // Is the player playing (vs. paused)?
+  int volume_percent = -1;   // The device volume (0..100), -1 if unknown.
+  uint32_t progress_ms = 0;  // Position in the current track.
+  uint32_t duration_ms = 0;  // Duration of the current track.
+  std::string artist_name;   // Current track's (first) artist.
+  std::string song_title;    // Current track's title.
+};
@@ -0,0 +1,198 @@
+#include "power_manager.h"
+
+#include <cstdio>
+
+#include <esp_attr.h>
+#include <esp_log.h>
+#include <esp_sleep.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+
+namespace {
+
+constexpr char TAG[] = "kbd_power";
+
+// APB runs at the CPU frequency below 80 MHz, which would change the
+// console UART's baud rate, so don't go lower.
+constexpr int kMinCPUFreqMHz = 80;
+
+constexpr const char* kLockNames[] = {"cpu-max", "no-light-sleep"};
+
+portMUX_TYPE g_mux = portMUX_INITIALIZER_UNLOCKED;  // Guards following.
+esp_pm_lock_handle_t g_locks[2];  // Indexed by PowerManager::Lock::Type.
+uint32_t g_lock_counts[2];        // Number of holders of each lock type.
+bool g_usb_active;                // Is the USB NoLightSleep lock held?
+bool g_usb_lock_acquired;         // ... and was it actually acquired?
+int64_t g_init_time;              // When Initialize() was called.
+int64_t g_state_time;             // When the residency was last updated.
+int64_t g_residency_us[3];        // CPUMax, NoLightSleep, sleep allowed.
+int64_t g_light_sleep_us;         // Time spent in light sleep.
+uint32_t g_light_sleeps;          // Number of light sleeps.
+
+}  // namespace
+
+extern "C" esp_err_t __real_esp_light_sleep_start();
+
+// esp_pm enters light sleep from the idle task, and doesn't report for how
+// long. The linker routes its call here (see main/CMakeLists.txt) so that
+// the time actually slept is measured.
+extern "C" esp_err_t IRAM_ATTR __wrap_esp_light_sleep_start() {
+  const int64_t start = esp_timer_get_time();
+  const esp_err_t err = __real_esp_light_sleep_start();
+  const int64_t slept_us = esp_timer_get_time() - start;
+  // Called within esp_pm's critical section: nesting is allowed.
+  portENTER_CRITICAL_SAFE(&g_mux);
+  if (err == ESP_OK) {
+    g_light_sleep_us += slept_us;
+    g_light_sleeps++;
+  }
+  portEXIT_CRITICAL_SAFE(&g_mux);
+  return err;
+}
+
+PowerManager::Lock::Lock(Type type)
+    : type_(type), acquired_(PowerManager::Acquire(type)) {}
+
+PowerManager::Lock::~Lock() {
+  PowerManager::Release(type_, acquired_);
+}
+
+// static
+void IRAM_ATTR PowerManager::UpdateResidency(int64_t now) {
+  int state = kNumLockTypes;  // Sleep allowed.
+  for (int i = 0; i < kNumLockTypes; i++) {
+    if (g_lock_counts[i]) {
+      state = i;
+      break;
+    }
+  }
+  if (g_state_time)
+    g_residency_us[state] += now - g_state_time;
+  g_state_time = now;
+}
+
+// static
+bool IRAM_ATTR PowerManager::Acquire(Lock::Type type) {
+  const int idx = static_cast<int>(type);
+  const int64_t now = esp_timer_get_time();
+  portENTER_CRITICAL_SAFE(&g_mux);
+  UpdateResidency(now);
+  g_lock_counts[idx]++;
+  esp_pm_lock_handle_t lock = g_locks[idx];
+  portEXIT_CRITICAL_SAFE(&g_mux);
+  return lock && esp_pm_lock_acquire(lock) == ESP_OK;
+}
+
+// static
+void IRAM_ATTR PowerManager::Release(Lock::Type type, bool acquired) {
+  const int idx = static_cast<int>(type);
+  if (acquired)
+    esp_pm_lock_release(g_locks[idx]);
+  const int64_t now = esp_timer_get_time();
+  portENTER_CRITICAL_SAFE(&g_mux);
+  UpdateResidency(now);
+  g_lock_counts[idx]--;
+  portEXIT_CRITICAL_SAFE(&g_mux);
+}
+
+// static
+esp_err_t PowerManager::Initialize() {
+#if CONFIG_PM_ENABLE
+  constexpr esp_pm_lock_type_t kLockTypes[] = {ESP_PM_CPU_FREQ_MAX,
+                                               ESP_PM_NO_LIGHT_SLEEP};
+  static_assert(sizeof(kLockTypes) / sizeof(kLockTypes[0]) == kNumLockTypes);
+  static_assert(sizeof(kLockNames) / sizeof(kLockNames[0]) == kNumLockTypes);
+
+  for (int i = 0; i < kNumLockTypes; i++) {
+    esp_pm_lock_handle_t lock;
+    esp_err_t err = esp_pm_lock_create(kLockTypes[i], 0, kLockNames[i], &lock);
+    if (err != ESP_OK)
+      return err;
+    portENTER_CRITICAL(&g_mux);
+    g_locks[i] = lock;
+    portEXIT_CRITICAL(&g_mux);
+  }
+
+  const esp_pm_config_esp32s2_t config = {
+      .max_freq_mhz = CONFIG_ESP32S2_DEFAULT_CPU_FREQ_MHZ,
+      .min_freq_mhz = kMinCPUFreqMHz,
+      .light_sleep_enable = true,
+  };
+  esp_err_t err = esp_pm_configure(&config);
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "Unable to configure PM: %s", esp_err_to_name(err));
+    return err;
+  }
+  err = esp_sleep_enable_gpio_wakeup();
+  if (err != ESP_OK)
+    return err;
+
+  const int64_t now = esp_timer_get_time();
+  portENTER_CRITICAL(&g_mux);
+  g_init_time = now;
+  g_state_time = now;
+  portEXIT_CRITICAL(&g_mux);
+  ESP_LOGI(TAG, "DFS %d..%d MHz, light sleep enabled.", kMinCPUFreqMHz,
+           CONFIG_ESP32S2_DEFAULT_CPU_FREQ_MHZ);
+  return ESP_OK;
+#else
+  return ESP_ERR_NOT_SUPPORTED;
+#endif
+}
+
+// static
+esp_err_t PowerManager::EnableGPIOWakeup(gpio_num_t gpio, int level) {
+  return gpio_wakeup_enable(
+      gpio, level ? GPIO_INTR_HIGH_LEVEL : GPIO_INTR_LOW_LEVEL);
+}
+
+// static
+esp_err_t PowerManager::DisableGPIOWakeup(gpio_num_t gpio) {
+  return gpio_wakeup_disable(gpio);
+}
+
+// static
+void PowerManager::SetUSBActive(bool active) {
+  // Only called from the USB task, so |g_usb_active| needs no lock.
+  if (active == g_usb_active)
+    return;
+  g_usb_active = active;
+  if (active)
+    g_usb_lock_acquired = Acquire(Lock::Type::NoLightSleep);
+  else
+    Release(Lock::Type::NoLightSleep, g_usb_lock_acquired);
+}
+
+// static
+PowerManager::Residency PowerManager::GetResidency() {
+  const int64_t now = esp_timer_get_time();
+  portENTER_CRITICAL(&g_mux);
+  UpdateResidency(now);
+  const Residency residency = {
+      .cpu_max_us = g_residency_us[0],
+      .no_light_sleep_us = g_residency_us[1],
+      .sleep_allowed_us = g_residency_us[2],
+      .light_sleep_us = g_light_sleep_us,
+      .light_sleeps = g_light_sleeps,
+      .elapsed_us = g_init_time ? now - g_init_time : 0,
+  };
+  portEXIT_CRITICAL(&g_mux);
+  return residency;
+}
+
+// static
+void PowerManager::LogStats() {
+  const Residency residency = GetResidency();
+  if (!residency.elapsed_us)
+    return;
+  ESP_LOGI(TAG, "Residency: light-sleep %lld%% (%u sleeps), cpu-max %lld%%, "
+           "no-light-sleep %lld%%, sleep-allowed %lld%%",
+           residency.light_sleep_us * 100 / residency.elapsed_us,
+           residency.light_sleeps,
+           residency.cpu_max_us * 100 / residency.elapsed_us,
+           residency.no_light_sleep_us * 100 / residency.elapsed_us,
+           residency.sleep_allowed_us * 100 / residency.elapsed_us);
+#if CONFIG_PM_PROFILING
+  esp_pm_dump_locks(stdout);
+#endif
+}
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <cstdint>
+
+#include <driver/gpio.h>
+#include <esp_attr.h>
+#include <esp_err.h>
+#include <esp_pm.h>
+
+/**
+ * Dynamic frequency scaling and automatic light sleep.
+ *
+ * Once initialized the CPU runs at its minimum frequency, and the chip
+ * light sleeps whenever FreeRTOS is idle, unless a Lock is held. Work which
+ * benefits from full speed (rendering, TLS) holds a Lock::Type::CPUMax
+ * lock while it runs. Peripherals which stop in light sleep (e.g. USB while
+ * attached to an active host) hold a Lock::Type::NoLightSleep lock.
+ *
+ * Locks may be taken before (or without) Initialize(), in which case they
+ * do nothing.
+ */
+class PowerManager {
+ public:
+  /**
+   * A power management lock, held for the lifetime of this object.
+   */
+  class Lock {
+   public:
+    enum class Type : uint8_t {
+      CPUMax,        // Run the CPU at its maximum frequency.
+      NoLightSleep,  // Don't enter light sleep.
+      Count,
+    };
+
+    explicit Lock(Type type);
+    ~Lock();
+
+    Lock(const Lock&) = delete;
+    Lock& operator=(const Lock&) = delete;
+
+   private:
+    const Type type_;
+    const bool acquired_;  // Was the esp_pm lock acquired?
+  };
+
+  /**
+   * Time spent in each state since Initialize().
+   *
+   * The lock states show what kept the chip awake. |light_sleep_us| is the
+   * time actually spent in light sleep (out of |sleep_allowed_us|).
+   */
+  struct Residency {
+    int64_t cpu_max_us;         // A CPUMax lock was held.
+    int64_t no_light_sleep_us;  // A NoLightSleep lock was held.
+    int64_t sleep_allowed_us;   // No lock held: light sleep when idle.
+    int64_t light_sleep_us;     // In light sleep.
+    uint32_t light_sleeps;      // Number of times light sleep was entered.
+    int64_t elapsed_us;         // Since Initialize().
+  };
+
+  PowerManager() = delete;
+  ~PowerManager() = delete;
+
+  /**
+   * Enable DFS and automatic light sleep.
+   *
+   * @return ESP_ERR_NOT_SUPPORTED if CONFIG_PM_ENABLE is not set.
+   */
+  static esp_err_t Initialize();
+
+  /**
+   * Wake from light sleep when |gpio| is at |level|.
+   *
+   * Light sleep can only wake on a level, so the pin's interrupt (if any)
+   * must be level triggered too.
+   */
+  static esp_err_t EnableGPIOWakeup(gpio_num_t gpio, int level);
+  static esp_err_t DisableGPIOWakeup(gpio_num_t gpio);
+
+  /**
+   * Keep the chip out of light sleep while USB is in use.
+   *
+   * @param active true while the device is attached to a (non-suspended)
+   *               host.
+   */
+  static void SetUSBActive(bool active);
+
+  /**
+   * Take a lock without a Lock object, for holders which release it in a
+   * different context (e.g. an ISR). Safe to call from an ISR.
+   *
+   * @return true if the esp_pm lock was acquired (false before Initialize()),
+   *         to be passed to Release().
+   */
+  static bool IRAM_ATTR Acquire(Lock::Type type);
+  static void IRAM_ATTR Release(Lock::Type type, bool acquired);
+
+  static Residency GetResidency();
+  static void LogStats();
+
+ private:
+  static constexpr int kNumLockTypes = static_cast<int>(Lock::Type::Count);
+
+  static void IRAM_ATTR UpdateResidency(int64_t now);
+};
@@ -0,0 +1,109 @@
+#include "pwm_script.h"
+
+#include <algorithm>
+
+namespace {
+
+// Command encodings (datasheet "PWM Script Commands").
+constexpr uint16_t kCmdGoToStart = 0x0000;
+constexpr uint16_t kCmdSetPWM = 0x4000;  // | level.
+constexpr uint16_t kCmdEnd = 0xC000;     // | interrupt << 12 | reset << 11.
+constexpr uint16_t kRampPrescale = 1 << 14;
+constexpr uint16_t kRampDown = 1 << 7;
+
+}  // namespace
+
+// static
+PWMScript PWMScript::Breathing(uint32_t period_ms,
+                               uint8_t min_level,
+                               uint8_t max_level) {
+  PWMScript script;
+  script.SetLevel(min_level)
+      .RampTo(max_level, period_ms / 2)
+      .RampTo(min_level, period_ms / 2)
+      .GoToStart();
+  return script;
+}
+
+// static
+PWMScript PWMScript::Flash(uint8_t level, uint32_t fade_ms) {
+  PWMScript script;
+  script.SetLevel(level).RampTo(0, fade_ms).End(/*interrupt=*/false);
+  return script;
+}
+
+// static
+PWMScript PWMScript::Blink(uint32_t on_ms, uint32_t off_ms, uint8_t level) {
+  PWMScript script;
+  script.SetLevel(level).Wait(on_ms).SetLevel(0).Wait(off_ms).GoToStart();
+  return script;
+}
+
+void PWMScript::Append(uint16_t command) {
+  if (size_ == kMaxCommands) {
+    status_ = ESP_ERR_NO_MEM;
+    return;
+  }
+  commands_[size_++] = command;
+}
+
+void PWMScript::AppendRamp(uint32_t steps, bool down, uint32_t step_usecs) {
+  uint16_t prescale = 0;
+  uint32_t unit_usecs = kFastStepUsecs;
+  if (step_usecs > kMaxStepTime * kFastStepUsecs) {
+    prescale = kRampPrescale;
+    unit_usecs = kSlowStepUsecs;
+  }
+  uint32_t step_time = (step_usecs + unit_usecs / 2) / unit_usecs;
+  if (step_time > kMaxStepTime) {
+    status_ = ESP_ERR_INVALID_ARG;
+    step_time = kMaxStepTime;
+  }
+  // Ramps faster than one step per unit run at the fastest rate.
+  step_time = std::max<uint32_t>(step_time, 1);
+  Append(prescale | step_time << 8 | (down ? kRampDown : 0) | steps);
+}
+
+PWMScript& PWMScript::SetLevel(uint8_t level) {
+  Append(kCmdSetPWM | level);
+  level_ = level;
+  return *this;
+}
+
+PWMScript& PWMScript::RampTo(uint8_t level, uint32_t duration_ms) {
+  if (level == level_)
+    return Wait(duration_ms);
+  const bool down = level < level_;
+  const uint32_t steps = down ? level_ - level : level - level_;
+  const uint32_t step_usecs = duration_ms * 1000 / steps;
+  // Each RAMP command changes the level by one per step, for up to
+  // kMaxIncrement steps.
+  for (uint32_t remaining = steps; remaining;) {
+    const uint32_t chunk = std::min(remaining, kMaxIncrement);
+    AppendRamp(chunk, down, step_usecs);
+    remaining -= chunk;
+  }
+  level_ = level;
+  return *this;
+}
+
+PWMScript& PWMScript::Wait(uint32_t duration_ms) {
+  // A RAMP of zero steps waits for one step time.
+  constexpr uint32_t kMaxWaitUsecs = kMaxStepTime * kSlowStepUsecs;
+  for (uint32_t remaining = duration_ms * 1000; remaining;) {
+    const uint32_t chunk = std::min(remaining, kMaxWaitUsecs);
+    AppendRamp(0, /*down=*/false, chunk);
+    remaining -= chunk;
+  }
+  return *this;
+}
+
+PWMScript& PWMScript::GoToStart() {
+  Append(kCmdGoToStart);
+  return *this;
+}
+
+PWMScript& PWMScript::End(bool interrupt) {
+  Append(kCmdEnd | (interrupt ? 1 << 12 : 0));
+  return *this;
+}
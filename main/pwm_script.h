@@ -0,0 +1,100 @@
+#pragma once
+
+#include <cstdint>
+
+#include <esp_err.h>
+
+/**
+ * A compiled LM8330 PWM timer script.
+ *
+ * Each of the LM8330's three PWM timers runs a small script of 16-bit
+ * commands which sets and ramps its output duty cycle, with no help from
+ * the host once started. Scripts are built from millisecond and level
+ * values, which are compiled into the chip's RAMP/SET_PWM/BRANCH/END
+ * commands (see datasheet "PWM Script Commands").
+ *
+ * Errors (e.g. overflowing the script memory) are sticky and reported by
+ * status(), so a script can be built without checking every step.
+ */
+class PWMScript {
+ public:
+  static constexpr int kMaxCommands = 32;  // Per PWM timer.
+  static constexpr uint8_t kMaxLevel = 0xFF;
+
+  /**
+   * Continuously ramp between |min_level| and |max_level|.
+   */
+  static PWMScript Breathing(uint32_t period_ms,
+                             uint8_t min_level,
+                             uint8_t max_level);
+
+  /**
+   * Jump to |level| then fade to off once. Restart the timer to replay.
+   */
+  static PWMScript Flash(uint8_t level, uint32_t fade_ms);
+
+  /**
+   * Continuously blink at |level|.
+   */
+  static PWMScript Blink(uint32_t on_ms, uint32_t off_ms, uint8_t level);
+
+  PWMScript() = default;
+
+  /**
+   * Set the output level immediately.
+   */
+  PWMScript& SetLevel(uint8_t level);
+
+  /**
+   * Linearly change the output level to |level| over |duration_ms|.
+   */
+  PWMScript& RampTo(uint8_t level, uint32_t duration_ms);
+
+  /**
+   * Hold the current output level for |duration_ms|.
+   */
+  PWMScript& Wait(uint32_t duration_ms);
+
+  /**
+   * Restart from the first command.
+   */
+  PWMScript& GoToStart();
+
+  /**
+   * Stop the script, holding the current level.
+   *
+   * @param interrupt Raise the timer's interrupt.
+   */
+  PWMScript& End(bool interrupt);
+
+  const uint16_t* commands() const { return commands_; }
+  int size() const { return size_; }
+
+  /**
+   * @return ESP_OK, ESP_ERR_NO_MEM if the script is too long, or
+   *         ESP_ERR_INVALID_ARG if a duration can't be represented.
+   */
+  esp_err_t status() const { return status_; }
+
+ private:
+  /**
+   * Step time units selected by the RAMP prescale bit.
+   */
+  static constexpr uint32_t kFastStepUsecs = 488;    // Prescale 0: 1/2048 s.
+  static constexpr uint32_t kSlowStepUsecs = 15625;  // Prescale 1: 1/64 s.
+  static constexpr uint32_t kMaxStepTime = 0x3F;     // 6-bit step time.
+  static constexpr uint32_t kMaxIncrement = 0x7F;    // 7-bit increment.
+
+  void Append(uint16_t command);
+
+  /**
+   * Append one RAMP command of |steps| (possibly zero) steps of |step_usecs|
+   * each, rounded to the nearest representable step time.
+   */
+  void AppendRamp(uint32_t steps, bool down, uint32_t step_usecs);
+
+  uint16_t commands_[kMaxCommands] = {};
+  int size_ = 0;
+  uint8_t level_ = 0;  // Output level when the last command completes.
+  esp_err_t status_ = ESP_OK;
+};
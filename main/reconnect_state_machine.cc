@@ -0,0 +1,170 @@
+#include "reconnect_state_machine.h"
+
+#include <algorithm>
+
+namespace {
+
+using Action = ReconnectStateMachine::Action;
+
+constexpr Action kNone = {
+    .went_offline = false,
+    .disconnect = false,
+    .radio_off = false,
+    .connect = false,
+    .cancel_timer = false,
+    .timer_ms = 0,
+};
+
+}  // namespace
+
+ReconnectStateMachine::ReconnectStateMachine(const Params& params,
+                                             RandomFunc random)
+    : params_(params),
+      random_(random),
+      state_(State::Idle),
+      state_start_us_(0),
+      failures_(0),
+      expect_disconnect_(false),
+      stats_({}) {}
+
+void ReconnectStateMachine::SetState(State state, int64_t now_us) {
+  const int64_t elapsed = now_us - state_start_us_;
+  switch (state_) {
+    case State::Idle:
+      break;
+    case State::Connecting:
+      stats_.retrying_us += elapsed;
+      break;
+    case State::Connected:
+      stats_.connected_us += elapsed;
+      break;
+    case State::Backoff:
+      stats_.offline_us += elapsed;
+      break;
+  }
+  state_ = state;
+  state_start_us_ = now_us;
+}
+
+uint32_t ReconnectStateMachine::BackoffDelay(uint32_t retry) const {
+  // Limit the shift so that it can't overflow.
+  const uint32_t shift = std::min<uint32_t>(retry - 1, 20);
+  const uint32_t delay = static_cast<uint32_t>(std::min<uint64_t>(
+      static_cast<uint64_t>(params_.initial_delay_ms) << shift,
+      params_.max_delay_ms));
+  // "Equal jitter": somewhere in the upper half of the delay.
+  const uint32_t half = delay / 2;
+  return delay - half + random_() % (half + 1);
+}
+
+Action ReconnectStateMachine::Connect(int64_t now_us) {
+  SetState(State::Connecting, now_us);
+  stats_.attempts++;
+  Action action = kNone;
+  action.connect = true;
+  action.timer_ms = params_.connect_timeout_ms;
+  return action;
+}
+
+Action ReconnectStateMachine::Backoff(int64_t now_us) {
+  failures_++;
+  SetState(State::Backoff, now_us);
+  Action action = kNone;
+  action.timer_ms = BackoffDelay(failures_);
+  action.radio_off = action.timer_ms >= params_.radio_off_delay_ms;
+  return action;
+}
+
+Action ReconnectStateMachine::Start(int64_t now_us) {
+  failures_ = 0;
+  expect_disconnect_ = false;
+  return Connect(now_us);
+}
+
+Action ReconnectStateMachine::OnDisconnected(int64_t now_us) {
+  switch (state_) {
+    case State::Idle:
+    case State::Backoff:
+      // e.g. an attempt being aborted. Keeps the pending retry.
+      return kNone;
+    case State::Connected: {
+      // The first attempt after losing the connection is immediate.
+      stats_.disconnects++;
+      failures_ = 0;
+      Action action = Connect(now_us);
+      action.went_offline = true;
+      return action;
+    }
+    case State::Connecting:
+      if (expect_disconnect_) {
+        expect_disconnect_ = false;
+        return Connect(now_us);
+      }
+      return Backoff(now_us);
+  }
+  return kNone;
+}
+
+Action ReconnectStateMachine::OnGotIP(int64_t now_us) {
+  failures_ = 0;
+  expect_disconnect_ = false;
+  if (state_ != State::Connected)
+    SetState(State::Connected, now_us);
+  Action action = kNone;
+  action.cancel_timer = true;  // The attempt timeout.
+  return action;
+}
+
+Action ReconnectStateMachine::OnLostIP(int64_t now_us) {
+  if (state_ != State::Connected)
+    return kNone;
+  // Still associated, but without an address: drop the association and
+  // reconnect (from OnDisconnected()) to get a new lease.
+  stats_.disconnects++;
+  failures_ = 0;
+  expect_disconnect_ = true;
+  SetState(State::Connecting, now_us);
+  Action action = kNone;
+  action.went_offline = true;
+  action.disconnect = true;
+  action.timer_ms = params_.connect_timeout_ms;
+  return action;
+}
+
+Action ReconnectStateMachine::OnTimer(int64_t now_us) {
+  switch (state_) {
+    case State::Idle:
+    case State::Connected:
+      return kNone;
+    case State::Connecting: {
+      // The attempt timed out.
+      expect_disconnect_ = false;
+      Action action = Backoff(now_us);
+      action.disconnect = true;
+      return action;
+    }
+    case State::Backoff:
+      return Connect(now_us);
+  }
+  return kNone;
+}
+
+ReconnectStateMachine::Stats ReconnectStateMachine::GetStats(
+    int64_t now_us) const {
+  Stats stats = stats_;
+  const int64_t elapsed = now_us - state_start_us_;
+  switch (state_) {
+    case State::Idle:
+      break;
+    case State::Connecting:
+      stats.retrying_us += elapsed;
+      break;
+    case State::Connected:
+      stats.connected_us += elapsed;
+      break;
+    case State::Backoff:
+      stats.offline_us += elapsed;
+      break;
+  }
+  return stats;
+}
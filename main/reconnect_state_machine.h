@@ -0,0 +1,121 @@
+#pragma once
+
+#include <cstdint>
+
+/**
+ * Decides when to (re)connect to the Wi-Fi network.
+ *
+ * The first reconnection attempt after a disconnection is immediate. Later
+ * attempts are separated by an exponentially growing, jittered delay, so a
+ * flaky AP doesn't have the radio retrying back to back, and devices which
+ * lost the same AP don't retry in lock step. It never gives up. When the
+ * delay is long enough the radio is turned off until the next attempt.
+ *
+ * This class only makes decisions, the caller feeds it events and performs
+ * the returned actions. It has no ESP-IDF dependencies, so it can be tested
+ * on a host with simulated events and time. Not thread safe.
+ */
+class ReconnectStateMachine {
+ public:
+  enum class State : uint8_t {
+    Idle,        // Not started.
+    Connecting,  // Associating with the AP and/or getting an IP address.
+    Connected,   // Have an IP address.
+    Backoff,     // Waiting to retry.
+  };
+
+  /**
+   * What the caller must do after an event, in this order.
+   */
+  struct Action {
+    bool went_offline;  // The IP address was just lost: tell the app.
+    bool disconnect;    // Drop the association, or abort the attempt.
+    bool radio_off;     // Turn the radio off until the next attempt.
+    bool connect;       // Start an attempt (turning the radio on).
+    bool cancel_timer;  // Cancel the pending OnTimer() (if |timer_ms| is 0).
+    uint32_t timer_ms;  // If nonzero, call OnTimer() after this instead.
+  };
+
+  struct Params {
+    uint32_t connect_timeout_ms;  // Longest attempt, including DHCP.
+    uint32_t initial_delay_ms;    // Delay before the second retry.
+    uint32_t max_delay_ms;        // Longest delay between retries.
+    uint32_t radio_off_delay_ms;  // Shortest delay to turn the radio off for.
+  };
+
+  /**
+   * Time spent in each state (Connecting is "retrying", Backoff "offline"),
+   * and counters.
+   */
+  struct Stats {
+    int64_t connected_us;
+    int64_t retrying_us;
+    int64_t offline_us;
+    uint32_t attempts;     // Connection attempts made.
+    uint32_t disconnects;  // Times the IP address was lost.
+  };
+
+  typedef uint32_t (*RandomFunc)();
+
+  static constexpr Params kDefaultParams = {
+      .connect_timeout_ms = 30 * 1000,
+      .initial_delay_ms = 1000,
+      .max_delay_ms = 5 * 60 * 1000,
+      .radio_off_delay_ms = 10 * 1000,
+  };
+
+  /**
+   * @param random Source of jitter, e.g. esp_random.
+   */
+  ReconnectStateMachine(const Params& params, RandomFunc random);
+
+  /**
+   * Start connecting, with the radio configured but off.
+   */
+  Action Start(int64_t now_us);
+
+  Action OnDisconnected(int64_t now_us);
+  Action OnGotIP(int64_t now_us);
+  Action OnLostIP(int64_t now_us);
+
+  /**
+   * The last nonzero Action |timer_ms| has elapsed.
+   *
+   * An Action with neither |timer_ms| nor |cancel_timer| leaves the pending
+   * timer running.
+   */
+  Action OnTimer(int64_t now_us);
+
+  State state() const { return state_; }
+
+  /**
+   * @return The stats, including time in the current state until |now_us|.
+   */
+  Stats GetStats(int64_t now_us) const;
+
+ private:
+  void SetState(State state, int64_t now_us);
+
+  /**
+   * Enter Connecting and start an attempt.
+   */
+  Action Connect(int64_t now_us);
+
+  /**
+   * Count a failed attempt and wait to retry.
+   */
+  Action Backoff(int64_t now_us);
+
+  /**
+   * @return The (jittered) delay before retry number |retry| (from 1).
+   */
+  uint32_t BackoffDelay(uint32_t retry) const;
+
+  const Params params_;
+  const RandomFunc random_;
+  State state_;
+  int64_t state_start_us_;  // When |state_| was entered.
+  uint32_t failures_;       // Consecutive failed attempts.
+  bool expect_disconnect_;  // Was a disconnect requested by OnLostIP()?
+  Stats stats_;
+};
@@ -0,0 +1,290 @@
+#include "request_scheduler.h"
+
+#include <algorithm>
+#include <utility>
+
+#include <esp_http_client.h>
+#include <esp_log.h>
+#include <esp_system.h>
+#include <esp_timer.h>
+#include <freertos/task.h>
+
+#include "http_client.h"
+
+namespace {
+
+constexpr char TAG[] = "kbd_sched";
+
+constexpr uint32_t kMaxAttempts = 4;
+// Consecutive failures which open the circuit breaker.
+constexpr uint32_t kCircuitFailureThreshold = 5;
+constexpr int64_t kCircuitOpenUsecs = 60 * 1000 * 1000;
+constexpr int64_t kMinBackoffUsecs = 1000 * 1000;
+constexpr int64_t kMaxBackoffUsecs = 64 * 1000 * 1000;
+// Longest time Perform() will block the caller. Longer waits are rejected
+// so that the caller can try again later.
+constexpr int64_t kMaxWaitUsecs = 10 * 1000 * 1000;
+constexpr int kHttpStatusTooManyRequests = 429;
+constexpr int kHttpStatusFirstServerError = 500;
+
+struct EndpointConfig {
+  const char* name;
+  uint32_t bucket_capacity;
+  int64_t refill_period_us;
+};
+
+// Indexed by RequestScheduler::Endpoint.
+constexpr EndpointConfig kEndpointConfigs[] = {
+    {"token", 2, 30 * 1000 * 1000},
+    {"player", 2, 2 * 1000 * 1000},
+    {"command", 5, 250 * 1000},
+};
+
+static_assert(sizeof(kEndpointConfigs) / sizeof(kEndpointConfigs[0]) ==
+              static_cast<int>(RequestScheduler::Endpoint::Count));
+
+bool IsRetryableStatus(int status_code) {
+  return status_code == kHttpStatusTooManyRequests ||
+         status_code >= kHttpStatusFirstServerError;
+}
+
+// Is the failure one which the server can't have acted on?
+bool WasNotSent(esp_err_t err, int status_code) {
+  return err == ESP_ERR_HTTP_CONNECT ||
+         (err == ESP_OK && status_code == kHttpStatusTooManyRequests);
+}
+
+}  // namespace
+
+RequestScheduler::RequestScheduler(DepthCallback depth_callback)
+    : depth_callback_(std::move(depth_callback)),
+      mutex_(xSemaphoreCreateMutex()),
+      depth_(0) {
+  const int64_t now = esp_timer_get_time();
+  for (int i = 0; i < static_cast<int>(Endpoint::Count); i++) {
+    EndpointState& state = endpoints_[i];
+    state.bucket_capacity = kEndpointConfigs[i].bucket_capacity;
+    state.refill_period_us = kEndpointConfigs[i].refill_period_us;
+    state.tokens_updated_us = now;
+    state.tokens = state.bucket_capacity;
+    state.not_before_us = 0;
+    state.consecutive_failures = 0;
+    state.circuit = CircuitState::Closed;
+    state.open_until_us = 0;
+  }
+}
+
+RequestScheduler::~RequestScheduler() {
+  vSemaphoreDelete(mutex_);
+}
+
+void RequestScheduler::RefillTokens(EndpointState* state, int64_t now_us) {
+  const int64_t earned =
+      (now_us - state->tokens_updated_us) / state->refill_period_us;
+  if (!earned)
+    return;
+  state->tokens_updated_us += earned * state->refill_period_us;
+  state->tokens = std::min<int64_t>(state->tokens + earned,
+                                    state->bucket_capacity);
+  if (state->tokens == state->bucket_capacity)
+    state->tokens_updated_us = now_us;
+}
+
+int64_t RequestScheduler::GetBackoffUsecs(uint32_t num_failures) const {
+  int64_t backoff = kMinBackoffUsecs << std::min<uint32_t>(num_failures, 16);
+  if (backoff > kMaxBackoffUsecs)
+    backoff = kMaxBackoffUsecs;
+  // "Equal jitter": half fixed, half random, so that many devices failing
+  // together don't retry together.
+  const int64_t half = backoff / 2;
+  return half + static_cast<int64_t>(esp_random() % (half + 1));
+}
+
+esp_err_t RequestScheduler::Acquire(Endpoint endpoint) {
+  EndpointState& state = endpoints_[static_cast<int>(endpoint)];
+  const char* name = kEndpointConfigs[static_cast<int>(endpoint)].name;
+  bool counted_paced = false;
+  bool is_trial = false;  // Is this the half-open circuit's trial request?
+
+  while (true) {
+    int64_t wait_us = 0;
+    bool give_mutex = xSemaphoreTake(mutex_, portMAX_DELAY) == pdTRUE;
+    const int64_t now = esp_timer_get_time();
+    if (state.circuit == CircuitState::Open && now >= state.open_until_us) {
+      ESP_LOGI(TAG, "%s: circuit half-open, sending trial request.", name);
+      state.circuit = CircuitState::HalfOpen;
+      state.not_before_us = 0;
+      is_trial = true;
+    } else if (state.circuit == CircuitState::Open ||
+               (state.circuit == CircuitState::HalfOpen && !is_trial)) {
+      state.stats.rejected++;
+      if (give_mutex)
+        xSemaphoreGive(mutex_);
+      return ESP_ERR_INVALID_STATE;
+    }
+
+    RefillTokens(&state, now);
+    if (now < state.not_before_us) {
+      wait_us = state.not_before_us - now;
+    } else if (!state.tokens) {
+      wait_us = state.tokens_updated_us + state.refill_period_us - now;
+    } else {
+      state.tokens--;
+    }
+
+    if (wait_us > kMaxWaitUsecs) {
+      state.stats.rejected++;
+      if (is_trial) {
+        // Let the next request be the trial.
+        state.circuit = CircuitState::Open;
+        state.open_until_us = now;
+      }
+      if (give_mutex)
+        xSemaphoreGive(mutex_);
+      ESP_LOGW(TAG, "%s: rejecting request, would wait %lld ms.", name,
+               wait_us / 1000);
+      return ESP_ERR_TIMEOUT;
+    }
+    if (wait_us && !counted_paced) {
+      state.stats.paced++;
+      counted_paced = true;
+    }
+    if (give_mutex)
+      xSemaphoreGive(mutex_);
+
+    if (!wait_us)
+      return ESP_OK;
+    ESP_LOGD(TAG, "%s: waiting %lld ms.", name, wait_us / 1000);
+    vTaskDelay(std::max<TickType_t>(1, pdMS_TO_TICKS(wait_us / 1000)));
+  }
+}
+
+bool RequestScheduler::Record(Endpoint endpoint,
+                              Retry retry,
+                              esp_err_t err,
+                              int status_code,
+                              uint32_t retry_after_secs) {
+  EndpointState& state = endpoints_[static_cast<int>(endpoint)];
+  const char* name = kEndpointConfigs[static_cast<int>(endpoint)].name;
+
+  bool give_mutex = xSemaphoreTake(mutex_, portMAX_DELAY) == pdTRUE;
+  state.stats.requests++;
+  const bool failed = err != ESP_OK || IsRetryableStatus(status_code);
+  if (err != ESP_OK)
+    state.stats.network_errors++;
+  else if (status_code == kHttpStatusTooManyRequests)
+    state.stats.throttled++;
+  else if (status_code >= kHttpStatusFirstServerError)
+    state.stats.server_errors++;
+  else
+    state.stats.successes++;
+
+  const int64_t now = esp_timer_get_time();
+  if (!failed) {
+    if (state.circuit != CircuitState::Closed)
+      ESP_LOGI(TAG, "%s: circuit closed.", name);
+    state.consecutive_failures = 0;
+    state.circuit = CircuitState::Closed;
+    state.not_before_us = 0;
+  } else {
+    state.consecutive_failures++;
+    int64_t backoff = GetBackoffUsecs(state.consecutive_failures - 1);
+    const int64_t retry_after_us =
+        static_cast<int64_t>(retry_after_secs) * 1000 * 1000;
+    if (retry_after_us > backoff)
+      backoff = retry_after_us;
+    state.not_before_us = now + backoff;
+
+    if (state.circuit == CircuitState::HalfOpen ||
+        state.consecutive_failures >= kCircuitFailureThreshold) {
+      state.circuit = CircuitState::Open;
+      state.open_until_us =
+          now + std::max<int64_t>(kCircuitOpenUsecs, retry_after_us);
+      state.stats.circuit_opens++;
+      ESP_LOGW(TAG, "%s: circuit open for %lld s after %u failures.", name,
+               (state.open_until_us - now) / (1000 * 1000),
+               state.consecutive_failures);
+    }
+  }
+  const bool retryable =
+      failed && state.circuit == CircuitState::Closed &&
+      (retry == Retry::Any || WasNotSent(err, status_code));
+  if (give_mutex)
+    xSemaphoreGive(mutex_);
+  return retryable;
+}
+
+void RequestScheduler::UpdateDepth(int delta) {
+  bool give_mutex = xSemaphoreTake(mutex_, portMAX_DELAY) == pdTRUE;
+  const bool was_idle = !depth_;
+  depth_ += delta;
+  // Called with the mutex held so that calls are never reordered.
+  if (depth_callback_ && was_idle != !depth_)
+    depth_callback_(depth_);
+  if (give_mutex)
+    xSemaphoreGive(mutex_);
+}
+
+esp_err_t RequestScheduler::Perform(Endpoint endpoint,
+                                    Retry retry,
+                                    const HTTPClient* client,
+                                    const Request& request,
+                                    int* status_code) {
+  // Counted from before any pacing delay, so that the callback has time to
+  // get the network ready.
+  UpdateDepth(1);
+  const esp_err_t err =
+      PerformWithRetries(endpoint, retry, client, request, status_code);
+  UpdateDepth(-1);
+  return err;
+}
+
+esp_err_t RequestScheduler::PerformWithRetries(Endpoint endpoint,
+                                               Retry retry,
+                                               const HTTPClient* client,
+                                               const Request& request,
+                                               int* status_code) {
+  esp_err_t err = ESP_FAIL;
+  for (uint32_t attempt = 0; attempt < kMaxAttempts; attempt++) {
+    if (attempt) {
+      bool give_mutex = xSemaphoreTake(mutex_, portMAX_DELAY) == pdTRUE;
+      endpoints_[static_cast<int>(endpoint)].stats.retries++;
+      if (give_mutex)
+        xSemaphoreGive(mutex_);
+    }
+    const esp_err_t acquire_err = Acquire(endpoint);
+    if (acquire_err != ESP_OK)
+      return attempt ? err : acquire_err;
+
+    *status_code = 0;
+    err = request(status_code);
+    if (!Record(endpoint, retry, err, *status_code,
+                err == ESP_OK ? client->retry_after_secs() : 0)) {
+      return err;
+    }
+    ESP_LOGW(TAG, "%s: attempt %u failed (err=%s, status=%d).",
+             kEndpointConfigs[static_cast<int>(endpoint)].name, attempt + 1,
+             esp_err_to_name(err), *status_code);
+  }
+  return err;
+}
+
+RequestScheduler::Stats RequestScheduler::GetStats(Endpoint endpoint) const {
+  bool give_mutex = xSemaphoreTake(mutex_, portMAX_DELAY) == pdTRUE;
+  const Stats stats = endpoints_[static_cast<int>(endpoint)].stats;
+  if (give_mutex)
+    xSemaphoreGive(mutex_);
+  return stats;
+}
+
+void RequestScheduler::LogStats() const {
+  for (int i = 0; i < static_cast<int>(Endpoint::Count); i++) {
+    const Stats stats = GetStats(static_cast<Endpoint>(i));
+    ESP_LOGI(TAG,
+             "%s: requests=%u ok=%u 429=%u 5xx=%u net_err=%u retries=%u "
+             "paced=%u rejected=%u circuit_opens=%u",
+             kEndpointConfigs[i].name, stats.requests, stats.successes,
+             stats.throttled, stats.server_errors, stats.network_errors,
+             stats.retries, stats.paced, stats.rejected, stats.circuit_opens);
+  }
+}
@@ -0,0 +1,159 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+
+#include <esp_err.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+
+class HTTPClient;
+
+/**
+ * Paces and retries requests to a rate-limited web service.
+ *
+ * Each endpoint has its own token bucket limiting the steady-state request
+ * rate. Responses of 429 (Too Many Requests) or 5xx are retried with
+ * jittered exponential backoff, honoring the server's Retry-After header
+ * when present. Requests which aren't idempotent are only retried when the
+ * server can't have acted on them (see Retry). After too many consecutive
+ * failures the endpoint's circuit breaker opens and requests are rejected
+ * without touching the network until a cool-down has elapsed, after which
+ * a single trial request is allowed through.
+ *
+ * The number of requests being performed (queued or in flight) is reported
+ * to an optional callback, e.g. so that the radio can stay fully awake only
+ * while requests are outstanding.
+ */
+class RequestScheduler {
+ public:
+  enum class Endpoint : uint8_t {
+    Token,          // Access token retrieval/refresh.
+    Player,         // Player state polling.
+    PlayerCommand,  // Playback commands.
+    Count,
+  };
+
+  /**
+   * Which failed attempts a request may be retried after.
+   */
+  enum class Retry : uint8_t {
+    Any,      // Idempotent (e.g. GET, PUT): any 429, 5xx or network error.
+    NotSent,  // Not idempotent (e.g. POST): only a 429, or a failure to
+              // connect. A 5xx or lost response may follow a request which
+              // was acted on.
+  };
+
+  /**
+   * Per-endpoint counters for diagnostics.
+   */
+  struct Stats {
+    uint32_t requests = 0;        // Requests sent (including retries).
+    uint32_t successes = 0;       // Requests with a non-retryable response.
+    uint32_t throttled = 0;       // 429 responses.
+    uint32_t server_errors = 0;   // 5xx responses.
+    uint32_t network_errors = 0;  // Requests failing without a response.
+    uint32_t retries = 0;         // Retries after a failed request.
+    uint32_t paced = 0;           // Requests delayed by pacing or backoff.
+    uint32_t rejected = 0;        // Rejected by open circuit or timeout.
+    uint32_t circuit_opens = 0;   // # times the circuit breaker opened.
+  };
+
+  /**
+   * Sends a request, writing the HTTP status to |status_code|.
+   */
+  using Request = std::function<esp_err_t(int* status_code)>;
+
+  /**
+   * Called with the number of requests being performed each time it goes
+   * from zero to one, or one to zero.
+   */
+  using DepthCallback = std::function<void(uint32_t depth)>;
+
+  explicit RequestScheduler(DepthCallback depth_callback = nullptr);
+  ~RequestScheduler();
+
+  /**
+   * Perform a request, retrying it as needed.
+   *
+   * Blocks the calling task while the request is paced or backed off.
+   *
+   * @param endpoint The endpoint being requested.
+   * @param retry    Which failures |request| may be retried after.
+   * @param client   The client used by |request|. Used to read Retry-After.
+   * @param request  Sends the request.
+   * @param status_code Receives the HTTP status of the last attempt.
+   *
+   * @return ESP_OK if a response was received (check |status_code|),
+   *         ESP_ERR_INVALID_STATE if the circuit breaker is open,
+   *         ESP_ERR_TIMEOUT if the request would need to wait too long,
+   *         or the error from the last attempt.
+   */
+  esp_err_t Perform(Endpoint endpoint,
+                    Retry retry,
+                    const HTTPClient* client,
+                    const Request& request,
+                    int* status_code);
+
+  Stats GetStats(Endpoint endpoint) const;
+
+  void LogStats() const;
+
+ private:
+  enum class CircuitState : uint8_t {
+    Closed,    // Requests flow normally.
+    Open,      // Requests rejected until |open_until_us|.
+    HalfOpen,  // A single trial request is in flight.
+  };
+
+  struct EndpointState {
+    uint32_t bucket_capacity;       // Max. burst size.
+    int64_t refill_period_us;       // Time to earn one token.
+    int64_t tokens_updated_us;      // When |tokens| was last refilled.
+    uint32_t tokens;                // Tokens currently available.
+    int64_t not_before_us;          // Backoff/Retry-After deadline.
+    uint32_t consecutive_failures;  // Retryable failures in a row.
+    CircuitState circuit;           // Circuit breaker state.
+    int64_t open_until_us;          // When an open circuit goes half-open.
+    Stats stats;                    // Diagnostic counters.
+  };
+
+  /**
+   * Perform(), without the depth accounting.
+   */
+  esp_err_t PerformWithRetries(Endpoint endpoint,
+                               Retry retry,
+                               const HTTPClient* client,
+                               const Request& request,
+                               int* status_code);
+
+  /**
+   * Add |delta| to |depth_|, calling |depth_callback_| if it became, or
+   * stopped being, zero.
+   */
+  void UpdateDepth(int delta);
+
+  /**
+   * Wait until a request to |endpoint| may be sent.
+   */
+  esp_err_t Acquire(Endpoint endpoint);
+
+  /**
+   * Update endpoint state with the result of a request.
+   *
+   * @return true if the request should be retried.
+   */
+  bool Record(Endpoint endpoint,
+              Retry retry,
+              esp_err_t err,
+              int status_code,
+              uint32_t retry_after_secs);
+
+  void RefillTokens(EndpointState* state, int64_t now_us);
+  int64_t GetBackoffUsecs(uint32_t num_failures) const;
+
+  const DepthCallback depth_callback_;
+  SemaphoreHandle_t mutex_;  // Synchronize access to following members.
+  EndpointState endpoints_[static_cast<int>(Endpoint::Count)];
+  uint32_t depth_;  // Requests in Perform().
+};
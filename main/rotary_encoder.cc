@@ -0,0 +1,243 @@
+#include "rotary_encoder.h"
+
+#include <cstdlib>
+#include <utility>
+
+#include <esp_log.h>
+#include <esp_timer.h>
+
+namespace {
+
+constexpr char TAG[] = "kbd_encoder";
+
+// Quadrature edges counted per detent (click) of the knob.
+constexpr int kCountsPerDetent = 4;
+// Poll period while the knob is turning. Polling stops once it has been
+// idle for |kIdleAfterUsecs|.
+constexpr uint32_t kActivePollMSecs = 20;
+constexpr int64_t kIdleAfterUsecs = 1000 * 1000;
+// The counter resets to zero on reaching either limit. Even the fastest
+// spin is a few hundred counts per poll, so this never happens between two
+// reads unless the task is starved for seconds.
+constexpr int16_t kCounterLimit = 30000;
+// Pulses shorter than this many APB clocks (80MHz) are ignored: ~12us.
+constexpr uint16_t kGlitchFilterClocks = 1000;
+
+struct AccelerationStep {
+  int min_detents_per_sec;  // Speed at which this step starts to apply.
+  int multiplier;           // Steps reported per detent.
+};
+
+// Ordered fastest first.
+constexpr AccelerationStep kAccelerationSteps[] = {
+    {25, 4},
+    {10, 2},
+};
+
+}  // namespace
+
+RotaryEncoder::RotaryEncoder(gpio_num_t a_gpio,
+                             gpio_num_t b_gpio,
+                             pcnt_unit_t unit)
+    : a_gpio_(a_gpio),
+      b_gpio_(b_gpio),
+      unit_(unit),
+      task_(nullptr),
+      last_count_(0),
+      residual_counts_(0) {}
+
+RotaryEncoder::~RotaryEncoder() {
+  gpio_isr_handler_remove(a_gpio_);
+  gpio_isr_handler_remove(b_gpio_);
+  if (task_)
+    vTaskDelete(task_);
+  DisarmWakeup();
+  pcnt_counter_pause(unit_);
+}
+
+// static
+void IRAM_ATTR RotaryEncoder::PinISR(void* arg) {
+  RotaryEncoder* encoder = static_cast<RotaryEncoder*>(arg);
+  // The interrupts are level triggered, so keep them from firing again
+  // until the task re-arms them.
+  gpio_intr_disable(encoder->a_gpio_);
+  gpio_intr_disable(encoder->b_gpio_);
+  if (!encoder->task_)
+    return;
+  BaseType_t higher_priority_task_woken = pdFALSE;
+  vTaskNotifyGiveFromISR(encoder->task_, &higher_priority_task_woken);
+  if (higher_priority_task_woken)
+    portYIELD_FROM_ISR();
+}
+
+esp_err_t RotaryEncoder::ArmWakeup() {
+  for (gpio_num_t gpio : {a_gpio_, b_gpio_}) {
+    // If the pin changes after being read the interrupt fires straight away.
+    esp_err_t err = PowerManager::EnableGPIOWakeup(gpio, !gpio_get_level(gpio));
+    if (err != ESP_OK)
+      return err;
+    err = gpio_intr_enable(gpio);
+    if (err != ESP_OK)
+      return err;
+  }
+  return ESP_OK;
+}
+
+void RotaryEncoder::DisarmWakeup() {
+  for (gpio_num_t gpio : {a_gpio_, b_gpio_}) {
+    gpio_intr_disable(gpio);
+    PowerManager::DisableGPIOWakeup(gpio);
+  }
+}
+
+esp_err_t RotaryEncoder::ConfigureCounter() {
+  // Channel 0 counts A's edges, with B selecting the direction; channel 1
+  // the reverse. Together they count every edge of the quadrature cycle.
+  const pcnt_config_t channel_configs[] = {
+      {
+          .pulse_gpio_num = a_gpio_,
+          .ctrl_gpio_num = b_gpio_,
+          .lctrl_mode = PCNT_MODE_REVERSE,
+          .hctrl_mode = PCNT_MODE_KEEP,
+          .pos_mode = PCNT_COUNT_DEC,
+          .neg_mode = PCNT_COUNT_INC,
+          .counter_h_lim = kCounterLimit,
+          .counter_l_lim = -kCounterLimit,
+          .unit = unit_,
+          .channel = PCNT_CHANNEL_0,
+      },
+      {
+          .pulse_gpio_num = b_gpio_,
+          .ctrl_gpio_num = a_gpio_,
+          .lctrl_mode = PCNT_MODE_REVERSE,
+          .hctrl_mode = PCNT_MODE_KEEP,
+          .pos_mode = PCNT_COUNT_INC,
+          .neg_mode = PCNT_COUNT_DEC,
+          .counter_h_lim = kCounterLimit,
+          .counter_l_lim = -kCounterLimit,
+          .unit = unit_,
+          .channel = PCNT_CHANNEL_1,
+      },
+  };
+  for (const pcnt_config_t& config : channel_configs) {
+    esp_err_t err = pcnt_unit_config(&config);
+    if (err != ESP_OK)
+      return err;
+  }
+
+  // The encoder's switches are open-drain to ground.
+  gpio_pullup_en(a_gpio_);
+  gpio_pullup_en(b_gpio_);
+
+  esp_err_t err = pcnt_set_filter_value(unit_, kGlitchFilterClocks);
+  if (err != ESP_OK)
+    return err;
+  err = pcnt_filter_enable(unit_);
+  if (err != ESP_OK)
+    return err;
+
+  err = pcnt_counter_pause(unit_);
+  if (err != ESP_OK)
+    return err;
+  err = pcnt_counter_clear(unit_);
+  if (err != ESP_OK)
+    return err;
+  return pcnt_counter_resume(unit_);
+}
+
+esp_err_t RotaryEncoder::Initialize(Callback callback) {
+  callback_ = std::move(callback);
+
+  esp_err_t err = ConfigureCounter();
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "Unable to configure PCNT unit %d: %s", unit_,
+             esp_err_to_name(err));
+    return err;
+  }
+
+  // gpio_install_isr_service() has already been called by App.
+  for (gpio_num_t gpio : {a_gpio_, b_gpio_}) {
+    err = gpio_isr_handler_add(gpio, PinISR, this);
+    if (err != ESP_OK)
+      return err;
+  }
+
+  // https://www.freertos.org/FAQMem.html#StackSize
+  constexpr uint32_t kStackDepthWords = 2048;
+  if (xTaskCreate(EncoderTask, "encoder", kStackDepthWords, this,
+                  tskIDLE_PRIORITY + 1, &task_) != pdPASS) {
+    return ESP_FAIL;
+  }
+  ESP_LOGI(TAG, "Encoder on GPIO %d/%d using PCNT unit %d.", a_gpio_,
+           b_gpio_, unit_);
+  return ESP_OK;
+}
+
+int RotaryEncoder::ReadCounts() {
+  int16_t count;
+  if (pcnt_get_counter_value(unit_, &count) != ESP_OK)
+    return 0;
+  const int counts = count - last_count_;
+  last_count_ = count;
+  return counts;
+}
+
+// static
+int RotaryEncoder::Accelerate(int detents, int64_t elapsed_us) {
+  if (!detents || elapsed_us <= 0)
+    return detents;
+  const int64_t detents_per_sec =
+      std::abs(detents) * int64_t{1000 * 1000} / elapsed_us;
+  for (const AccelerationStep& step : kAccelerationSteps) {
+    if (detents_per_sec >= step.min_detents_per_sec)
+      return detents * step.multiplier;
+  }
+  return detents;
+}
+
+void RotaryEncoder::WaitForTurn() {
+  // The knob rests on a detent, so drop any partial detent (e.g. edges
+  // missed while the chip woke from light sleep).
+  ReadCounts();
+  residual_counts_ = 0;
+  ulTaskNotifyTake(pdTRUE, 0);
+  ESP_ERROR_CHECK_WITHOUT_ABORT(ArmWakeup());
+  active_lock_.reset();
+  ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+  active_lock_.reset(
+      new PowerManager::Lock(PowerManager::Lock::Type::NoLightSleep));
+  DisarmWakeup();
+}
+
+// static
+void RotaryEncoder::EncoderTask(void* arg) {
+  RotaryEncoder* encoder = static_cast<RotaryEncoder*>(arg);
+  int64_t last_poll_time = esp_timer_get_time();
+  // Start idle.
+  int64_t last_turn_time = last_poll_time - kIdleAfterUsecs;
+  while (true) {
+    const bool idle = last_poll_time - last_turn_time >= kIdleAfterUsecs;
+    if (idle)
+      encoder->WaitForTurn();
+    // Give the rest of the detent time to arrive.
+    vTaskDelay(pdMS_TO_TICKS(kActivePollMSecs));
+
+    const int64_t now = esp_timer_get_time();
+    last_poll_time = now;
+
+    encoder->residual_counts_ += encoder->ReadCounts();
+    const int detents = encoder->residual_counts_ / kCountsPerDetent;
+    if (!detents)
+      continue;
+    encoder->residual_counts_ -= detents * kCountsPerDetent;
+    // Speed is measured from the previous turn, not the poll period, so
+    // that a single slow click isn't mistaken for a fast spin.
+    const int64_t elapsed_us = now - last_turn_time;
+    last_turn_time = now;
+
+    const int steps = Accelerate(detents, elapsed_us);
+    ESP_LOGV(TAG, "%d detents in %lld ms -> %d steps", detents,
+             elapsed_us / 1000, steps);
+    encoder->callback_(steps);
+  }
+}
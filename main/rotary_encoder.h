@@ -0,0 +1,88 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+
+#include <driver/gpio.h>
+#include <driver/pcnt.h>
+#include <esp_attr.h>
+#include <esp_err.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#include "power_manager.h"
+
+/**
+ * A quadrature rotary encoder (the volume knob).
+ *
+ * Edges are counted in hardware by a PCNT unit (both channels, so all four
+ * edges of each quadrature cycle are counted), so no interrupt fires per
+ * edge. A low-rate task reads the count, converts it to detents, applies
+ * velocity-based acceleration and reports the change. CPU cost therefore
+ * depends on the polling rate, not on how fast the knob is spun.
+ *
+ * PCNT stops in light sleep, so a NoLightSleep lock is held while the knob
+ * is turning. Once it is idle the task stops polling, releases the lock and
+ * waits for either pin to leave its current level. That is a level
+ * interrupt and a light sleep wakeup, so a turn wakes the chip. Edges
+ * before the chip is awake aren't counted, so the first quarter detent or
+ * so of a turn from light sleep is lost.
+ */
+class RotaryEncoder {
+ public:
+  /**
+   * Receives the (accelerated) number of steps turned since the previous
+   * call. Positive is clockwise. Called on the encoder task.
+   */
+  using Callback = std::function<void(int steps)>;
+
+  RotaryEncoder(gpio_num_t a_gpio, gpio_num_t b_gpio, pcnt_unit_t unit);
+  ~RotaryEncoder();
+
+  /**
+   * Configure the PCNT unit and pin interrupts, and start the polling task.
+   *
+   * gpio_install_isr_service() must have already been called.
+   */
+  esp_err_t Initialize(Callback callback);
+
+ private:
+  static void EncoderTask(void* arg);
+  static void IRAM_ATTR PinISR(void* arg);
+
+  esp_err_t ConfigureCounter();
+
+  /**
+   * Interrupt, and wake from light sleep, when either pin changes level.
+   */
+  esp_err_t ArmWakeup();
+  void DisarmWakeup();
+
+  /**
+   * Return the number of counts since the last call.
+   */
+  int ReadCounts();
+
+  /**
+   * Block the calling (encoder) task until the knob is turned.
+   */
+  void WaitForTurn();
+
+  /**
+   * Scale |detents| by the knob's speed.
+   *
+   * @param detents    Detents turned since the previous turn.
+   * @param elapsed_us Time since the previous turn.
+   */
+  static int Accelerate(int detents, int64_t elapsed_us);
+
+  const gpio_num_t a_gpio_;
+  const gpio_num_t b_gpio_;
+  const pcnt_unit_t unit_;
+  Callback callback_;
+  TaskHandle_t task_;    // The polling task.
+  int16_t last_count_;   // Counter value at the last read.
+  int residual_counts_;  // Counts not yet making up a whole detent.
+  std::unique_ptr<PowerManager::Lock> active_lock_;  // Held while turning.
+};
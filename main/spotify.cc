@@ -5,87 +5,60 @@
 #include <memory>
 #include <string>
 
-#define LOG_LOCAL_LEVEL ESP_LOG_VERBOSE
+#define LOG_LOCAL_LEVEL ESP_LOG_INFO
 
 #include <cJSON/cJSON.h>
 #include <esp_err.h>
 #include <esp_log.h>
 #include <mbedtls/base64.h>
 
+#include "binary_log.h"
 #include "config.h"
-#include "event_ids.h"
+#include "event_bus.h"
 #include "http_client.h"
 #include "http_server.h"
+#include "request_scheduler.h"
+#include "url_encode.h"
 #include "wifi.h"
 
 using std::string;
 
 namespace {
 
-struct RequestData {
-  struct {
-    uint32_t progress_ms;
-    uint32_t duration_ms;
-  } times;
-  bool is_playing;
-  bool is_player_active;
-  string artist_name;
-  string song_title;
-  struct {
-    string url_640;
-    string url_300;
-    string url_64;
-  } image;
-};
-
 constexpr char TAG[] = "kbd_spotify";
 constexpr char kApiHost[] = "api.spotify.com";
-constexpr char kCurrentlyPlayingResource[] = "/v1/me/player/currently-playing";
+constexpr char kPlayerURL[] = "https://api.spotify.com/v1/me/player";
 constexpr char kRootURI[] = "/";
 constexpr char kCallbackURI[] = "/callback/";
+constexpr int kHttpStatusNoContent = 204;
+constexpr int kHttpStatusAccepted = 202;
+constexpr UBaseType_t kCommandQueueLength = 8;
+// Spotify access tokens are currently ~200 characters.
+constexpr size_t kMaxAccessTokenLen = 512;
+// How often the player state is polled when idle.
+constexpr uint32_t kPlayerPollPeriodMs = 5000;
+// Delay after the last command before reconciling with the player state.
+// Spotify takes a moment to reflect the change.
+constexpr uint32_t kPostCommandPollDelayMs = 500;
 
 string Base64Encode(const string& str) {
   size_t dest_buff_size(0);
 
-  // First get the necessary destination buffer size.
+  // First get the necessary destination buffer size (includes terminator).
   mbedtls_base64_encode(nullptr, 0, &dest_buff_size,
                         reinterpret_cast<const unsigned char*>(str.c_str()),
                         str.length());
 
-  std::unique_ptr<unsigned char> dst(new unsigned char[dest_buff_size]);
-  if (!dst)
-    return string();
-
+  // Encode directly into the result - no intermediate buffer.
+  string encoded(dest_buff_size, '\0');
   int res = mbedtls_base64_encode(
-      dst.get(), dest_buff_size, &dest_buff_size,
-      reinterpret_cast<const unsigned char*>(str.c_str()), str.length());
+      reinterpret_cast<unsigned char*>(&encoded[0]), encoded.size(),
+      &dest_buff_size, reinterpret_cast<const unsigned char*>(str.c_str()),
+      str.length());
   if (res)
     return string();
 
-  return string(reinterpret_cast<char*>(dst.get()), dest_buff_size);
-}
-
-string EntityEncode(const string& str) {
-  // TODO: Surely there is an ESP-IDF/FreeRTOS function to do this.
-  string encoded;
-  for (size_t i = 0; i < str.length(); i++) {
-    char c = str[i];
-    if (std::isalnum(c)) {
-      encoded += c;
-    } else {
-      char code1 = (c & 0xf) + '0';
-      if ((c & 0xf) > 9)
-        code1 = (c & 0xf) - 10 + 'A';
-      c = (c >> 4) & 0xf;
-      char code0 = c + '0';
-      if (c > 9)
-        code0 = c - 10 + 'A';
-      encoded += '%';
-      encoded += code0;
-      encoded += code1;
-    }
-    taskYIELD();
-  }
+  encoded.resize(dest_buff_size);
   return encoded;
 }
 
@@ -116,6 +89,10 @@ std::string GetJSONString(const cJSON* json, const char* key) {
   return str_value;
 }
 
+bool GetJSONBool(const cJSON* json, const char* key) {
+  return cJSON_IsTrue(cJSON_GetObjectItem(json, key));
+}
+
 int GetJSONNumber(const cJSON* json, const char* key) {
   cJSON* value = cJSON_GetObjectItem(json, key);
   if (!value)
@@ -131,12 +108,14 @@ int GetJSONNumber(const cJSON* json, const char* key) {
 std::string CreateAccessTokenAuthorizationContent(
     const std::string& code,
     const std::string& redirect_url) {
-  return "grant_type=authorization_code&code=" + code +
-         "&redirect_uri=" + EntityEncode(redirect_url);
+  return "grant_type=authorization_code&code=" +
+         url::Encode(code, url::Mode::Form) +
+         "&redirect_uri=" + url::Encode(redirect_url, url::Mode::Form);
 }
 
 std::string CreateAccessTokenRefreshContent(const std::string& code) {
-  return "grant_type=refresh_token&refresh_token=" + code;
+  return "grant_type=refresh_token&refresh_token=" +
+         url::Encode(code, url::Mode::Form);
 }
 
 }  // namespace
@@ -155,23 +134,36 @@ esp_err_t Spotify::CallbackHandler(httpd_req_t* request) {
 Spotify::Spotify(const Config* config,
                  HTTPServer* https_server,
                  WiFi* wifi,
-                 EventGroupHandle_t event_group)
+                 EventBus* event_bus,
+                 TimerWheel* timer_wheel)
     : config_(config),
       https_server_(https_server),
-      event_group_(event_group),
+      event_bus_(event_bus),
       wifi_(wifi),
       initialized_(false),
-      token_refresh_timer_(nullptr),
-      mutex_(xSemaphoreCreateMutex()) {
+      token_refresh_timer_(timer_wheel, TokenRefreshCb, this),
+      player_task_(nullptr),
+      command_queue_(nullptr),
+      api_client_(new HTTPClient()),
+      // The radio stays awake while requests are outstanding.
+      scheduler_(new RequestScheduler(
+          [wifi](uint32_t depth) { wifi->SetBusy(depth != 0); })),
+      api_auth_slot_(0),
+      api_headers_token_version_(0),
+      mutex_(xSemaphoreCreateMutex()),
+      pending_volume_(-1),
+      unconfirmed_commands_(0) {
   assert(config != nullptr);
   assert(https_server != nullptr);
   assert(wifi != nullptr);
-  assert(event_group != nullptr);
+  assert(event_bus != nullptr);
 }
 
 Spotify::~Spotify() {
-  if (token_refresh_timer_)
-    esp_timer_delete(token_refresh_timer_);
+  if (player_task_)
+    vTaskDelete(player_task_);
+  if (command_queue_)
+    vQueueDelete(command_queue_);
   ESP_ERROR_CHECK_WITHOUT_ABORT(
       https_server_->UnregisterURIHandler(kCallbackURI, HTTP_GET));
   ESP_ERROR_CHECK_WITHOUT_ABORT(
@@ -181,8 +173,8 @@ Spotify::~Spotify() {
 // static:
 void Spotify::TokenRefreshCb(void* arg) {
   ESP_LOGD(TAG, "Timer fired to refresh access token");
-  xEventGroupSetBits(static_cast<Spotify*>(arg)->event_group_,
-                     EVENT_SPOTIFY_ACCESS_TOKEN_EXPIRE);
+  static_cast<Spotify*>(arg)->event_bus_->Post(
+      {.type = EventType::SpotifyAccessTokenExpire});
 }
 
 esp_err_t Spotify::Initialize() {
@@ -208,16 +200,27 @@ esp_err_t Spotify::Initialize() {
   if (err != ESP_OK)
     return err;
 
-  const esp_timer_create_args_t timer_args = {
-    .callback = TokenRefreshCb,
-    .arg = this,
-    .dispatch_method = ESP_TIMER_TASK,
-    .name = "AccessTokenRefresh",
-#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(4, 3, 0)
-    .skip_unhandled_events = true,
-#endif
-  };
-  err = esp_timer_create(&timer_args, &token_refresh_timer_);
+  command_queue_ = xQueueCreate(kCommandQueueLength, sizeof(Command));
+  if (!command_queue_)
+    return ESP_ERR_NO_MEM;
+
+  // Build the headers for recurring requests once. Only the access token
+  // changes, and is updated in place.
+  const string basic_auth =
+      "Basic " + Base64Encode(config_->spotify.client_id + ":" +
+                              config_->spotify.client_secret);
+  err = token_headers_.Add("Authorization", basic_auth.c_str());
+  if (err != ESP_OK)
+    return err;
+  err = token_headers_.Add("Content-Type",
+                           "application/x-www-form-urlencoded");
+  if (err != ESP_OK)
+    return err;
+  err = token_headers_.Add("Connection", "close");
+  if (err != ESP_OK)
+    return err;
+  err = api_headers_.AddSlot("Authorization", "Bearer ", kMaxAccessTokenLen,
+                             &api_auth_slot_);
   if (err != ESP_OK)
     return err;
 
@@ -249,7 +252,7 @@ esp_err_t Spotify::HandleRootRequest(httpd_req_t* request) {
     return err;
   const string location = "https://accounts.spotify.com/authorize/?client_id=" +
                           config_->spotify.client_id + "&response_type=code" +
-                          "&redirect_uri=" + EntityEncode(redirect_url) +
+                          "&redirect_uri=" + url::Encode(redirect_url) +
                           "&scope=" + kScopes;
 
   err = httpd_resp_set_hdr(request, "Location", location.c_str());
@@ -274,7 +277,7 @@ esp_err_t Spotify::HandleCallbackRequest(httpd_req_t* request) {
   // Now that we have the authorization code, notify the application so that
   // it can update any UI (if desired) and continue the process of connecting
   // to Spotify.
-  xEventGroupSetBits(event_group_, EVENT_SPOTIFY_GOT_AUTHORIZATION_CODE);
+  event_bus_->Post({.type = EventType::SpotifyGotAuthorizationCode});
 
   constexpr char kCallbackSuccess[] =
       "<html><head></head><body>Succesfully authentiated this device with "
@@ -292,50 +295,324 @@ esp_err_t Spotify::GetRedirectURL(string* url) const {
   return ESP_OK;
 }
 
-esp_err_t Spotify::GetCurrentlyPlaying() {
-  constexpr char kCurrentlyPlayingURL[] =
-      "https://api.spotify.com/v1/me/player/currently-playing";
-
+esp_err_t Spotify::UpdateAPIHeaders() {
+  esp_err_t err = ESP_OK;
   bool give_mutex = xSemaphoreTake(mutex_, portMAX_DELAY) == pdTRUE;
-  const std::vector<HTTPClient::HeaderValue> header_values = {
-      {"Authorization", "Bearer " + auth_data_.access_token},
-      {"Connection", "close"},
-  };
+  if (api_headers_token_version_ != auth_data_.access_token_version) {
+    err = api_headers_.SetSlot(api_auth_slot_, auth_data_.access_token.data(),
+                               auth_data_.access_token.length());
+    if (err == ESP_OK)
+      api_headers_token_version_ = auth_data_.access_token_version;
+  }
   if (give_mutex)
     xSemaphoreGive(mutex_);
+  if (err != ESP_OK)
+    ESP_LOGE(TAG, "Can't set access token: %s", esp_err_to_name(err));
+  return err;
+}
 
+esp_err_t Spotify::GetCurrentlyPlaying() {
+  esp_err_t err = UpdateAPIHeaders();
+  if (err != ESP_OK)
+    return err;
   std::string response;
-  HTTPClient https_client;
   int status_code(0);
-  esp_err_t err = https_client.DoGET(
-      kCurrentlyPlayingURL, header_values,
-      [&response](const void* data, int data_len) {
-        response.append(static_cast<const char*>(data), data_len);
-        return ESP_OK;
+  err = scheduler_->Perform(
+      RequestScheduler::Endpoint::Player, RequestScheduler::Retry::Any,
+      api_client_.get(),
+      [&](int* status) {
+        response.clear();  // Discard any failed attempt's response.
+        return api_client_->DoGET(
+            kPlayerURL, api_headers_,
+            [&response](const void* data, int data_len) {
+              response.append(static_cast<const char*>(data), data_len);
+              return ESP_OK;
+            },
+            status);
       },
       &status_code);
 
   if (err != ESP_OK)
     return ESP_FAIL;
 
-  if (status_code != HttpStatus_Ok) {
+  PlayerState state;
+  if (status_code == kHttpStatusNoContent) {
+    // Nothing is playing. |state| is already correct.
+  } else if (status_code != HttpStatus_Ok) {
     ESP_LOGE(TAG, "Request error: %d", status_code);
     return ESP_FAIL;
+  } else {
+    if (response.empty()) {
+      ESP_LOGE(TAG, "Got empty response.");
+      return ESP_FAIL;
+    }
+    cJSON* json = cJSON_Parse(response.c_str());
+    if (!json) {
+      ESP_LOGE(TAG, "Failure parsing JSON response.");
+      return ESP_FAIL;
+    }
+    state.is_active = true;
+    state.is_playing = GetJSONBool(json, "is_playing");
+    state.progress_ms = GetJSONNumber(json, "progress_ms");
+    const cJSON* device = cJSON_GetObjectItem(json, "device");
+    if (cJSON_IsNumber(cJSON_GetObjectItem(device, "volume_percent")))
+      state.volume_percent = GetJSONNumber(device, "volume_percent");
+    const cJSON* item = cJSON_GetObjectItem(json, "item");
+    if (item) {
+      state.song_title = GetJSONString(item, "name");
+      state.duration_ms = GetJSONNumber(item, "duration_ms");
+      const cJSON* artists = cJSON_GetObjectItem(item, "artists");
+      if (cJSON_GetArraySize(artists) > 0) {
+        state.artist_name =
+            GetJSONString(cJSON_GetArrayItem(artists, 0), "name");
+      }
+    }
+    cJSON_Delete(json);
   }
 
-  if (response.empty()) {
-    ESP_LOGE(TAG, "Got empty response.");
-    return ESP_FAIL;
+  bool changed = false;
+  bool give_mutex = xSemaphoreTake(mutex_, portMAX_DELAY) == pdTRUE;
+  // Don't clobber the optimistic state with one that predates a command
+  // that hasn't yet been confirmed.
+  if (!unconfirmed_commands_) {
+    changed = state.is_active != player_state_.is_active ||
+              state.is_playing != player_state_.is_playing ||
+              state.volume_percent != player_state_.volume_percent ||
+              state.song_title != player_state_.song_title ||
+              state.artist_name != player_state_.artist_name;
+    player_state_ = std::move(state);
   }
-  cJSON* json = cJSON_Parse(response.c_str());
-  if (!json) {
-    ESP_LOGE(TAG, "Failure parsing JSON response.");
-    return ESP_FAIL;
+  if (give_mutex)
+    xSemaphoreGive(mutex_);
+  if (changed)
+    NotifyPlayerStateChanged();
+
+  BLOGD(TAG, "Got player state response.");
+  return ESP_OK;
+}
+
+esp_err_t Spotify::StartPlayerTask() {
+  if (!initialized_)
+    return ESP_ERR_INVALID_STATE;
+  if (player_task_)
+    return ESP_OK;
+
+  // https://www.freertos.org/FAQMem.html#StackSize
+  // TLS handshakes need a lot of stack.
+  constexpr uint32_t kStackDepthWords = 8192;
+  return xTaskCreate(PlayerTask, "spotify-player", kStackDepthWords, this,
+                     tskIDLE_PRIORITY + 1, &player_task_) == pdPASS
+             ? ESP_OK
+             : ESP_FAIL;
+}
+
+// static
+void Spotify::PlayerTask(void* arg) {
+  Spotify* spotify = static_cast<Spotify*>(arg);
+  TickType_t wait_ticks = 0;  // Poll right away.
+  while (true) {
+    Command command;
+    if (xQueueReceive(spotify->command_queue_, &command, wait_ticks) ==
+        pdTRUE) {
+      ESP_ERROR_CHECK_WITHOUT_ABORT(spotify->SendCommand(command));
+      wait_ticks = uxQueueMessagesWaiting(spotify->command_queue_)
+                       ? 0
+                       : pdMS_TO_TICKS(kPostCommandPollDelayMs);
+      continue;
+    }
+    spotify->GetCurrentlyPlaying();
+    wait_ticks = pdMS_TO_TICKS(kPlayerPollPeriodMs);
   }
+}
 
-  cJSON_Delete(json);
+void Spotify::NotifyPlayerStateChanged() {
+  event_bus_->Post({.type = EventType::SpotifyPlayerStateChanged});
+}
+
+PlayerState Spotify::GetPlayerState() const {
+  bool give_mutex = xSemaphoreTake(mutex_, portMAX_DELAY) == pdTRUE;
+  PlayerState state = player_state_;
+  if (give_mutex)
+    xSemaphoreGive(mutex_);
+  return state;
+}
+
+esp_err_t Spotify::QueueCommand(CommandType type, uint32_t value) {
+  esp_err_t err = ESP_OK;
+  if (!command_queue_) {
+    err = ESP_ERR_INVALID_STATE;
+  } else {
+    const Command command = {.type = type, .value = value};
+    // Don't wait - the caller is likely handling user input.
+    if (xQueueSend(command_queue_, &command, 0) != pdTRUE) {
+      ESP_LOGW(TAG, "Command queue full.");
+      err = ESP_ERR_NO_MEM;
+    }
+  }
+  if (err == ESP_OK)
+    return ESP_OK;
+
+  // The command will never be confirmed, so let the next poll reconcile the
+  // optimistic state with Spotify's.
+  bool give_mutex = xSemaphoreTake(mutex_, portMAX_DELAY) == pdTRUE;
+  if (unconfirmed_commands_)
+    unconfirmed_commands_--;
+  if (type == CommandType::Volume)
+    pending_volume_ = -1;
+  if (give_mutex)
+    xSemaphoreGive(mutex_);
+  return err;
+}
+
+esp_err_t Spotify::Play() {
+  bool give_mutex = xSemaphoreTake(mutex_, portMAX_DELAY) == pdTRUE;
+  player_state_.is_playing = true;
+  unconfirmed_commands_++;
+  if (give_mutex)
+    xSemaphoreGive(mutex_);
+  NotifyPlayerStateChanged();
+  return QueueCommand(CommandType::Play, 0);
+}
+
+esp_err_t Spotify::Pause() {
+  bool give_mutex = xSemaphoreTake(mutex_, portMAX_DELAY) == pdTRUE;
+  player_state_.is_playing = false;
+  unconfirmed_commands_++;
+  if (give_mutex)
+    xSemaphoreGive(mutex_);
+  NotifyPlayerStateChanged();
+  return QueueCommand(CommandType::Pause, 0);
+}
+
+esp_err_t Spotify::Next() {
+  bool give_mutex = xSemaphoreTake(mutex_, portMAX_DELAY) == pdTRUE;
+  player_state_.progress_ms = 0;
+  unconfirmed_commands_++;
+  if (give_mutex)
+    xSemaphoreGive(mutex_);
+  NotifyPlayerStateChanged();
+  return QueueCommand(CommandType::Next, 0);
+}
+
+esp_err_t Spotify::Previous() {
+  bool give_mutex = xSemaphoreTake(mutex_, portMAX_DELAY) == pdTRUE;
+  player_state_.progress_ms = 0;
+  unconfirmed_commands_++;
+  if (give_mutex)
+    xSemaphoreGive(mutex_);
+  NotifyPlayerStateChanged();
+  return QueueCommand(CommandType::Previous, 0);
+}
+
+esp_err_t Spotify::Seek(uint32_t position_ms) {
+  bool give_mutex = xSemaphoreTake(mutex_, portMAX_DELAY) == pdTRUE;
+  player_state_.progress_ms = position_ms;
+  unconfirmed_commands_++;
+  if (give_mutex)
+    xSemaphoreGive(mutex_);
+  NotifyPlayerStateChanged();
+  return QueueCommand(CommandType::Seek, position_ms);
+}
+
+esp_err_t Spotify::SetVolume(int volume_percent) {
+  if (volume_percent < 0)
+    volume_percent = 0;
+  else if (volume_percent > 100)
+    volume_percent = 100;
+
+  bool give_mutex = xSemaphoreTake(mutex_, portMAX_DELAY) == pdTRUE;
+  player_state_.volume_percent = volume_percent;
+  // Only one volume command is ever queued. It sends whatever the most
+  // recent volume is when it is processed.
+  const bool already_queued = pending_volume_ != -1;
+  pending_volume_ = volume_percent;
+  if (!already_queued)
+    unconfirmed_commands_++;
+  if (give_mutex)
+    xSemaphoreGive(mutex_);
+  NotifyPlayerStateChanged();
+  if (already_queued)
+    return ESP_OK;
+  return QueueCommand(CommandType::Volume, 0);
+}
+
+esp_err_t Spotify::SendCommand(const Command& command) {
+  constexpr char kPlayURL[] = "https://api.spotify.com/v1/me/player/play";
+  constexpr char kPauseURL[] = "https://api.spotify.com/v1/me/player/pause";
+  constexpr char kNextURL[] = "https://api.spotify.com/v1/me/player/next";
+  constexpr char kPreviousURL[] =
+      "https://api.spotify.com/v1/me/player/previous";
+  constexpr char kSeekURL[] =
+      "https://api.spotify.com/v1/me/player/seek?position_ms=";
+  constexpr char kVolumeURL[] =
+      "https://api.spotify.com/v1/me/player/volume?volume_percent=";
+
+  const string kEmptyContent;
+  const HTTPClient::DataCallback ignore_data = [](const void*, int) {
+    return ESP_OK;
+  };
+  esp_http_client_method_t method = HTTP_METHOD_PUT;
+  string url;
+  switch (command.type) {
+    case CommandType::Play:
+      url = kPlayURL;
+      break;
+    case CommandType::Pause:
+      url = kPauseURL;
+      break;
+    case CommandType::Next:
+      method = HTTP_METHOD_POST;
+      url = kNextURL;
+      break;
+    case CommandType::Previous:
+      method = HTTP_METHOD_POST;
+      url = kPreviousURL;
+      break;
+    case CommandType::Seek:
+      url = kSeekURL + std::to_string(command.value);
+      break;
+    case CommandType::Volume: {
+      bool give_mutex = xSemaphoreTake(mutex_, portMAX_DELAY) == pdTRUE;
+      const int volume_percent = pending_volume_;
+      pending_volume_ = -1;
+      if (give_mutex)
+        xSemaphoreGive(mutex_);
+      url = kVolumeURL + std::to_string(volume_percent);
+    } break;
+  }
 
-  ESP_LOGI(TAG, "Got currently-playing response.");
+  int status_code(0);
+  esp_err_t err = UpdateAPIHeaders();
+  if (err == ESP_OK) {
+    // Next/previous skip a track each time they are acted on.
+    const RequestScheduler::Retry retry = method == HTTP_METHOD_POST
+                                              ? RequestScheduler::Retry::NotSent
+                                              : RequestScheduler::Retry::Any;
+    err = scheduler_->Perform(
+        RequestScheduler::Endpoint::PlayerCommand, retry, api_client_.get(),
+        [&](int* status) {
+          return method == HTTP_METHOD_POST
+                     ? api_client_->DoPOST(url, kEmptyContent, api_headers_,
+                                           ignore_data, status)
+                     : api_client_->DoPUT(url, kEmptyContent, api_headers_,
+                                          ignore_data, status);
+        },
+        &status_code);
+  }
+
+  bool give_mutex = xSemaphoreTake(mutex_, portMAX_DELAY) == pdTRUE;
+  unconfirmed_commands_--;
+  if (give_mutex)
+    xSemaphoreGive(mutex_);
+
+  if (err != ESP_OK)
+    return err;
+  if (status_code != kHttpStatusNoContent && status_code != HttpStatus_Ok &&
+      status_code != kHttpStatusAccepted) {
+    ESP_LOGE(TAG, "Command %u failed: %d", static_cast<unsigned>(command.type),
+             status_code);
+    return ESP_FAIL;
+  }
   return ESP_OK;
 }
 
@@ -367,13 +644,6 @@ esp_err_t Spotify::GetAccessToken(TokenGrantType grant_type, string code) {
   bool give_mutex = false;
   uint32_t expires_in_secs = 0;
   const string kGetAccessTokenURL("https://accounts.spotify.com/api/token");
-  const std::vector<HTTPClient::HeaderValue> header_values = {
-      {"Authorization",
-       "Basic " + Base64Encode(config_->spotify.client_id + ":" +
-                               config_->spotify.client_secret)},
-      {"Content-Type", "application/x-www-form-urlencoded"},
-      {"Connection", "close"},
-  };
   string content;
   std::string access_token;
   std::string refresh_token;
@@ -389,17 +659,29 @@ esp_err_t Spotify::GetAccessToken(TokenGrantType grant_type, string code) {
                 ? CreateAccessTokenAuthorizationContent(code, redirect_url)
                 : CreateAccessTokenRefreshContent(code);
 
-  err = http_client.DoPOST(
-      kGetAccessTokenURL, content, header_values,
-      [&response](const void* data, int data_len) {
-        response.append(static_cast<const char*>(data), data_len);
-        return ESP_OK;
+  // An authorization code can only be exchanged once, whereas refreshing
+  // again just issues another access token.
+  err = scheduler_->Perform(
+      RequestScheduler::Endpoint::Token,
+      grant_type == TokenGrantType::Refresh ? RequestScheduler::Retry::Any
+                                            : RequestScheduler::Retry::NotSent,
+      &http_client,
+      [&](int* status) {
+        response.clear();  // Discard any failed attempt's response.
+        return http_client.DoPOST(
+            kGetAccessTokenURL, content, token_headers_,
+            [&response](const void* data, int data_len) {
+              response.append(static_cast<const char*>(data), data_len);
+              return ESP_OK;
+            },
+            status);
       },
       &status_code);
   if (err != ESP_OK)
     goto exit;
   if (status_code != HttpStatus_Ok) {
     ESP_LOGE(TAG, "Invalid status: %d", status_code);
+    err = ESP_FAIL;
     goto exit;
   }
   if (response.empty()) {
@@ -420,8 +702,10 @@ esp_err_t Spotify::GetAccessToken(TokenGrantType grant_type, string code) {
   scope = GetJSONString(json, "scope");
 
   give_mutex = xSemaphoreTake(mutex_, portMAX_DELAY) == pdTRUE;
-  if (!access_token.empty())
+  if (!access_token.empty()) {
     auth_data_.access_token = std::move(access_token);
+    auth_data_.access_token_version++;
+  }
   if (!token_type.empty())
     auth_data_.token_type = std::move(token_type);
   if (!refresh_token.empty())
@@ -440,13 +724,21 @@ esp_err_t Spotify::GetAccessToken(TokenGrantType grant_type, string code) {
   ESP_LOGI(TAG, "%s access code. Refreshing in %d secs.",
            grant_type == TokenGrantType::Refresh ? "Refreshed" : "Got",
            expires_in_secs);
-  esp_timer_start_once(token_refresh_timer_,
-                       static_cast<uint64_t>(expires_in_secs) * 1000 * 1000);
+  token_refresh_timer_.StartOnce(expires_in_secs * 1000);
 
 exit:
-  xEventGroupSetBits(event_group_, err == ESP_OK
-                                       ? EVENT_SPOTIFY_ACCESS_TOKEN_GOOD
-                                       : EVENT_SPOTIFY_ACCESS_TOKEN_FAILURE);
+  if (err == ESP_OK) {
+    event_bus_->Post({
+        .type = EventType::SpotifyAccessTokenGood,
+        .access_token_good = {.expires_in_secs =
+                                  static_cast<int32_t>(expires_in_secs)},
+    });
+  } else {
+    event_bus_->Post({
+        .type = EventType::SpotifyAccessTokenFailure,
+        .access_token_failure = {.err = err},
+    });
+  }
   return err;
 }
 
@@ -1,16 +1,24 @@
 #pragma once
 
 #include <cstdint>
+#include <memory>
 #include <string>
 
 #include <esp_http_server.h>
-#include <esp_timer.h>
-#include <event_groups.h>
 #include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
 #include <freertos/semphr.h>
+#include <freertos/task.h>
+
+#include "header_set.h"
+#include "player_state.h"
+#include "timer_wheel.h"
 
 class Config;
+class EventBus;
+class HTTPClient;
 class HTTPServer;
+class RequestScheduler;
 class WiFi;
 
 class Spotify {
@@ -18,7 +26,8 @@ class Spotify {
   Spotify(const Config* config,
           HTTPServer* https_server,
           WiFi* wifi,
-          EventGroupHandle_t event_group);
+          EventBus* event_bus,
+          TimerWheel* timer_wheel);
   ~Spotify();
 
   /**
@@ -36,9 +45,38 @@ class Spotify {
   esp_err_t ContinueLogin();
 
   /**
-   * Retrieve the Spotify currently playing track information.
+   * Start the task which sends playback commands to Spotify and
+   * periodically polls the player state.
+   *
+   * Call once the access token has been retrieved.
    */
-  esp_err_t GetCurrentlyPlaying();
+  esp_err_t StartPlayerTask();
+
+  /**
+   * Playback commands.
+   *
+   * These update the player state immediately, notify the application via
+   * EventType::SpotifyPlayerStateChanged, and queue the request to Spotify,
+   * which is sent on the player task. The optimistic state is reconciled
+   * with Spotify's on the next poll after the request completes.
+   *
+   * Repeated volume changes are coalesced so that only the most recent
+   * value is sent.
+   *
+   * @note Can be called on any task.
+   */
+  esp_err_t Play();
+  esp_err_t Pause();
+  esp_err_t Next();
+  esp_err_t Previous();
+  esp_err_t Seek(uint32_t position_ms);
+  esp_err_t SetVolume(int volume_percent);
+
+  // The current (possibly optimistic) player state.
+  PlayerState GetPlayerState() const;
+
+  // Paces and retries all requests to Spotify.
+  const RequestScheduler& request_scheduler() const { return *scheduler_; }
 
   // Was this instance *successfully* initialized?
   bool initialized() const { return initialized_; }
@@ -64,6 +102,23 @@ class Spotify {
     AuthorizationCode,
   };
 
+  enum class CommandType : uint8_t {
+    Play,
+    Pause,
+    Next,
+    Previous,
+    Seek,
+    Volume,
+  };
+
+  /**
+   * A playback command queued for the player task.
+   */
+  struct Command {
+    CommandType type;
+    uint32_t value;  // Seek position. Volume is read from pending_volume_.
+  };
+
   /**
    * Contains authentication values for the current Spotify user.
    */
@@ -73,11 +128,15 @@ class Spotify {
     std::string refresh_token;  // The refresh token used to get access_token.
     std::string scope;          // Privilege scope.
     std::string auth_code;      // Code used when fully authenticating.
+
+    // Incremented each time |access_token| changes.
+    uint32_t access_token_version = 0;
   };
 
   static esp_err_t RootHandler(httpd_req_t* request);
   static esp_err_t CallbackHandler(httpd_req_t* request);
   static void TokenRefreshCb(void* arg);
+  static void PlayerTask(void* arg);
 
   /**
    * HTTPD request handler for "/".
@@ -105,6 +164,38 @@ class Spotify {
    */
   esp_err_t GetAccessToken(TokenGrantType grant_type, std::string code);
 
+  /**
+   * Retrieve the Spotify player state and reconcile it with player_state_.
+   *
+   * @note Called on the player task.
+   */
+  esp_err_t GetCurrentlyPlaying();
+
+  /**
+   * Queue a playback command for the player task.
+   *
+   * The caller must already have counted the command in
+   * |unconfirmed_commands_| (and for a volume command set |pending_volume_|),
+   * which is undone if the command can't be queued.
+   */
+  esp_err_t QueueCommand(CommandType type, uint32_t value);
+
+  /**
+   * Send a playback command to Spotify.
+   *
+   * @note Called on the player task.
+   */
+  esp_err_t SendCommand(const Command& command);
+
+  /**
+   * Copy the current access token into api_headers_ if it has changed.
+   *
+   * @note Called on the player task.
+   */
+  esp_err_t UpdateAPIHeaders();
+
+  void NotifyPlayerStateChanged();
+
   /**
    * Create the URL to have Spotify redirect to after user successfully
    * authenticates and approves access to this client.
@@ -125,10 +216,21 @@ class Spotify {
 
   const Config* config_;            // Application config data.
   HTTPServer* https_server_;        // Accept inbound requests for auth.
-  EventGroupHandle_t event_group_;  // Used to inform owner of events.
+  EventBus* event_bus_;             // Used to inform owner of events.
   WiFi* wifi_;                      // Object used to controll Wi-Fi network.
   bool initialized_;                // Is this instance initialized?
-  esp_timer_handle_t token_refresh_timer_;  // Used to refresh access token.
+  TimerWheel::Timer token_refresh_timer_;  // Used to refresh access token.
+  TaskHandle_t player_task_;       // Sends commands & polls player state.
+  QueueHandle_t command_queue_;    // Commands waiting for the player task.
+  std::unique_ptr<HTTPClient> api_client_;  // Kept connected to kApiHost.
+  std::unique_ptr<RequestScheduler> scheduler_;  // All requests go via this.
+  HeaderSet token_headers_;  // Access token request headers.
+  HeaderSet api_headers_;    // Web API headers. Used by the player task.
+  size_t api_auth_slot_;     // api_headers_ slot of the access token.
+  uint32_t api_headers_token_version_;  // Token version in api_headers_.
   SemaphoreHandle_t mutex_;  // Synchronize access to following members.
   AuthData auth_data_;       // Current user auth data.
+  PlayerState player_state_;  // Current (possibly optimistic) player state.
+  int pending_volume_;        // Volume waiting to be sent, -1 if none.
+  int unconfirmed_commands_;  // # commands queued or in flight.
 };
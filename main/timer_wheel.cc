@@ -0,0 +1,260 @@
+#include "timer_wheel.h"
+
+#include <algorithm>
+
+#include <esp_log.h>
+
+namespace {
+
+constexpr char TAG[] = "kbd_timer";
+
+TickType_t MSecsToTicks(uint32_t msecs) {
+  // Round up so that a timer never fires early.
+  return (msecs + portTICK_PERIOD_MS - 1) / portTICK_PERIOD_MS;
+}
+
+// Is tick |a| at or after tick |b|?
+bool AtOrAfter(TickType_t a, TickType_t b) {
+  return static_cast<int32_t>(a - b) >= 0;
+}
+
+}  // namespace
+
+TimerWheel::Timer::Timer(TimerWheel* wheel, Callback callback, void* arg)
+    : wheel_(wheel),
+      callback_(callback),
+      arg_(arg),
+      prev_(nullptr),
+      next_(nullptr),
+      batch_next_(nullptr),
+      expiry_(0),
+      period_(0),
+      armed_(false),
+      expired_(false) {}
+
+TimerWheel::Timer::~Timer() {
+  Stop();
+}
+
+void TimerWheel::Timer::StartOnce(uint32_t delay_ms) {
+  wheel_->Arm(this, delay_ms, /*period_ms=*/0);
+}
+
+void TimerWheel::Timer::StartPeriodic(uint32_t period_ms) {
+  wheel_->Arm(this, period_ms, period_ms);
+}
+
+void TimerWheel::Timer::Stop() {
+  wheel_->Disarm(this);
+}
+
+TimerWheel::TimerWheel()
+    : mutex_(xSemaphoreCreateMutex()),
+      batch_(nullptr),
+      last_tick_(xTaskGetTickCount()),
+      sleep_until_(0),
+      sleeping_forever_(true),
+      stats_({}),
+      task_(nullptr) {
+  std::fill(std::begin(slots_), std::end(slots_), nullptr);
+}
+
+TimerWheel::~TimerWheel() {
+  if (task_)
+    vTaskDelete(task_);
+  vSemaphoreDelete(mutex_);
+}
+
+esp_err_t TimerWheel::Start() {
+  // https://www.freertos.org/FAQMem.html#StackSize
+  constexpr uint32_t kStackDepthWords = 2048;
+  return xTaskCreate(TimerTask, "timer-wheel", kStackDepthWords, this,
+                     tskIDLE_PRIORITY + 4, &task_) == pdPASS
+             ? ESP_OK
+             : ESP_FAIL;
+}
+
+void TimerWheel::Link(Timer* timer) {
+  Timer*& head = slots_[timer->expiry_ & (kNumSlots - 1)];
+  timer->prev_ = nullptr;
+  timer->next_ = head;
+  if (head)
+    head->prev_ = timer;
+  head = timer;
+  timer->armed_ = true;
+  stats_.armed++;
+}
+
+void TimerWheel::Unlink(Timer* timer) {
+  if (timer->prev_)
+    timer->prev_->next_ = timer->next_;
+  else
+    slots_[timer->expiry_ & (kNumSlots - 1)] = timer->next_;
+  if (timer->next_)
+    timer->next_->prev_ = timer->prev_;
+  timer->prev_ = timer->next_ = nullptr;
+  timer->armed_ = false;
+  stats_.armed--;
+}
+
+void TimerWheel::RemoveFromBatch(Timer* timer) {
+  // Batches are a few timers, so a linear search is fine.
+  for (Timer** link = &batch_; *link; link = &(*link)->batch_next_) {
+    if (*link == timer) {
+      *link = timer->batch_next_;
+      break;
+    }
+  }
+  timer->batch_next_ = nullptr;
+  timer->expired_ = false;
+}
+
+void TimerWheel::Arm(Timer* timer, uint32_t delay_ms, uint32_t period_ms) {
+  const TickType_t delay = std::max<TickType_t>(1, MSecsToTicks(delay_ms));
+  const TickType_t period =
+      period_ms ? std::max<TickType_t>(1, MSecsToTicks(period_ms)) : 0;
+
+  bool give_mutex = xSemaphoreTake(mutex_, portMAX_DELAY) == pdTRUE;
+  if (timer->armed_)
+    Unlink(timer);
+  // A restart replaces an expiry whose callback hasn't run yet.
+  if (timer->expired_)
+    RemoveFromBatch(timer);
+  timer->expiry_ = xTaskGetTickCount() + delay;
+  timer->period_ = period;
+  Link(timer);
+  // Only wake the timer task if it would otherwise sleep past this timer.
+  const bool wake =
+      sleeping_forever_ || !AtOrAfter(timer->expiry_, sleep_until_);
+  if (wake) {
+    sleeping_forever_ = false;
+    sleep_until_ = timer->expiry_;
+  }
+  if (give_mutex)
+    xSemaphoreGive(mutex_);
+  if (wake && task_)
+    xTaskNotifyGive(task_);
+}
+
+void TimerWheel::Disarm(Timer* timer) {
+  bool give_mutex = xSemaphoreTake(mutex_, portMAX_DELAY) == pdTRUE;
+  if (timer->armed_)
+    Unlink(timer);
+  if (timer->expired_)
+    RemoveFromBatch(timer);
+  if (give_mutex)
+    xSemaphoreGive(mutex_);
+}
+
+uint32_t TimerWheel::CollectExpired(TickType_t now) {
+  uint32_t num_expired = 0;
+  // Only the slots of the ticks since the last pass can hold due timers.
+  const TickType_t elapsed = now - last_tick_;
+  const int num_slots =
+      elapsed >= kNumSlots ? kNumSlots : static_cast<int>(elapsed);
+  for (int i = 1; i <= num_slots; i++) {
+    Timer* timer = slots_[(last_tick_ + i) & (kNumSlots - 1)];
+    while (timer) {
+      Timer* next = timer->next_;
+      // Timers a whole number of revolutions later share the slot.
+      if (AtOrAfter(now, timer->expiry_)) {
+        Unlink(timer);
+        if (!timer->expired_) {
+          timer->expired_ = true;
+          timer->batch_next_ = batch_;
+          batch_ = timer;
+          num_expired++;
+        }
+        if (timer->period_) {
+          timer->expiry_ += timer->period_;
+          // Skip periods missed while the task was busy.
+          if (AtOrAfter(now, timer->expiry_))
+            timer->expiry_ = now + timer->period_;
+          Link(timer);
+        }
+      }
+      timer = next;
+    }
+  }
+  last_tick_ = now;
+  return num_expired;
+}
+
+TickType_t TimerWheel::TicksUntilNextDeadline(TickType_t now) const {
+  bool armed = false;
+  TickType_t next = 0;
+  for (const Timer* head : slots_) {
+    for (const Timer* timer = head; timer; timer = timer->next_) {
+      const TickType_t until =
+          AtOrAfter(now, timer->expiry_) ? 0 : timer->expiry_ - now;
+      if (!armed || until < next)
+        next = until;
+      armed = true;
+    }
+  }
+  return armed ? next : portMAX_DELAY;
+}
+
+void TimerWheel::RunExpired() {
+  while (true) {
+    bool give_mutex = xSemaphoreTake(mutex_, portMAX_DELAY) == pdTRUE;
+    Timer* timer = batch_;
+    Callback callback = nullptr;
+    void* arg = nullptr;
+    if (timer) {
+      batch_ = timer->batch_next_;
+      timer->batch_next_ = nullptr;
+      timer->expired_ = false;
+      callback = timer->callback_;
+      arg = timer->arg_;
+    }
+    if (give_mutex)
+      xSemaphoreGive(mutex_);
+    if (!timer)
+      return;
+    callback(arg);
+  }
+}
+
+// static
+void TimerWheel::TimerTask(void* arg) {
+  TimerWheel* wheel = static_cast<TimerWheel*>(arg);
+  while (true) {
+    bool give_mutex = xSemaphoreTake(wheel->mutex_, portMAX_DELAY) == pdTRUE;
+    const TickType_t now = xTaskGetTickCount();
+    const uint32_t num_expired = wheel->CollectExpired(now);
+    const TickType_t wait = wheel->TicksUntilNextDeadline(now);
+    wheel->sleeping_forever_ = wait == portMAX_DELAY;
+    wheel->sleep_until_ = now + wait;
+    wheel->stats_.expirations += num_expired;
+    if (num_expired > 1)
+      wheel->stats_.batched += num_expired - 1;
+    if (give_mutex)
+      xSemaphoreGive(wheel->mutex_);
+
+    wheel->RunExpired();
+
+    // Timers started by the callbacks notify this task if they are due
+    // before |wait| ends, so the wait returns right away.
+    ulTaskNotifyTake(pdTRUE, wait);
+
+    give_mutex = xSemaphoreTake(wheel->mutex_, portMAX_DELAY) == pdTRUE;
+    wheel->stats_.wakeups++;
+    if (give_mutex)
+      xSemaphoreGive(wheel->mutex_);
+  }
+}
+
+TimerWheel::Stats TimerWheel::GetStats() const {
+  bool give_mutex = xSemaphoreTake(mutex_, portMAX_DELAY) == pdTRUE;
+  const Stats stats = stats_;
+  if (give_mutex)
+    xSemaphoreGive(mutex_);
+  return stats;
+}
+
+void TimerWheel::LogStats() const {
+  const Stats stats = GetStats();
+  ESP_LOGI(TAG, "wakeups=%u expirations=%u batched=%u armed=%u",
+           stats.wakeups, stats.expirations, stats.batched, stats.armed);
+}
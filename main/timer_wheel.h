@@ -0,0 +1,128 @@
+#pragma once
+
+#include <cstdint>
+
+#include <esp_err.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+
+/**
+ * The application's software timers, run from a single task.
+ *
+ * Timers are kept in a hashed timing wheel with one slot per FreeRTOS tick,
+ * so starting and stopping a timer is O(1). All timers which expire by the
+ * time the task wakes are run in one batch, and the task sleeps until the
+ * next deadline (not a fixed poll period), so idle time isn't broken up by
+ * timer wakeups.
+ *
+ * Callbacks run on the timer task, so must be short and must not block.
+ */
+class TimerWheel {
+ public:
+  typedef void (*Callback)(void* arg);
+
+  /**
+   * A timer, owned by the client. Stopped when destroyed.
+   */
+  class Timer {
+   public:
+    Timer(TimerWheel* wheel, Callback callback, void* arg);
+    ~Timer();
+
+    Timer(const Timer&) = delete;
+    Timer& operator=(const Timer&) = delete;
+
+    /**
+     * (Re)start the timer to fire once after |delay_ms|.
+     */
+    void StartOnce(uint32_t delay_ms);
+
+    /**
+     * (Re)start the timer to fire every |period_ms|.
+     */
+    void StartPeriodic(uint32_t period_ms);
+
+    /**
+     * Stop the timer. Does not wait for a running callback to finish.
+     */
+    void Stop();
+
+   private:
+    friend class TimerWheel;
+
+    TimerWheel* wheel_;
+    const Callback callback_;
+    void* const arg_;
+    // Following members are guarded by |wheel_->mutex_|.
+    Timer* prev_;  // Slot list links.
+    Timer* next_;
+    Timer* batch_next_;  // Expired timer list link.
+    TickType_t expiry_;  // Tick at which the timer fires.
+    TickType_t period_;  // Zero if one-shot.
+    bool armed_;         // Is the timer in a slot?
+    bool expired_;       // Is the timer in |wheel_->batch_|?
+  };
+
+  /**
+   * Usage counters for diagnostics.
+   */
+  struct Stats {
+    uint32_t wakeups;      // Times the timer task woke.
+    uint32_t expirations;  // Callbacks run.
+    uint32_t batched;      // Callbacks run in the same wakeup as another.
+    uint32_t armed;        // Timers currently running.
+  };
+
+  TimerWheel();
+  ~TimerWheel();
+
+  /**
+   * Start the timer task.
+   */
+  esp_err_t Start();
+
+  Stats GetStats() const;
+  void LogStats() const;
+
+ private:
+  static constexpr int kNumSlots = 64;  // Must be a power of two.
+
+  static void TimerTask(void* arg);
+
+  void Arm(Timer* timer, uint32_t delay_ms, uint32_t period_ms);
+  void Disarm(Timer* timer);
+
+  // Following must be called with |mutex_| held.
+  void Link(Timer* timer);
+  void Unlink(Timer* timer);
+
+  void RemoveFromBatch(Timer* timer);
+
+  /**
+   * Move every timer due at |now| to |batch_| (re-arming periodic ones).
+   *
+   * @return The number of expired timers.
+   */
+  uint32_t CollectExpired(TickType_t now);
+
+  /**
+   * @return The ticks from |now| until the earliest deadline, or
+   *         portMAX_DELAY if no timer is armed.
+   */
+  TickType_t TicksUntilNextDeadline(TickType_t now) const;
+
+  /**
+   * Run the callbacks of the timers in |batch_|. Called without |mutex_|.
+   */
+  void RunExpired();
+
+  SemaphoreHandle_t mutex_;  // Synchronize access to following members.
+  Timer* slots_[kNumSlots];  // Armed timers, by expiry tick.
+  Timer* batch_;             // Expired timers whose callbacks are due.
+  TickType_t last_tick_;     // Last tick processed by the timer task.
+  TickType_t sleep_until_;   // Tick the timer task will wake at.
+  bool sleeping_forever_;    // Is the timer task waiting for a new timer?
+  Stats stats_;
+  TaskHandle_t task_;
+};
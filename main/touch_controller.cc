@@ -0,0 +1,262 @@
+#include "touch_controller.h"
+
+#include <cstdlib>
+
+#include <esp_log.h>
+#include <esp_timer.h>
+
+#include "power_manager.h"
+
+namespace {
+
+constexpr char TAG[] = "kbd_touch";
+
+// XPT2046 control bytes: start bit, channel, 12-bit differential mode, and
+// PD1:PD0 = 00 so that PENIRQ stays enabled between conversions.
+constexpr uint8_t kCmdZ1 = 0xB0;
+constexpr uint8_t kCmdZ2 = 0xC0;
+constexpr uint8_t kCmdX = 0x90;
+constexpr uint8_t kCmdY = 0xD0;
+
+constexpr int kClockSpeedHz = 2 * 1000 * 1000;  // Datasheet max. is 2.5 MHz.
+// z1 + 4095 - z2 (rises with pressure) below which a position is invalid.
+constexpr uint32_t kPressureThreshold = 400;
+// The panel is sampled at this period while pressed.
+constexpr uint32_t kSamplePeriodMSecs = 10;
+
+// Raw readings at the panel's edges, and the panel's (portrait) size.
+// TODO: Calibrate on the device.
+constexpr uint32_t kRawMin = 200;
+constexpr uint32_t kRawMax = 3900;
+constexpr uint32_t kPanelWidth = 240;
+constexpr uint32_t kPanelHeight = 320;
+
+// Gesture recognition, in panel pixels.
+constexpr int kTapMaxPixels = 15;    // A tap moves less than this.
+constexpr int kSwipeMinPixels = 60;  // A swipe moves at least this.
+constexpr int64_t kTapMaxUsecs = 300 * 1000;
+constexpr int64_t kSwipeMaxUsecs = 600 * 1000;  // Slower is a drag.
+
+// Packing of TouchController::Point into a 32-bit slot.
+constexpr uint32_t kPointXShift = 0;
+constexpr uint32_t kPointYShift = 12;
+constexpr uint32_t kPointCoordMask = 0xfff;
+constexpr uint32_t kPointPressed = 1u << 24;
+
+uint16_t ScaleRaw(uint32_t raw, uint32_t size) {
+  if (raw <= kRawMin)
+    return 0;
+  if (raw >= kRawMax)
+    return size - 1;
+  return (raw - kRawMin) * (size - 1) / (kRawMax - kRawMin);
+}
+
+uint32_t PackPoint(const TouchController::Point& point) {
+  return (point.x & kPointCoordMask) << kPointXShift |
+         (point.y & kPointCoordMask) << kPointYShift |
+         (point.pressed ? kPointPressed : 0);
+}
+
+TouchController::Gesture ToGesture(const TouchController::Point& start,
+                                   const TouchController::Point& end,
+                                   int64_t duration_us) {
+  const int dx = end.x - start.x;
+  const int dy = end.y - start.y;
+  if (std::abs(dx) < kTapMaxPixels && std::abs(dy) < kTapMaxPixels) {
+    return duration_us <= kTapMaxUsecs ? TouchController::Gesture::Tap
+                                       : TouchController::Gesture::None;
+  }
+  if (duration_us > kSwipeMaxUsecs)
+    return TouchController::Gesture::None;
+  if (std::abs(dx) >= std::abs(dy)) {
+    if (std::abs(dx) < kSwipeMinPixels)
+      return TouchController::Gesture::None;
+    return dx > 0 ? TouchController::Gesture::SwipeRight
+                  : TouchController::Gesture::SwipeLeft;
+  }
+  if (std::abs(dy) < kSwipeMinPixels)
+    return TouchController::Gesture::None;
+  return dy > 0 ? TouchController::Gesture::SwipeDown
+                : TouchController::Gesture::SwipeUp;
+}
+
+}  // namespace
+
+TouchController::TouchController(gpio_num_t cs_gpio, gpio_num_t irq_gpio)
+    : cs_gpio_(cs_gpio),
+      irq_gpio_(irq_gpio),
+      spi_(nullptr),
+      task_(nullptr),
+      point_(0),
+      gesture_(static_cast<uint8_t>(Gesture::None)),
+      listener_(nullptr),
+      gesture_listener_(nullptr) {}
+
+TouchController::~TouchController() {
+  gpio_isr_handler_remove(irq_gpio_);
+  if (task_)
+    vTaskDelete(task_);
+  if (spi_)
+    spi_bus_remove_device(spi_);
+}
+
+esp_err_t TouchController::Initialize(spi_host_device_t host) {
+  const spi_device_interface_config_t dev_config = {
+      .mode = 0,
+      .clock_speed_hz = kClockSpeedHz,
+      .spics_io_num = cs_gpio_,
+      .queue_size = 1,
+  };
+  esp_err_t err = spi_bus_add_device(host, &dev_config, &spi_);
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "Unable to add touch controller to SPI bus: %s.",
+             esp_err_to_name(err));
+    return err;
+  }
+
+  // https://www.freertos.org/FAQMem.html#StackSize
+  constexpr uint32_t kStackDepthWords = 2048;
+  // Above the render task so that a touch is published before the next
+  // input device read.
+  if (xTaskCreate(TouchTask, "touch", kStackDepthWords, this,
+                  tskIDLE_PRIORITY + 3, &task_) != pdPASS) {
+    return ESP_FAIL;
+  }
+
+  // PENIRQ is open drain, and only pulled low while the panel is pressed.
+  const gpio_config_t io_conf = {
+      .pin_bit_mask = 1ULL << irq_gpio_,
+      .mode = GPIO_MODE_INPUT,
+      .pull_up_en = GPIO_PULLUP_ENABLE,
+      .pull_down_en = GPIO_PULLDOWN_DISABLE,
+      .intr_type = GPIO_INTR_LOW_LEVEL,
+  };
+  err = gpio_config(&io_conf);
+  if (err != ESP_OK)
+    return err;
+  err = gpio_isr_handler_add(irq_gpio_, TouchISR, this);
+  if (err != ESP_OK)
+    return err;
+  // A press wakes the chip from light sleep.
+  err = PowerManager::EnableGPIOWakeup(irq_gpio_, /*level=*/0);
+  if (err != ESP_OK)
+    return err;
+
+  ESP_LOGI(TAG, "XPT2046 touch CS on GPIO %d, PENIRQ on GPIO %d.", cs_gpio_,
+           irq_gpio_);
+  return ESP_OK;
+}
+
+// static
+void IRAM_ATTR TouchController::TouchISR(void* arg) {
+  TouchController* controller = static_cast<TouchController*>(arg);
+  // The interrupt is level triggered, so keep it from firing again until
+  // the task has seen the panel released.
+  gpio_intr_disable(controller->irq_gpio_);
+  BaseType_t higher_priority_task_woken = pdFALSE;
+  vTaskNotifyGiveFromISR(controller->task_, &higher_priority_task_woken);
+  portYIELD_FROM_ISR(higher_priority_task_woken);
+}
+
+// static
+void TouchController::TouchTask(void* arg) {
+  TouchController* controller = static_cast<TouchController*>(arg);
+  while (true) {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    controller->TrackPress();
+    // Fires straight away if the panel was pressed again since.
+    gpio_intr_enable(controller->irq_gpio_);
+  }
+}
+
+void TouchController::TrackPress() {
+  // PENIRQ stays low (a wakeup) while pressed, so don't try to sleep.
+  PowerManager::Lock lock(PowerManager::Lock::Type::NoLightSleep);
+  Point start = {};
+  Point last = {};
+  int64_t start_us = 0;
+  while (true) {
+    Point point;
+    if (ReadPoint(&point) != ESP_OK) {
+      ESP_LOGW(TAG, "Unable to read touch data.");
+      point.pressed = false;
+    }
+    if (!point.pressed)
+      break;
+    point_.store(PackPoint(point), std::memory_order_release);
+    if (!last.pressed) {
+      start = point;
+      start_us = esp_timer_get_time();
+      const TaskHandle_t listener = listener_.load(std::memory_order_acquire);
+      if (listener)
+        xTaskNotifyGive(listener);
+    }
+    last = point;
+    vTaskDelay(pdMS_TO_TICKS(kSamplePeriodMSecs));
+  }
+
+  if (!last.pressed) {
+    // Too light a press to read, don't poll the controller while it lasts.
+    vTaskDelay(pdMS_TO_TICKS(kSamplePeriodMSecs));
+    return;
+  }
+  last.pressed = false;
+  point_.store(PackPoint(last), std::memory_order_release);
+
+  const Gesture gesture =
+      ToGesture(start, last, esp_timer_get_time() - start_us);
+  if (gesture == Gesture::None)
+    return;
+  gesture_.store(static_cast<uint8_t>(gesture), std::memory_order_release);
+  const TaskHandle_t listener =
+      gesture_listener_.load(std::memory_order_acquire);
+  if (listener)
+    xTaskNotifyGive(listener);
+}
+
+esp_err_t TouchController::ReadPoint(Point* point) {
+  // Each command's 12-bit result is clocked out (after a busy bit) during
+  // the next 16 clocks, so the next command is sent at the same time.
+  WORD_ALIGNED_ATTR const uint8_t tx[] = {
+      kCmdZ1, 0, kCmdZ2, 0, kCmdX, 0, kCmdY, 0, 0,
+  };
+  WORD_ALIGNED_ATTR uint8_t rx[sizeof(tx)];
+  spi_transaction_t trans = {};
+  trans.length = sizeof(tx) * 8;
+  trans.tx_buffer = tx;
+  trans.rx_buffer = rx;
+  const esp_err_t err = spi_device_polling_transmit(spi_, &trans);
+  if (err != ESP_OK)
+    return err;
+
+  uint32_t result[4];
+  for (int i = 0; i < 4; i++)
+    result[i] = (((rx[2 * i + 1] << 8) | rx[2 * i + 2]) >> 3) & 0xfff;
+  const uint32_t z = result[0] + 4095 - result[1];
+  point->x = ScaleRaw(result[2], kPanelWidth);
+  point->y = ScaleRaw(result[3], kPanelHeight);
+  point->pressed = z >= kPressureThreshold;
+  return ESP_OK;
+}
+
+void TouchController::SetListener(TaskHandle_t task) {
+  listener_.store(task, std::memory_order_release);
+}
+
+void TouchController::SetGestureListener(TaskHandle_t task) {
+  gesture_listener_.store(task, std::memory_order_release);
+}
+
+TouchController::Point TouchController::GetPoint() const {
+  const uint32_t point = point_.load(std::memory_order_acquire);
+  return Point{
+      .x = static_cast<uint16_t>((point >> kPointXShift) & kPointCoordMask),
+      .y = static_cast<uint16_t>((point >> kPointYShift) & kPointCoordMask),
+      .pressed = (point & kPointPressed) != 0,
+  };
+}
+
+TouchController::Gesture TouchController::TakeGesture() {
+  return static_cast<Gesture>(gesture_.exchange(
+      static_cast<uint8_t>(Gesture::None), std::memory_order_acquire));
+}
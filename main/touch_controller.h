@@ -0,0 +1,104 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+#include <driver/gpio.h>
+#include <driver/spi_master.h>
+#include <esp_attr.h>
+#include <esp_err.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+/**
+ * The main display's XPT2046 resistive touch controller.
+ *
+ * The controller shares the display's SPI bus, and is only read while it
+ * holds its PENIRQ line low, which it does only while the panel is pressed.
+ * The ISR wakes a task which samples the panel until it is released,
+ * publishing each point in a lock-free slot. Readers (the LVGL input device)
+ * only load the slot, so they never touch the bus. Nothing is read while
+ * the panel is untouched.
+ *
+ * The controller has no gesture engine, so a gesture is recognized from
+ * each press's start and end points once the panel is released.
+ */
+class TouchController {
+ public:
+  /**
+   * Gestures, in the panel's (portrait) coordinates.
+   */
+  enum class Gesture : uint8_t {
+    None,
+    Tap,
+    SwipeUp,
+    SwipeRight,
+    SwipeDown,
+    SwipeLeft,
+  };
+
+  struct Point {
+    uint16_t x;
+    uint16_t y;
+    bool pressed;
+  };
+
+  TouchController(gpio_num_t cs_gpio, gpio_num_t irq_gpio);
+  ~TouchController();
+
+  /**
+   * Add the controller to |host|, then start handling interrupts.
+   *
+   * The SPI bus must have already been initialized (by the display), and
+   * gpio_install_isr_service() must have already been called.
+   */
+  esp_err_t Initialize(spi_host_device_t host);
+
+  /**
+   * Notify |task| (via xTaskNotifyGive) each time the panel is pressed, or
+   * stop notifying if nullptr.
+   */
+  void SetListener(TaskHandle_t task);
+
+  /**
+   * Notify |task| (via xTaskNotifyGive) each time a gesture is recognized,
+   * or stop notifying if nullptr.
+   */
+  void SetGestureListener(TaskHandle_t task);
+
+  /**
+   * Return the most recent touch point. Safe to call from any task.
+   */
+  Point GetPoint() const;
+
+  /**
+   * Return the most recent gesture, if any, and reset it to None.
+   */
+  Gesture TakeGesture();
+
+ private:
+  static void IRAM_ATTR TouchISR(void* arg);
+  static void TouchTask(void* arg);
+
+  /**
+   * Sample the panel once.
+   *
+   * @return ESP_OK, with |point->pressed| false if the pressure is too low
+   *         for the position to be valid.
+   */
+  esp_err_t ReadPoint(Point* point);
+
+  /**
+   * Sample the panel until it is released, then publish the gesture.
+   */
+  void TrackPress();
+
+  const gpio_num_t cs_gpio_;
+  const gpio_num_t irq_gpio_;
+  spi_device_handle_t spi_;
+  TaskHandle_t task_;
+  std::atomic<uint32_t> point_;   // Packed Point.
+  std::atomic<uint8_t> gesture_;  // Latest Gesture not yet taken.
+  std::atomic<TaskHandle_t> listener_;          // Notified when pressed.
+  std::atomic<TaskHandle_t> gesture_listener_;  // Notified on a gesture.
+};
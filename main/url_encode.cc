@@ -0,0 +1,94 @@
+#include "url_encode.h"
+
+#include <array>
+#include <cstdint>
+
+namespace url {
+
+namespace {
+
+enum CharClass : uint8_t {
+  kEncoded = 0,     // Encoded as "%XX".
+  kUnreserved = 1,  // Copied as is.
+  kSpace = 2,       // ' ' - depends on mode.
+};
+
+constexpr bool IsUnreserved(int c) {
+  return (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') ||
+         (c >= '0' && c <= '9') || c == '-' || c == '.' || c == '_' ||
+         c == '~';
+}
+
+constexpr std::array<uint8_t, 256> CreateClassTable() {
+  std::array<uint8_t, 256> table{};
+  for (int c = 0; c < 256; c++) {
+    if (IsUnreserved(c))
+      table[c] = kUnreserved;
+    else if (c == ' ')
+      table[c] = kSpace;
+    else
+      table[c] = kEncoded;
+  }
+  return table;
+}
+
+constexpr std::array<uint8_t, 256> kCharClass = CreateClassTable();
+constexpr char kHexDigits[] = "0123456789ABCDEF";
+
+static_assert(kCharClass['~'] == kUnreserved);
+static_assert(kCharClass['/'] == kEncoded);
+
+}  // namespace
+
+size_t EncodedLength(const char* str, size_t len, Mode mode) {
+  size_t encoded_len = len;
+  for (size_t i = 0; i < len; i++) {
+    const uint8_t cls = kCharClass[static_cast<uint8_t>(str[i])];
+    if (cls == kEncoded || (cls == kSpace && mode == Mode::Component))
+      encoded_len += 2;
+  }
+  return encoded_len;
+}
+
+esp_err_t Encode(const char* str,
+                 size_t len,
+                 Mode mode,
+                 char* dst,
+                 size_t dst_size,
+                 size_t* written) {
+  if (EncodedLength(str, len, mode) >= dst_size)
+    return ESP_ERR_INVALID_SIZE;
+
+  char* out = dst;
+  for (size_t i = 0; i < len; i++) {
+    const uint8_t c = static_cast<uint8_t>(str[i]);
+    switch (kCharClass[c]) {
+      case kUnreserved:
+        *out++ = c;
+        continue;
+      case kSpace:
+        if (mode == Mode::Form) {
+          *out++ = '+';
+          continue;
+        }
+        break;
+    }
+    *out++ = '%';
+    *out++ = kHexDigits[c >> 4];
+    *out++ = kHexDigits[c & 0xf];
+  }
+  *out = '\0';
+  *written = out - dst;
+  return ESP_OK;
+}
+
+std::string Encode(const std::string& str, Mode mode) {
+  // std::string always has room for a terminator after size().
+  std::string encoded(EncodedLength(str.data(), str.length(), mode), '\0');
+  size_t written;
+  Encode(str.data(), str.length(), mode, &encoded[0], encoded.size() + 1,
+         &written);
+  return encoded;
+}
+
+}  // namespace url
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+#include <esp_err.h>
+
+// Percent-encoding as described in RFC 3986 section 2.1.
+namespace url {
+
+enum class Mode {
+  Component,  // URI component: all but unreserved characters are encoded.
+  Form,       // application/x-www-form-urlencoded: as above, but ' ' -> '+'.
+};
+
+/**
+ * Return the length of |str| once encoded (excluding any terminator).
+ */
+size_t EncodedLength(const char* str, size_t len, Mode mode);
+
+/**
+ * Encode |str| into a caller supplied buffer.
+ *
+ * @param dst      Receives the null terminated encoded string.
+ * @param dst_size Size of |dst|. Must be > EncodedLength().
+ * @param written  Receives the encoded length (excluding terminator).
+ *
+ * @return ESP_OK if successful, ESP_ERR_INVALID_SIZE if |dst| is too small.
+ */
+esp_err_t Encode(const char* str,
+                 size_t len,
+                 Mode mode,
+                 char* dst,
+                 size_t dst_size,
+                 size_t* written);
+
+/**
+ * Encode |str|, allocating the result exactly once.
+ */
+std::string Encode(const std::string& str, Mode mode = Mode::Component);
+
+}  // namespace url
@@ -2,9 +2,11 @@
 
 #include <cstring>
 
+#include <driver/gpio.h>
 #include <esp_log.h>
 #include <freertos/task.h>
 #include <tusb.h>
+#include "power_manager.h"
 #include "usb_board.h"
 #include "usb_hid.h"
 #include "usb_misc.h"
@@ -30,6 +32,9 @@ static_assert(sizeof(ConfigDescriptors) ==
                   sizeof(HID::kHIDDescriptorConfig));
 
 constexpr char TAG[] = "kbd_usb";
+// The USB peripheral is stopped in light sleep. While suspended the host
+// resumes the bus by driving D- high, which wakes the chip.
+constexpr gpio_num_t kUSBDMinusGPIO = GPIO_NUM_19;
 // TODO: These are from random.org. Need to get actual VID/PID numbers to
 //       avoid conflicts with other products.
 constexpr uint16_t kVendorID = 0xae9b;
@@ -139,6 +144,29 @@ uint16_t const* tud_descriptor_string_cb(uint8_t index, uint16_t /*langid*/) {
   return g_unknown_descriptor_string;
 }
 
+// Invoked when the device is mounted (configured) by the host.
+void tud_mount_cb(void) {
+  PowerManager::SetUSBActive(true);
+}
+
+// Invoked when the device is unmounted.
+void tud_umount_cb(void) {
+  PowerManager::SetUSBActive(false);
+}
+
+// Invoked when the bus is suspended. Within 7ms the device must draw an
+// average current less than 2.5 mA from the bus.
+void tud_suspend_cb(bool /*remote_wakeup_en*/) {
+  PowerManager::EnableGPIOWakeup(kUSBDMinusGPIO, /*level=*/1);
+  PowerManager::SetUSBActive(false);
+}
+
+// Invoked when the bus is resumed.
+void tud_resume_cb(void) {
+  PowerManager::DisableGPIOWakeup(kUSBDMinusGPIO);
+  PowerManager::SetUSBActive(true);
+}
+
 }  // extern C
 
 }  // namespace
@@ -40,6 +40,9 @@ class Device {
 
   /**
    * Give time to the USB stack to do work.
+   *
+   * Blocks until the stack has at least one event (from the USB interrupt
+   * or a class driver) to process.
    */
   static void Tick();
 };
@@ -1,5 +1,7 @@
 #include "usb_hid.h"
 
+#include <atomic>
+
 #include <freertos/FreeRTOS.h>
 
 #include <class/hid/hid_device.h>
@@ -18,6 +20,10 @@ namespace {
 constexpr char TAG[] = "kbd_hid";
 constexpr uint8_t kASCII2KeyCode[128][2] = {HID_ASCII_TO_KEYCODE};
 
+std::atomic<uint8_t> g_keyboard_leds;  // Last KEYBOARD_LED_* from the host.
+HID::LEDsChangedCallback g_leds_changed_cb = nullptr;
+void* g_leds_changed_arg = nullptr;
+
 extern "C" {
 
 // Invoked when received GET HID REPORT DESCRIPTOR
@@ -48,11 +54,12 @@ void tud_hid_set_report_cb(uint8_t report_id,
   if (bufsize < 1)
     return;
 
-  const uint8_t num_lock = buffer[KEYBOARD_LED_NUMLOCK];
-  const uint8_t caps_lock = buffer[KEYBOARD_LED_CAPSLOCK];
-
-  ESP_LOGI(TAG, "NUM LOCK: %c, CAPS LOCK: %c", num_lock ? 'Y' : 'N',
-           caps_lock ? 'Y' : 'N');
+  const uint8_t leds = buffer[0];
+  ESP_LOGI(TAG, "NUM LOCK: %c, CAPS LOCK: %c",
+           leds & KEYBOARD_LED_NUMLOCK ? 'Y' : 'N',
+           leds & KEYBOARD_LED_CAPSLOCK ? 'Y' : 'N');
+  if (g_keyboard_leds.exchange(leds) != leds && g_leds_changed_cb)
+    g_leds_changed_cb(leds, g_leds_changed_arg);
 }
 
 }  // extern "C"
@@ -88,9 +95,20 @@ esp_err_t HID::KeyboardRelease(uint8_t report_id) {
   return tud_hid_keyboard_report(report_id, 0, nullptr) ? ESP_OK : ESP_FAIL;
 }
 
+// static
+esp_err_t HID::ConsumerReport(uint8_t report_id, uint16_t usage) {
+  return tud_hid_report(report_id, &usage, sizeof(usage)) ? ESP_OK : ESP_FAIL;
+}
+
 // static
 bool HID::Ready() {
   return tud_hid_ready();
 }
 
+// static
+void HID::SetLEDsChangedCallback(LEDsChangedCallback callback, void* arg) {
+  g_leds_changed_arg = arg;
+  g_leds_changed_cb = callback;
+}
+
 }  // namespace usb
\ No newline at end of file
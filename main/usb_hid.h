@@ -11,7 +11,7 @@
 
 namespace usb {
 
-enum { REPORT_ID_KEYBOARD = 1, REPORT_ID_MOUSE };
+enum { REPORT_ID_KEYBOARD = 1, REPORT_ID_MOUSE, REPORT_ID_CONSUMER_CONTROL };
 
 class HID {
  private:
@@ -23,7 +23,8 @@ class HID {
  public:
   constexpr static char kInterfaceName[] = "Keyboard HID";
   constexpr static uint8_t kHIDDescriptorReport[] = {
-      TUD_HID_REPORT_DESC_KEYBOARD(HID_REPORT_ID(HID_PROTOCOL_KEYBOARD))};
+      TUD_HID_REPORT_DESC_KEYBOARD(HID_REPORT_ID(HID_PROTOCOL_KEYBOARD)),
+      TUD_HID_REPORT_DESC_CONSUMER(HID_REPORT_ID(REPORT_ID_CONSUMER_CONTROL))};
   constexpr static uint8_t kHIDDescriptorConfig[] = {
       TUD_HID_DESCRIPTOR(kInterfaceNumber,
                          STRID_HID,
@@ -33,6 +34,13 @@ class HID {
                          CFG_TUD_HID_EP_BUFSIZE,
                          kEndpointIntervalMs)};
 
+  /**
+   * Called (from the USB task) when the host changes the keyboard LEDs.
+   *
+   * @param leds The new LED state (KEYBOARD_LED_* masks).
+   */
+  typedef void (*LEDsChangedCallback)(uint8_t leds, void* arg);
+
   HID() = delete;
   ~HID() = delete;
 
@@ -58,7 +66,20 @@ class HID {
 
   static esp_err_t KeyboardRelease(uint8_t report_id);
 
+  /**
+   * Consumer Control Report.
+   *
+   * @param report_id // Can be zero.
+   * @param usage     // The pressed control (HID_USAGE_CONSUMER_*), or zero
+   *                  // when released.
+   *
+   * @return ESP_OK on success, else other error code.
+   */
+  static esp_err_t ConsumerReport(uint8_t report_id, uint16_t usage);
+
   static bool Ready();
+
+  static void SetLEDsChangedCallback(LEDsChangedCallback callback, void* arg);
 };
 
 }  // namespace usb
\ No newline at end of file
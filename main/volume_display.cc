@@ -1,77 +1,187 @@
+#include "volume_display.h"
 
-#include <utility>
+#include <algorithm>
+#include <cstring>
 
-#include <lv_core/lv_obj.h>
-#include <lv_widgets/lv_bar.h>
-#include <lvgl_tft/ssd1306.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <i2clib/operation.h>
 
-#include "volume_display.h"
+#include "i2c_bus.h"
 
 namespace {
-constexpr uint16_t kNumBufferRows = 16;
-constexpr uint16_t kDisplayWidth = 128;
-constexpr uint16_t kDisplayHeight = 32;
-constexpr uint32_t kNumBufferPixels = kDisplayWidth * kNumBufferRows;
+
+constexpr char TAG[] = "kbd_volume";
+constexpr uint8_t kSlaveAddress = 0x3C;  // I2C address of SSD1306.
 constexpr int16_t kMaxVolume = 100;
 constexpr int16_t kMinVolume = 0;
-}  // namespace
 
-VolumeDisplay::VolumeDisplay(i2c::Master master)
-    : i2c_master_(std::move(master)),
-      disp_driver_(nullptr),
-      display_buf_1_(new lv_color_t[kDisplayWidth * kNumBufferRows]),
-      display_buf_2_(new lv_color_t[kDisplayWidth * kNumBufferRows]),
-      screen_(nullptr),
-      bar_(nullptr),
-      volume_(25) {}
+// SSD1306 control bytes. Each command (and its arguments) in a transaction
+// is preceded by kControlCommand. The data which follows kControlData runs
+// to the end of the transaction.
+constexpr uint8_t kControlCommand = 0x80;  // Co=1, D/C#=0.
+constexpr uint8_t kControlData = 0x40;     // Co=0, D/C#=1.
+
+// SSD1306 commands.
+constexpr uint8_t kCmdSetColumnAddress = 0x21;
+constexpr uint8_t kCmdSetPageAddress = 0x22;
+
+constexpr uint8_t kInitCommands[] = {
+    0xAE,        // Display off.
+    0xD5, 0x80,  // Clock divide ratio/oscillator frequency.
+    0xA8, 0x1F,  // Multiplex ratio: 32 rows.
+    0xD3, 0x00,  // Display offset.
+    0x40,        // Display start line 0.
+    0x8D, 0x14,  // Enable charge pump.
+    0x20, 0x00,  // Horizontal addressing mode.
+    0xA1,        // Segment remap: column 127 is SEG0.
+    0xC8,        // COM scan direction: remapped.
+    0xDA, 0x02,  // COM pins: sequential (128x32).
+    0x81, 0x8F,  // Contrast.
+    0xD9, 0xF1,  // Pre-charge period.
+    0xDB, 0x40,  // VCOMH deselect level.
+    0xA4,        // Display follows RAM.
+    0xA6,        // Normal (not inverted).
+    0xAF,        // Display on.
+};
+
+// The bar is inset within a one pixel outline.
+constexpr uint16_t kBarInset = 2;
+
+// Return the bits of |page| covering rows [first_row, last_row].
+uint8_t RowMask(uint16_t page, uint16_t first_row, uint16_t last_row) {
+  uint8_t mask = 0;
+  for (uint16_t bit = 0; bit < 8; bit++) {
+    const uint16_t row = page * 8 + bit;
+    if (row >= first_row && row <= last_row)
+      mask |= 1 << bit;
+  }
+  return mask;
+}
 
-bool VolumeDisplay::Initialize() {
-  // The lvgl_esp32_drivers library initializes the one configured
-  // display when lvgl_driver_init() is called. We need to manually
-  // initialize supplemental drivers. Maybe that library can support
-  // more than one display type in the future. Bug added at
-  // https://github.com/lvgl/lvgl_esp32_drivers/issues/31
-  ssd1306_init();
-
-  lv_disp_buf_init(&disp_buf_, display_buf_1_.get(), display_buf_2_.get(),
-                   kNumBufferPixels);
-
-  lv_disp_drv_t disp_drv;
-  lv_disp_drv_init(&disp_drv);
-
-  disp_drv.flush_cb = ssd1306_flush;
-  disp_drv.rounder_cb = ssd1306_rounder;
-  disp_drv.buffer = &disp_buf_;
-  disp_drv.hor_res = kDisplayWidth;
-  disp_drv.ver_res = kDisplayHeight;
-
-  disp_driver_ = lv_disp_drv_register(&disp_drv);
-  if (!disp_driver_)
-    return false;
+}  // namespace
 
-  screen_ = lv_disp_get_scr_act(disp_driver_);
-  if (!screen_)
-    return false;
+VolumeDisplay::VolumeDisplay(I2CBus* i2c_bus)
+    : i2c_bus_(i2c_bus), sent_valid_(false), volume_(25) {
+  std::memset(frame_, 0, sizeof(frame_));
+  std::memset(sent_, 0, sizeof(sent_));
+}
 
-#if 0
-  bar_ = lv_bar_create(screen_, nullptr);
-  if (!bar_)
-    return false;
+VolumeDisplay::~VolumeDisplay() = default;
+
+esp_err_t VolumeDisplay::SendCommands(const uint8_t* cmds, size_t num_cmds) {
+  I2CBus::Lease lease(i2c_bus_, I2CBus::Priority::Bulk);
+  i2c::Operation op = lease.master().CreateWriteOp(
+      kSlaveAddress, kControlCommand, "OLED::Cmd");
+  if (!op.ready())
+    return ESP_FAIL;
+  for (size_t i = 0; i < num_cmds; i++) {
+    if (i && !op.WriteByte(kControlCommand))
+      return ESP_FAIL;
+    if (!op.WriteByte(cmds[i]))
+      return ESP_FAIL;
+  }
+  return op.Execute() ? ESP_OK : ESP_FAIL;
+}
 
-  lv_obj_set_pos(bar_, 0, 0);
-  lv_obj_set_size(bar_, kDisplayWidth, kDisplayHeight);
+bool VolumeDisplay::Initialize() {
+  if (SendCommands(kInitCommands, sizeof(kInitCommands)) != ESP_OK) {
+    ESP_LOGE(TAG, "Unable to initialize OLED");
+    return false;
+  }
+  sent_valid_ = false;  // Panel RAM contents are unknown.
+  Update();
+  return true;
+}
 
-  lv_bar_set_range(bar_, kMinVolume, kMaxVolume);
-  lv_bar_set_value(bar_, volume_, LV_ANIM_OFF);
-#else
-  bar_ = lv_label_create(screen_, nullptr);
-  lv_label_set_text(bar_, "Hello World");
-  lv_obj_set_pos(bar_, 0, 0);
-#endif
+void VolumeDisplay::Render() {
+  const uint16_t bar_width =
+      volume_ * (kWidth - 2 * kBarInset) / (kMaxVolume - kMinVolume);
+  for (uint16_t page = 0; page < kNumPages; page++) {
+    const uint8_t outline =
+        RowMask(page, 0, 0) | RowMask(page, kHeight - 1, kHeight - 1);
+    const uint8_t bar =
+        RowMask(page, kBarInset, kHeight - 1 - kBarInset) | outline;
+    for (uint16_t col = 0; col < kWidth; col++) {
+      if (col == 0 || col == kWidth - 1)
+        frame_[page][col] = 0xFF;
+      else if (col >= kBarInset && col < kBarInset + bar_width)
+        frame_[page][col] = bar;
+      else
+        frame_[page][col] = outline;
+    }
+  }
+}
 
-  return true;
+esp_err_t VolumeDisplay::Flush() {
+  // Find the rectangle of changed bytes.
+  uint16_t first_page = kNumPages, last_page = 0;
+  uint16_t first_col = kWidth, last_col = 0;
+  for (uint16_t page = 0; page < kNumPages; page++) {
+    for (uint16_t col = 0; col < kWidth; col++) {
+      if (sent_valid_ && frame_[page][col] == sent_[page][col])
+        continue;
+      first_page = std::min(first_page, page);
+      last_page = std::max(last_page, page);
+      first_col = std::min(first_col, col);
+      last_col = std::max(last_col, col);
+    }
+  }
+  if (first_page == kNumPages)
+    return ESP_OK;  // Nothing changed.
+
+  const int64_t start = esp_timer_get_time();
+  I2CBus::Lease lease(i2c_bus_, I2CBus::Priority::Bulk);
+  // Set the address window and send the changed bytes of every page in one
+  // transaction. The panel wraps to the next page at |last_col|.
+  i2c::Operation op = lease.master().CreateWriteOp(
+      kSlaveAddress, kControlCommand, "OLED::Flush");
+  const uint8_t window[] = {
+      // Control byte kControlCommand is sent by CreateWriteOp().
+      kCmdSetColumnAddress,
+      kControlCommand,
+      static_cast<uint8_t>(first_col),
+      kControlCommand,
+      static_cast<uint8_t>(last_col),
+      kControlCommand,
+      kCmdSetPageAddress,
+      kControlCommand,
+      static_cast<uint8_t>(first_page),
+      kControlCommand,
+      static_cast<uint8_t>(last_page),
+      kControlData,
+  };
+  const size_t num_cols = last_col - first_col + 1;
+  bool ok = op.ready() && op.Write(window, sizeof(window));
+  for (uint16_t page = first_page; ok && page <= last_page; page++)
+    ok = op.Write(&frame_[page][first_col], num_cols);
+  if (!ok || !op.Execute()) {
+    sent_valid_ = false;  // Resend everything next time.
+    return ESP_FAIL;
+  }
+
+  for (uint16_t page = first_page; page <= last_page; page++)
+    std::memcpy(&sent_[page][first_col], &frame_[page][first_col], num_cols);
+  sent_valid_ = true;
+  ESP_LOGV(TAG, "Sent %u bytes in %lld usec.",
+           sizeof(window) + num_cols * (last_page - first_page + 1),
+           esp_timer_get_time() - start);
+  return ESP_OK;
 }
 
 void VolumeDisplay::Update() {
-  // lv_bar_set_value(bar, new_value, LV_ANIM_ON/OFF)
+  Render();
+  if (Flush() != ESP_OK)
+    ESP_LOGW(TAG, "Unable to update OLED");
+}
+
+void VolumeDisplay::SetVolume(int16_t volume) {
+  if (volume < kMinVolume)
+    volume = kMinVolume;
+  else if (volume > kMaxVolume)
+    volume = kMaxVolume;
+  if (volume == volume_)
+    return;
+  volume_ = volume;
+  Update();
 }
@@ -1,24 +1,43 @@
+#pragma once
 
+#include <cstddef>
 #include <cstdint>
-#include <memory>
 
-#include <i2clib/master.h>
-#include <lvgl.h>
+#include <esp_err.h>
 
+class I2CBus;
+
+/**
+ * Draws the volume bar on the 128x32 SSD1306 OLED.
+ *
+ * This does not use LVGL. The bar is drawn into a 1-bpp framebuffer (in the
+ * panel's native page layout), which is diffed against the frame last sent
+ * to the panel. Only the changed rectangle of pages/columns is sent, so a
+ * one step volume change is a few tens of bytes on the bus. The OLED is the
+ * only device on its bus, so the rectangle is sent in a single transaction.
+ */
 class VolumeDisplay {
  public:
-  VolumeDisplay(i2c::Master master);
+  VolumeDisplay(I2CBus* i2c_bus);
+  ~VolumeDisplay();
 
   bool Initialize();
   void Update();
+  void SetVolume(int16_t volume);
+  int16_t volume() const { return volume_; }
 
  private:
-  i2c::Master i2c_master_;
-  lv_disp_buf_t disp_buf_;
-  lv_disp_t* disp_driver_;
-  std::unique_ptr<lv_color_t[]> display_buf_1_;
-  std::unique_ptr<lv_color_t[]> display_buf_2_;
-  lv_obj_t* screen_;
-  lv_obj_t* bar_;
+  static constexpr uint16_t kWidth = 128;
+  static constexpr uint16_t kHeight = 32;
+  static constexpr uint16_t kNumPages = kHeight / 8;  // 8 rows per page.
+
+  esp_err_t SendCommands(const uint8_t* cmds, size_t num_cmds);
+  void Render();
+  esp_err_t Flush();
+
+  I2CBus* i2c_bus_;
+  uint8_t frame_[kNumPages][kWidth];  // The frame being drawn.
+  uint8_t sent_[kNumPages][kWidth];   // The frame last sent to the panel.
+  bool sent_valid_;                   // Does |sent_| match the panel?
   int16_t volume_;
 };
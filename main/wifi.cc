@@ -5,15 +5,33 @@
 #define LOG_LOCAL_LEVEL ESP_LOG_VERBOSE
 
 #include <esp_log.h>
+#include <esp_system.h>
+#include <esp_timer.h>
 #include <esp_wifi.h>
+#include <nvs.h>
 
-#include "event_ids.h"
+#include "event_bus.h"
 
 namespace {
 constexpr char TAG[] = "kbd_wifi";
 constexpr size_t kMaxSSIDLen = 31;
 constexpr size_t kMaxKeyLen = 63;
-constexpr int kMaxNumConnectRetry = 10;
+constexpr char kNVSNamespace[] = "wifi";
+constexpr char kNVSCachedAPKey[] = "ap";
+// Valid esp_wifi_set_max_tx_power() values, in 0.25 dBm units.
+constexpr int8_t kMinTxPower = 8;
+constexpr int8_t kMaxTxPower = 84;
+
+// The AP last connected to, as stored in NVS.
+struct CachedAP {
+  char ssid[kMaxSSIDLen + 2];  // NUL terminated.
+  uint8_t bssid[6];
+  uint8_t channel;
+};
+
+// Posted by the retry timer, so that the reconnect state machine only runs
+// on the event loop task.
+ESP_EVENT_DEFINE_BASE(KBD_WIFI_RETRY_EVENT);
 
 const char* wifi_event_name(wifi_event_t event) {
   switch (event) {
@@ -60,6 +78,19 @@ const char* wifi_event_name(wifi_event_t event) {
   }
 }
 
+const char* ps_name(wifi_ps_type_t type) {
+  switch (type) {
+    case WIFI_PS_NONE:
+      return "none";
+    case WIFI_PS_MIN_MODEM:
+      return "min_modem";
+    case WIFI_PS_MAX_MODEM:
+      return "max_modem";
+    default:
+      return "<unknown: wifi_ps_type_t>";
+  }
+}
+
 const char* ip_event_name(ip_event_t event) {
   switch (event) {
     case IP_EVENT_STA_GOT_IP:
@@ -115,17 +146,37 @@ void WiFi::HandleWiFiEvent(wifi_event_t event_id, void* event_data) {
   switch (event_id) {
     case WIFI_EVENT_STA_START:
       ESP_LOGW(TAG, "Starting");
-      esp_wifi_connect();
-      break;
-    case WIFI_EVENT_STA_DISCONNECTED:
-      if (retry_num_ < kMaxNumConnectRetry) {
-        esp_wifi_connect();
-        retry_num_++;
-      } else {
-        ESP_LOGW(TAG, "Connection failed");
-        xEventGroupSetBits(wifi_event_group_, EVENT_NETWORK_DISCONNECTED);
+      // Can only be set once started.
+      if (power_config_.max_tx_power) {
+        ESP_ERROR_CHECK_WITHOUT_ABORT(
+            esp_wifi_set_max_tx_power(power_config_.max_tx_power));
       }
+      if (reconnect_.state() == ReconnectStateMachine::State::Connecting)
+        esp_wifi_connect();
+      break;
+    case WIFI_EVENT_STA_CONNECTED:
+      if (have_static_ip_)
+        ESP_ERROR_CHECK_WITHOUT_ABORT(ApplyStaticIP());
       break;
+    case WIFI_EVENT_STA_DISCONNECTED: {
+      const wifi_event_sta_disconnected_t* event =
+          static_cast<wifi_event_sta_disconnected_t*>(event_data);
+      if (!connect_start_us_)
+        connect_start_us_ = esp_timer_get_time();
+      if (directed_) {
+        // The cached AP may have moved channel or been replaced, so scan
+        // from now on.
+        ESP_ERROR_CHECK_WITHOUT_ABORT(StopDirected());
+        if (reconnect_.state() == ReconnectStateMachine::State::Connecting) {
+          ESP_LOGW(TAG, "Cached AP connection failed (reason %u), scanning.",
+                   event->reason);
+          esp_wifi_connect();
+          break;
+        }
+      }
+      ESP_LOGW(TAG, "Disconnected, reason %u.", event->reason);
+      Apply(Feed(&ReconnectStateMachine::OnDisconnected), event->reason);
+    } break;
     default:
       break;
   }
@@ -142,14 +193,76 @@ void WiFi::HandleIPEvent(ip_event_t event_id, void* event_data) {
       ::GetHostname(event->esp_netif, &hostname);
       ESP_LOGI(TAG, "Hostname: \"%s\"", hostname.c_str());
 
-      retry_num_ = 0;
-      xEventGroupSetBits(wifi_event_group_, EVENT_NETWORK_GOT_IP);
+      const int64_t now = esp_timer_get_time();
+      ESP_LOGI(TAG, "Got IP %lld ms after boot, %lld ms after %s connect.",
+               now / 1000, (now - connect_start_us_) / 1000,
+               directed_ ? "directed" : "scanning");
+      connect_start_us_ = 0;
+      SaveCachedAP();
+
+      Apply(Feed(&ReconnectStateMachine::OnGotIP), /*reason=*/0);
+      event_bus_->Post({
+          .type = EventType::NetworkGotIP,
+          .network_got_ip = {.ip = event->ip_info.ip.addr},
+      });
     } break;
+    case IP_EVENT_STA_LOST_IP:
+      ESP_LOGW(TAG, "Lost IP address.");
+      Apply(Feed(&ReconnectStateMachine::OnLostIP), /*reason=*/0);
+      break;
     default:
       break;
   }
 }
 
+ReconnectStateMachine::Action WiFi::Feed(
+    ReconnectStateMachine::Action (ReconnectStateMachine::*event)(int64_t)) {
+  bool give_mutex = xSemaphoreTake(mutex_, portMAX_DELAY) == pdTRUE;
+  const ReconnectStateMachine::Action action =
+      (reconnect_.*event)(esp_timer_get_time());
+  if (give_mutex)
+    xSemaphoreGive(mutex_);
+  return action;
+}
+
+void WiFi::Apply(const ReconnectStateMachine::Action& action, uint8_t reason) {
+  if (action.went_offline) {
+    event_bus_->Post({
+        .type = EventType::NetworkDisconnected,
+        .network_disconnected = {.reason = reason},
+    });
+  }
+  if (action.disconnect)
+    esp_wifi_disconnect();
+  if (action.radio_off && radio_on_) {
+    ESP_LOGI(TAG, "Radio off for %u ms.", action.timer_ms);
+    esp_wifi_stop();
+    radio_on_ = false;
+  }
+  if (action.connect) {
+    if (radio_on_) {
+      esp_wifi_connect();
+    } else {
+      // Connects on WIFI_EVENT_STA_START.
+      const esp_err_t err = esp_wifi_start();
+      if (err != ESP_OK)
+        ESP_LOGE(TAG, "Start failed: %s", esp_err_to_name(err));
+      radio_on_ = err == ESP_OK;
+    }
+  }
+  if (action.timer_ms)
+    retry_timer_.StartOnce(action.timer_ms);
+  else if (action.cancel_timer)
+    retry_timer_.Stop();
+}
+
+// static
+void WiFi::RetryTimerCb(void* arg) {
+  // Don't block the timer task if the event queue is full: the attempt
+  // timeout or next disconnect will get things going again.
+  esp_event_post(KBD_WIFI_RETRY_EVENT, 0, nullptr, 0, 0);
+}
+
 // static
 void WiFi::EventHandler(void* arg,
                         esp_event_base_t event_base,
@@ -161,25 +274,54 @@ void WiFi::EventHandler(void* arg,
   } else if (event_base == IP_EVENT) {
     static_cast<WiFi*>(arg)->HandleIPEvent(static_cast<ip_event_t>(event_id),
                                            event_data);
+  } else if (event_base == KBD_WIFI_RETRY_EVENT) {
+    WiFi* wifi = static_cast<WiFi*>(arg);
+    wifi->Apply(wifi->Feed(&ReconnectStateMachine::OnTimer), /*reason=*/0);
   }
 }
 
-WiFi::WiFi(EventGroupHandle_t wifi_event_group)
-    : wifi_event_group_(wifi_event_group),
+WiFi::WiFi(EventBus* event_bus, TimerWheel* timer_wheel)
+    : event_bus_(event_bus),
       instance_any_id_(nullptr),
-      instance_got_ip_(nullptr),
-      retry_num_(0),
-      netif_(nullptr) {}
+      instance_ip_(nullptr),
+      instance_retry_(nullptr),
+      netif_(nullptr),
+      bssid_{0},
+      channel_(0),
+      directed_(false),
+      have_static_ip_(false),
+      static_ip_({}),
+      static_dns_({}),
+      connect_start_us_(0),
+      retry_timer_(timer_wheel, RetryTimerCb, this),
+      mutex_(xSemaphoreCreateMutex()),
+      reconnect_(ReconnectStateMachine::kDefaultParams, esp_random),
+      radio_on_(false),
+      power_config_({
+          .idle_ps = WIFI_PS_MIN_MODEM,
+          .listen_interval = 3,
+          .max_tx_power = 0,
+      }),
+      busy_(false),
+      busy_start_us_(0),
+      busy_us_(0),
+      busy_periods_(0) {}
 
 WiFi::~WiFi() {
-  if (instance_got_ip_) {
+  retry_timer_.Stop();
+  if (instance_retry_) {
+    ESP_ERROR_CHECK(esp_event_handler_instance_unregister(
+        KBD_WIFI_RETRY_EVENT, ESP_EVENT_ANY_ID, instance_retry_));
+  }
+  if (instance_ip_) {
     ESP_ERROR_CHECK(esp_event_handler_instance_unregister(
-        IP_EVENT, IP_EVENT_STA_GOT_IP, instance_got_ip_));
+        IP_EVENT, ESP_EVENT_ANY_ID, instance_ip_));
   }
   if (instance_any_id_) {
     ESP_ERROR_CHECK(esp_event_handler_instance_unregister(
         WIFI_EVENT, ESP_EVENT_ANY_ID, instance_any_id_));
   }
+  vSemaphoreDelete(mutex_);
 }
 
 esp_err_t WiFi::Inititialize() {
@@ -189,7 +331,7 @@ esp_err_t WiFi::Inititialize() {
     return err;
   }
 
-  esp_netif_t* netif_ = esp_netif_create_default_wifi_sta();
+  netif_ = esp_netif_create_default_wifi_sta();
   if (!netif_)
     return ESP_FAIL;
 
@@ -208,25 +350,31 @@ esp_err_t WiFi::Inititialize() {
     return err;
   }
   err = esp_event_handler_instance_register(
-      IP_EVENT, IP_EVENT_STA_GOT_IP, &EventHandler, this, &instance_got_ip_);
-
-  return err;
+      IP_EVENT, ESP_EVENT_ANY_ID, &EventHandler, this, &instance_ip_);
+  if (err != ESP_OK)
+    return err;
+  return esp_event_handler_instance_register(KBD_WIFI_RETRY_EVENT,
+                                             ESP_EVENT_ANY_ID, &EventHandler,
+                                             this, &instance_retry_);
 }
 
 esp_err_t WiFi::Connect(const std::string& ssid, const std::string& key) {
   ESP_LOGI(TAG, "Attempting connection to WiFi network: \"%s\"", ssid.c_str());
 
   esp_wifi_stop();
-  // TODO: Is clearing events necessary, or is this done automatically?
-  constexpr EventBits_t kAllNetworkEvents =
-      EVENT_NETWORK_GOT_IP | EVENT_NETWORK_DISCONNECTED;
-  xEventGroupClearBits(wifi_event_group_, kAllNetworkEvents);
-
-  retry_num_ = 0;
+  radio_on_ = false;
+  connect_start_us_ = esp_timer_get_time();
 
   if (ssid.length() > kMaxSSIDLen || key.length() > kMaxKeyLen)
     return ESP_ERR_INVALID_SIZE;
 
+  ssid_ = ssid;
+  directed_ = LoadCachedAP(ssid);
+  if (directed_) {
+    ESP_LOGI(TAG, "Trying cached AP " MACSTR " on channel %u.",
+             MAC2STR(bssid_), channel_);
+  }
+
   esp_err_t err = esp_wifi_set_mode(WIFI_MODE_STA);
   if (err != ESP_OK) {
     ESP_LOGE(TAG, "Failure to set mode: %s", esp_err_to_name(err));
@@ -239,10 +387,10 @@ esp_err_t WiFi::Connect(const std::string& ssid, const std::string& key) {
               .ssid = {0},
               .password = {0},
               .scan_method = WIFI_FAST_SCAN,
-              .bssid_set = false,
+              .bssid_set = directed_,
               .bssid = {0},
-              .channel = 0,
-              .listen_interval = 0,
+              .channel = directed_ ? channel_ : uint8_t{0},
+              .listen_interval = power_config_.listen_interval,
               .sort_method = WIFI_CONNECT_AP_BY_SIGNAL,
               .threshold{
                   .rssi = 0,
@@ -260,6 +408,8 @@ esp_err_t WiFi::Connect(const std::string& ssid, const std::string& key) {
               sizeof(wifi_config.sta.ssid) - 1);
   SafeStrCopy(reinterpret_cast<char*>(wifi_config.sta.password), key.c_str(),
               sizeof(wifi_config.sta.password) - 1);
+  if (directed_)
+    std::memcpy(wifi_config.sta.bssid, bssid_, sizeof(bssid_));
 
   err = esp_wifi_set_config(WIFI_IF_STA, &wifi_config);
   if (err != ESP_OK) {
@@ -267,11 +417,14 @@ esp_err_t WiFi::Connect(const std::string& ssid, const std::string& key) {
     return err;
   }
 
-  err = esp_wifi_start();
-  if (err != ESP_OK)
-    ESP_LOGE(TAG, "Start failed: %s", esp_err_to_name(err));
+  bool give_mutex = xSemaphoreTake(mutex_, portMAX_DELAY) == pdTRUE;
+  ApplyPowerSave();
+  if (give_mutex)
+    xSemaphoreGive(mutex_);
 
-  return err;
+  // Turns the radio on and starts the first attempt.
+  Apply(Feed(&ReconnectStateMachine::Start), /*reason=*/0);
+  return radio_on_ ? ESP_OK : ESP_FAIL;
 }
 
 esp_err_t WiFi::GetHostname(std::string* hostname) const {
@@ -280,4 +433,171 @@ esp_err_t WiFi::GetHostname(std::string* hostname) const {
 
 esp_err_t WiFi::GetIPAddress(esp_ip4_addr_t* addr) const {
   return ::GetIPAddress(netif_, addr);
-}
\ No newline at end of file
+}
+
+esp_err_t WiFi::SetStaticIP(const StaticIP& static_ip) {
+  esp_netif_ip_info_t ip_info = {};
+  esp_err_t err = esp_netif_str_to_ip4(static_ip.ip.c_str(), &ip_info.ip);
+  if (err == ESP_OK)
+    err = esp_netif_str_to_ip4(static_ip.netmask.c_str(), &ip_info.netmask);
+  if (err == ESP_OK)
+    err = esp_netif_str_to_ip4(static_ip.gateway.c_str(), &ip_info.gw);
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "Invalid static IP config.");
+    return ESP_ERR_INVALID_ARG;
+  }
+
+  esp_netif_dns_info_t dns_info = {};
+  if (!static_ip.dns.empty()) {
+    dns_info.ip.type = ESP_IPADDR_TYPE_V4;
+    err = esp_netif_str_to_ip4(static_ip.dns.c_str(), &dns_info.ip.u_addr.ip4);
+    if (err != ESP_OK) {
+      ESP_LOGE(TAG, "Invalid static DNS server \"%s\".", static_ip.dns.c_str());
+      return ESP_ERR_INVALID_ARG;
+    }
+  }
+
+  static_ip_ = ip_info;
+  static_dns_ = dns_info;
+  have_static_ip_ = true;
+  ESP_LOGI(TAG, "Using static IP " IPSTR ".", IP2STR(&static_ip_.ip));
+  return ESP_OK;
+}
+
+esp_err_t WiFi::SetPowerConfig(const PowerConfig& power_config) {
+  if (power_config.max_tx_power &&
+      (power_config.max_tx_power < kMinTxPower ||
+       power_config.max_tx_power > kMaxTxPower)) {
+    ESP_LOGE(TAG, "Invalid max TX power %d.", power_config.max_tx_power);
+    return ESP_ERR_INVALID_ARG;
+  }
+  power_config_ = power_config;
+  ESP_LOGI(TAG, "Idle power save: %s, listen interval %u.",
+           ps_name(power_config_.idle_ps), power_config_.listen_interval);
+  return ESP_OK;
+}
+
+void WiFi::SetBusy(bool busy) {
+  bool give_mutex = xSemaphoreTake(mutex_, portMAX_DELAY) == pdTRUE;
+  if (busy != busy_) {
+    const int64_t now = esp_timer_get_time();
+    if (busy) {
+      busy_start_us_ = now;
+      busy_periods_++;
+    } else {
+      busy_us_ += now - busy_start_us_;
+    }
+    busy_ = busy;
+    ApplyPowerSave();
+  }
+  if (give_mutex)
+    xSemaphoreGive(mutex_);
+}
+
+void WiFi::ApplyPowerSave() {
+  const wifi_ps_type_t type = busy_ ? WIFI_PS_NONE : power_config_.idle_ps;
+  const esp_err_t err = esp_wifi_set_ps(type);
+  if (err != ESP_OK) {
+    ESP_LOGW(TAG, "Can't set power save %s: %s", ps_name(type),
+             esp_err_to_name(err));
+    return;
+  }
+  ESP_LOGV(TAG, "Power save: %s.", ps_name(type));
+}
+
+esp_err_t WiFi::ApplyStaticIP() {
+  esp_err_t err = esp_netif_dhcpc_stop(netif_);
+  if (err != ESP_OK && err != ESP_ERR_ESP_NETIF_DHCP_ALREADY_STOPPED) {
+    ESP_LOGE(TAG, "Can't stop DHCP client: %s", esp_err_to_name(err));
+    return err;
+  }
+  // Posts IP_EVENT_STA_GOT_IP.
+  err = esp_netif_set_ip_info(netif_, &static_ip_);
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "Can't set static IP: %s", esp_err_to_name(err));
+    return err;
+  }
+  if (!static_dns_.ip.u_addr.ip4.addr)
+    return ESP_OK;
+  return esp_netif_set_dns_info(netif_, ESP_NETIF_DNS_MAIN, &static_dns_);
+}
+
+bool WiFi::LoadCachedAP(const std::string& ssid) {
+  channel_ = 0;
+  nvs_handle_t handle;
+  if (nvs_open(kNVSNamespace, NVS_READONLY, &handle) != ESP_OK)
+    return false;
+  CachedAP ap;
+  size_t size = sizeof(ap);
+  const esp_err_t err = nvs_get_blob(handle, kNVSCachedAPKey, &ap, &size);
+  nvs_close(handle);
+  if (err != ESP_OK || size != sizeof(ap))
+    return false;
+  ap.ssid[sizeof(ap.ssid) - 1] = '\0';
+  if (ssid != ap.ssid)
+    return false;
+  std::memcpy(bssid_, ap.bssid, sizeof(bssid_));
+  channel_ = ap.channel;
+  return channel_ != 0;
+}
+
+void WiFi::SaveCachedAP() {
+  wifi_ap_record_t ap_info;
+  if (esp_wifi_sta_get_ap_info(&ap_info) != ESP_OK)
+    return;
+  // Don't wear the flash rewriting an unchanged AP.
+  if (ap_info.primary == channel_ &&
+      !std::memcmp(ap_info.bssid, bssid_, sizeof(bssid_))) {
+    return;
+  }
+  std::memcpy(bssid_, ap_info.bssid, sizeof(bssid_));
+  channel_ = ap_info.primary;
+
+  CachedAP ap = {};
+  SafeStrCopy(ap.ssid, ssid_.c_str(), sizeof(ap.ssid));
+  std::memcpy(ap.bssid, bssid_, sizeof(ap.bssid));
+  ap.channel = channel_;
+
+  nvs_handle_t handle;
+  esp_err_t err = nvs_open(kNVSNamespace, NVS_READWRITE, &handle);
+  if (err == ESP_OK) {
+    err = nvs_set_blob(handle, kNVSCachedAPKey, &ap, sizeof(ap));
+    if (err == ESP_OK)
+      err = nvs_commit(handle);
+    nvs_close(handle);
+  }
+  if (err != ESP_OK) {
+    ESP_LOGW(TAG, "Can't cache AP: %s", esp_err_to_name(err));
+    return;
+  }
+  ESP_LOGI(TAG, "Cached AP " MACSTR " on channel %u.", MAC2STR(bssid_),
+           channel_);
+}
+
+esp_err_t WiFi::StopDirected() {
+  directed_ = false;
+  wifi_config_t wifi_config;
+  esp_err_t err = esp_wifi_get_config(WIFI_IF_STA, &wifi_config);
+  if (err != ESP_OK)
+    return err;
+  wifi_config.sta.bssid_set = false;
+  wifi_config.sta.channel = 0;
+  return esp_wifi_set_config(WIFI_IF_STA, &wifi_config);
+}
+
+void WiFi::LogStats() const {
+  bool give_mutex = xSemaphoreTake(mutex_, portMAX_DELAY) == pdTRUE;
+  const int64_t now = esp_timer_get_time();
+  const ReconnectStateMachine::Stats stats = reconnect_.GetStats(now);
+  const int64_t busy_us = busy_us_ + (busy_ ? now - busy_start_us_ : 0);
+  const uint32_t busy_periods = busy_periods_;
+  if (give_mutex)
+    xSemaphoreGive(mutex_);
+  ESP_LOGI(TAG,
+           "Wi-Fi: connected %lld s, retrying %lld s, offline %lld s, "
+           "%u attempts, %u disconnects.",
+           stats.connected_us / 1000000, stats.retrying_us / 1000000,
+           stats.offline_us / 1000000, stats.attempts, stats.disconnects);
+  ESP_LOGI(TAG, "Wi-Fi: power save off %lld ms (%u periods) of %lld s.",
+           busy_us / 1000, busy_periods, now / 1000000);
+}
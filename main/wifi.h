@@ -1,22 +1,87 @@
 #pragma once
 
+#include <cstdint>
 #include <string>
 
 #include <esp_err.h>
 #include <esp_event.h>
+#include <esp_netif.h>
+#include <esp_wifi_types.h>
 #include <freertos/FreeRTOS.h>
-#include <freertos/event_groups.h>
+#include <freertos/semphr.h>
 
+#include "reconnect_state_machine.h"
+#include "timer_wheel.h"
+
+class EventBus;
+
+/**
+ * Connects to, and stays connected to, the configured Wi-Fi network.
+ *
+ * The BSSID and channel of the last AP successfully connected to are kept
+ * in NVS, and the next connection is first attempted directly to that AP,
+ * skipping the channel scan. If that fails a normal scan is done. The DHCP
+ * lease is reused via CONFIG_LWIP_DHCP_RESTORE_LAST_IP, or DHCP is skipped
+ * entirely when a static IP is set.
+ *
+ * Once connected, a lost connection (or IP address) is retried forever, with
+ * increasing delays decided by a ReconnectStateMachine.
+ *
+ * The modem sleeps between beacons while idle, and stays awake while busy
+ * (see SetBusy()) so that responses aren't held by the AP until the next
+ * beacon.
+ */
 class WiFi {
  public:
-  WiFi(EventGroupHandle_t wifi_event_group);
+  /**
+   * Static IPv4 configuration, as dotted decimal strings.
+   */
+  struct StaticIP {
+    std::string ip;
+    std::string netmask;
+    std::string gateway;
+    std::string dns;  // Optional.
+  };
+
+  /**
+   * Radio power settings.
+   */
+  struct PowerConfig {
+    wifi_ps_type_t idle_ps;   // Power save mode while not busy.
+    uint8_t listen_interval;  // Beacons between wakes, for WIFI_PS_MAX_MODEM.
+    int8_t max_tx_power;      // In 0.25 dBm units, or zero for the default.
+  };
+
+  WiFi(EventBus* event_bus, TimerWheel* timer_wheel);
   ~WiFi();
 
   esp_err_t Inititialize();
+
+  /**
+   * Use |static_ip| instead of DHCP. Call before Connect().
+   */
+  esp_err_t SetStaticIP(const StaticIP& static_ip);
+
+  /**
+   * Set the radio power settings. Call before Connect().
+   */
+  esp_err_t SetPowerConfig(const PowerConfig& power_config);
+
+  /**
+   * Turn power save off while |busy|, e.g. while network requests are
+   * outstanding, and back to |PowerConfig::idle_ps| when not.
+   */
+  void SetBusy(bool busy);
+
   esp_err_t Connect(const std::string& ssid, const std::string& key);
   esp_err_t GetHostname(std::string* hostname) const;
   esp_err_t GetIPAddress(esp_ip4_addr_t* addr) const;
 
+  /**
+   * Log the time spent connected, retrying, offline and busy.
+   */
+  void LogStats() const;
+
  private:
   static void EventHandler(void* arg,
                            esp_event_base_t event_base,
@@ -24,10 +89,68 @@ class WiFi {
                            void* event_data);
   void HandleWiFiEvent(wifi_event_t event_id, void* event_data);
   void HandleIPEvent(ip_event_t event_id, void* event_data);
+  static void RetryTimerCb(void* arg);
+
+  /**
+   * Pass an event to |reconnect_|.
+   *
+   * @return The action to Apply().
+   */
+  ReconnectStateMachine::Action Feed(
+      ReconnectStateMachine::Action (ReconnectStateMachine::*event)(int64_t));
+
+  /**
+   * Carry out an action of |reconnect_|.
+   *
+   * @param reason The disconnect reason to post if going offline.
+   */
+  void Apply(const ReconnectStateMachine::Action& action, uint8_t reason);
+
+  /**
+   * Load the cached AP for |ssid| into |bssid_| and |channel_|.
+   *
+   * @return true if there was one.
+   */
+  bool LoadCachedAP(const std::string& ssid);
+
+  /**
+   * Cache the AP currently connected to, if not already cached.
+   */
+  void SaveCachedAP();
+
+  /**
+   * Stop using the cached AP, and scan for any AP with the SSID on the next
+   * attempt.
+   */
+  esp_err_t StopDirected();
+
+  esp_err_t ApplyStaticIP();
+
+  /**
+   * Set the power save mode for |busy_|. Call with |mutex_| held.
+   */
+  void ApplyPowerSave();
 
-  EventGroupHandle_t wifi_event_group_;
+  EventBus* event_bus_;
   esp_event_handler_instance_t instance_any_id_;
-  esp_event_handler_instance_t instance_got_ip_;
-  int retry_num_;
+  esp_event_handler_instance_t instance_ip_;
+  esp_event_handler_instance_t instance_retry_;
   esp_netif_t* netif_;
+  std::string ssid_;                 // SSID being connected to.
+  uint8_t bssid_[6];                 // Cached AP, if |channel_| is nonzero.
+  uint8_t channel_;                  // Zero if no AP is cached.
+  bool directed_;                    // Connecting to the cached AP?
+  bool have_static_ip_;              // Use |static_ip_| instead of DHCP?
+  esp_netif_ip_info_t static_ip_;    // Static address, netmask and gateway.
+  esp_netif_dns_info_t static_dns_;  // Zero if DNS is not set.
+  int64_t connect_start_us_;         // When the current attempt started.
+  TimerWheel::Timer retry_timer_;    // Next |reconnect_| OnTimer().
+  SemaphoreHandle_t mutex_;          // Guards |reconnect_| and busy state.
+  ReconnectStateMachine reconnect_;  // Decides when to connect.
+  bool radio_on_;                    // Has the STA been started?
+  PowerConfig power_config_;         // Radio power settings.
+  bool busy_;                        // Is power save off?
+  int64_t busy_start_us_;            // When |busy_| was last set.
+  int64_t busy_us_;                  // Time busy in earlier periods.
+  uint32_t busy_periods_;            // Times |busy_| was set.
 };
@@ -0,0 +1,180 @@
+#include "event_bus.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+
+#include "test.h"
+
+namespace {
+
+Event GotIP(uint32_t ip) {
+  return {.type = EventType::NetworkGotIP, .network_got_ip = {.ip = ip}};
+}
+
+Event KeyboardInterrupt(int64_t irq_time_us) {
+  return {
+      .type = EventType::KeyboardInterrupt,
+      .keyboard_interrupt = {.irq_time_us = irq_time_us},
+  };
+}
+
+void TestOrderedDelivery() {
+  EventBus bus;
+  const int all = bus.Subscribe(EventBus::kAllEvents);
+  const int ip_only = bus.Subscribe(EventBus::Mask(EventType::NetworkGotIP));
+  for (uint32_t i = 0; i < EventBus::kQueueSize; i++)
+    EXPECT(bus.Post(i % 2 ? GotIP(i) : KeyboardInterrupt(i)));
+
+  Event event;
+  for (uint32_t i = 0; i < EventBus::kQueueSize; i++) {
+    EXPECT(bus.Take(all, &event, 0));
+    if (i % 2) {
+      EXPECT(event.type == EventType::NetworkGotIP);
+      EXPECT(event.network_got_ip.ip == i);
+      EXPECT(bus.Take(ip_only, &event, 0));
+      EXPECT(event.network_got_ip.ip == i);
+    } else {
+      EXPECT(event.type == EventType::KeyboardInterrupt);
+      EXPECT(event.keyboard_interrupt.irq_time_us == i);
+    }
+  }
+  EXPECT(!bus.Take(all, &event, 0));
+  EXPECT(!bus.Take(ip_only, &event, 0));
+  EXPECT(bus.GetStats(all).replaced == 0);
+}
+
+// Once the ring is full the latest event of each type is kept, and
+// delivered in the order they were last posted.
+void TestOverflowKeepsLatest() {
+  EventBus bus;
+  const int id = bus.Subscribe(EventBus::kAllEvents);
+  for (uint32_t i = 0; i < EventBus::kQueueSize; i++)
+    EXPECT(bus.Post({.type = EventType::SpotifyPlayerStateChanged}));
+
+  EXPECT(bus.Post({.type = EventType::NetworkDisconnected}));
+  EXPECT(bus.Post(GotIP(1)));
+  EXPECT(bus.Post(KeyboardInterrupt(1)));
+  EXPECT(!bus.Post(GotIP(2)));
+  EXPECT(!bus.Post(KeyboardInterrupt(2)));
+  EXPECT(!bus.Post({.type = EventType::NetworkDisconnected}));
+
+  Event event;
+  EXPECT(bus.Take(id, &event, 0));
+  EXPECT(event.type == EventType::SpotifyPlayerStateChanged);
+  // Space in the ring doesn't let new events overtake overflowed ones.
+  EXPECT(!bus.Post(GotIP(3)));
+  for (uint32_t i = 1; i < EventBus::kQueueSize; i++) {
+    EXPECT(bus.Take(id, &event, 0));
+    EXPECT(event.type == EventType::SpotifyPlayerStateChanged);
+  }
+  EXPECT(bus.Take(id, &event, 0));
+  EXPECT(event.type == EventType::KeyboardInterrupt);
+  EXPECT(event.keyboard_interrupt.irq_time_us == 2);
+  EXPECT(bus.Take(id, &event, 0));
+  EXPECT(event.type == EventType::NetworkDisconnected);
+  EXPECT(bus.Take(id, &event, 0));
+  EXPECT(event.type == EventType::NetworkGotIP);
+  EXPECT(event.network_got_ip.ip == 3);
+  EXPECT(!bus.Take(id, &event, 0));
+
+  const EventBus::Stats stats = bus.GetStats(id);
+  EXPECT(stats.replaced == 4);
+  EXPECT(stats.max_depth == EventBus::kQueueSize);
+
+  // Back to the ring once drained.
+  EXPECT(bus.Post(GotIP(4)));
+  EXPECT(bus.Take(id, &event, 0));
+  EXPECT(event.network_got_ip.ip == 4);
+}
+
+// Models the keyboard interrupt: the "ISR" disables itself and posts an
+// event, and the interrupt is only re-enabled once the event is handled,
+// while other tasks flood a slow subscriber. If the interrupt's event were
+// ever lost the keyboard would stop for good.
+void TestLostEventStress() {
+  constexpr int kKeyboardEvents = 2000;
+  constexpr auto kTimeout = std::chrono::seconds(30);
+
+  EventBus bus;
+  const int id = bus.Subscribe(EventBus::kAllEvents);
+  std::atomic<bool> stop(false);
+  std::atomic<bool> irq_enabled(true);
+  std::atomic<uint32_t> last_ip(0);
+
+  std::thread isr([&] {
+    int64_t irq_time = 0;
+    while (!stop) {
+      // The INT line is always asserted: only the enable gates it.
+      if (irq_enabled.exchange(false)) {
+        BaseType_t woken = pdFALSE;
+        bus.PostFromISR(KeyboardInterrupt(++irq_time), &woken);
+      }
+      std::this_thread::yield();
+    }
+  });
+  std::thread flood([&] {
+    while (!stop)
+      bus.Post({.type = EventType::SpotifyPlayerStateChanged});
+  });
+  std::thread network([&] {
+    for (uint32_t ip = 1; !stop; ip++) {
+      bus.Post(GotIP(ip));
+      last_ip = ip;
+      std::this_thread::yield();
+    }
+  });
+
+  int handled = 0;
+  uint32_t prev_ip = 0;
+  int64_t prev_irq_time = 0;
+  const auto deadline = std::chrono::steady_clock::now() + kTimeout;
+  Event event;
+  while (handled < kKeyboardEvents &&
+         std::chrono::steady_clock::now() < deadline) {
+    if (!bus.Take(id, &event, 100))
+      continue;
+    switch (event.type) {
+      case EventType::KeyboardInterrupt:
+        EXPECT(event.keyboard_interrupt.irq_time_us > prev_irq_time);
+        prev_irq_time = event.keyboard_interrupt.irq_time_us;
+        handled++;
+        irq_enabled = true;
+        break;
+      case EventType::NetworkGotIP:
+        // Replacement skips events, but never reorders them.
+        EXPECT(event.network_got_ip.ip > prev_ip);
+        prev_ip = event.network_got_ip.ip;
+        break;
+      default:
+        break;
+    }
+  }
+  stop = true;
+  isr.join();
+  flood.join();
+  network.join();
+  EXPECT(handled == kKeyboardEvents);
+
+  // Everything posted is still delivered, ending with the latest address.
+  while (bus.Take(id, &event, 0)) {
+    if (event.type == EventType::NetworkGotIP)
+      prev_ip = event.network_got_ip.ip;
+  }
+  EXPECT(prev_ip == last_ip);
+
+  const EventBus::Stats stats = bus.GetStats(id);
+  std::printf("Stress: delivered=%u replaced=%u max_depth=%u\n",
+              stats.delivered, stats.replaced, stats.max_depth);
+}
+
+}  // namespace
+
+int main() {
+  TestOrderedDelivery();
+  TestOverflowKeepsLatest();
+  TestLostEventStress();
+  std::printf("event_bus_test passed.\n");
+  return 0;
+}
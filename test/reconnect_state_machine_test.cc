@@ -0,0 +1,228 @@
+#include "reconnect_state_machine.h"
+
+#include <algorithm>
+#include <cstdio>
+
+#include "test.h"
+
+namespace {
+
+using Action = ReconnectStateMachine::Action;
+using State = ReconnectStateMachine::State;
+
+constexpr int64_t kUsecsPerMSec = 1000;
+constexpr int64_t kUsecsPerSec = 1000 * kUsecsPerMSec;
+
+uint32_t g_random;
+
+uint32_t Random() {
+  g_random = g_random * 1103515245 + 12345;
+  return g_random >> 8;
+}
+
+/**
+ * Plays the part of WiFi and the Wi-Fi driver: performs each Action, and
+ * feeds back the events the driver would post, with simulated time.
+ */
+class Simulator {
+ public:
+  explicit Simulator(ReconnectStateMachine* machine) : machine_(machine) {}
+
+  // When a connect succeeds, the AP is reachable.
+  bool ap_up = false;
+  // How long a successful connect takes, including DHCP.
+  int64_t connect_us = 2 * kUsecsPerSec;
+  // How long a failing connect takes to report a disconnect, or zero if it
+  // never does (so that the attempt times out).
+  int64_t fail_us = 3 * kUsecsPerSec;
+
+  int64_t now_us() const { return now_us_; }
+  bool connected() const { return machine_->state() == State::Connected; }
+  int went_offline() const { return went_offline_; }
+
+  void Start() { Perform(machine_->Start(now_us_)); }
+
+  void LoseIP() { Perform(machine_->OnLostIP(now_us_)); }
+
+  void Disconnected() { Perform(machine_->OnDisconnected(now_us_)); }
+
+  /**
+   * Deliver whichever pending event is due first, if it is before |until|.
+   *
+   * @return false if nothing was pending before |until|.
+   */
+  bool Step(int64_t until_us) {
+    const bool timer_first =
+        timer_due_us_ && (!driver_due_us_ || timer_due_us_ <= driver_due_us_);
+    const int64_t due_us = timer_first ? timer_due_us_ : driver_due_us_;
+    if (!due_us || due_us > until_us) {
+      now_us_ = std::max(now_us_, until_us);
+      return false;
+    }
+    now_us_ = due_us;
+    if (timer_first) {
+      timer_due_us_ = 0;
+      Perform(machine_->OnTimer(now_us_));
+    } else {
+      driver_due_us_ = 0;
+      Perform(got_ip_ ? machine_->OnGotIP(now_us_)
+                      : machine_->OnDisconnected(now_us_));
+    }
+    return true;
+  }
+
+  void RunUntil(int64_t until_us) {
+    while (Step(until_us)) {
+    }
+  }
+
+ private:
+  void Perform(const Action& action) {
+    if (action.went_offline)
+      went_offline_++;
+    if (action.disconnect) {
+      // Like esp_wifi_disconnect(): always reported, even when aborting an
+      // attempt or already disconnected.
+      driver_due_us_ = now_us_ + 1;
+      got_ip_ = false;
+    }
+    if (action.connect) {
+      EXPECT(!driver_due_us_ || action.disconnect);
+      if (ap_up) {
+        driver_due_us_ = now_us_ + connect_us;
+        got_ip_ = true;
+      } else if (fail_us) {
+        driver_due_us_ = now_us_ + fail_us;
+        got_ip_ = false;
+      }
+    }
+    if (action.timer_ms)
+      timer_due_us_ = now_us_ + action.timer_ms * kUsecsPerMSec;
+    else if (action.cancel_timer)
+      timer_due_us_ = 0;
+  }
+
+  ReconnectStateMachine* const machine_;
+  int64_t now_us_ = 0;
+  int64_t timer_due_us_ = 0;   // Zero if no timer is pending.
+  int64_t driver_due_us_ = 0;  // Zero if no driver event is pending.
+  bool got_ip_ = false;        // Which driver event is pending.
+  int went_offline_ = 0;
+};
+
+void TestConnects() {
+  ReconnectStateMachine machine(ReconnectStateMachine::kDefaultParams,
+                                Random);
+  Simulator sim(&machine);
+  sim.ap_up = true;
+  sim.Start();
+  sim.RunUntil(10 * kUsecsPerSec);
+  EXPECT(sim.connected());
+  EXPECT(machine.GetStats(sim.now_us()).attempts == 1);
+}
+
+// Each delay is jittered within the upper half of an exponentially
+// growing, capped, delay.
+void TestBackoffDelays() {
+  const ReconnectStateMachine::Params& params =
+      ReconnectStateMachine::kDefaultParams;
+  ReconnectStateMachine machine(params, Random);
+  int64_t now_us = 0;
+  machine.Start(now_us);
+  for (uint32_t retry = 1; retry <= 16; retry++) {
+    now_us += kUsecsPerSec;
+    const Action action = machine.OnDisconnected(now_us);
+    EXPECT(machine.state() == State::Backoff);
+    EXPECT(!action.connect);
+    const uint32_t delay = static_cast<uint32_t>(std::min<uint64_t>(
+        uint64_t{params.initial_delay_ms} << (retry - 1),
+        params.max_delay_ms));
+    EXPECT(action.timer_ms >= delay - delay / 2);
+    EXPECT(action.timer_ms <= delay);
+    EXPECT(action.radio_off == (action.timer_ms >= params.radio_off_delay_ms));
+
+    now_us += action.timer_ms * kUsecsPerMSec;
+    EXPECT(machine.OnTimer(now_us).connect);
+    EXPECT(machine.state() == State::Connecting);
+  }
+}
+
+// Attempts that time out are aborted with a disconnect, which the driver
+// reports while backing off. That must not cancel the retry: reconnection
+// is attempted forever, and succeeds once the AP is back.
+void TestRetriesForever() {
+  ReconnectStateMachine machine(ReconnectStateMachine::kDefaultParams,
+                                Random);
+  Simulator sim(&machine);
+  sim.fail_us = 0;  // Attempts time out.
+  sim.Start();
+  sim.RunUntil(60 * 60 * kUsecsPerSec);
+  EXPECT(!sim.connected());
+  const uint32_t attempts = machine.GetStats(sim.now_us()).attempts;
+  // At least one attempt per (timeout + longest delay).
+  EXPECT(attempts >= 60 * 60 / (30 + 300));
+
+  sim.ap_up = true;
+  sim.RunUntil(sim.now_us() + 10 * 60 * kUsecsPerSec);
+  EXPECT(sim.connected());
+  EXPECT(machine.GetStats(sim.now_us()).attempts > attempts);
+}
+
+void TestStrayDisconnectKeepsRetry() {
+  ReconnectStateMachine machine(ReconnectStateMachine::kDefaultParams,
+                                Random);
+  int64_t now_us = 0;
+  machine.Start(now_us);
+  now_us += 30 * kUsecsPerSec;
+  const Action timeout = machine.OnTimer(now_us);
+  EXPECT(timeout.disconnect);
+  EXPECT(timeout.timer_ms);
+  EXPECT(machine.state() == State::Backoff);
+
+  const Action stray = machine.OnDisconnected(now_us);
+  EXPECT(!stray.connect);
+  EXPECT(!stray.timer_ms);
+  EXPECT(!stray.cancel_timer);
+  EXPECT(machine.state() == State::Backoff);
+}
+
+void TestLostConnection() {
+  ReconnectStateMachine machine(ReconnectStateMachine::kDefaultParams,
+                                Random);
+  Simulator sim(&machine);
+  sim.ap_up = true;
+  sim.Start();
+  sim.RunUntil(10 * kUsecsPerSec);
+  EXPECT(sim.connected());
+
+  // The first reconnect is immediate.
+  sim.Disconnected();
+  EXPECT(sim.went_offline() == 1);
+  EXPECT(machine.state() == State::Connecting);
+  sim.RunUntil(sim.now_us() + 10 * kUsecsPerSec);
+  EXPECT(sim.connected());
+
+  // Losing the address drops the association to get a new lease.
+  sim.LoseIP();
+  EXPECT(sim.went_offline() == 2);
+  sim.RunUntil(sim.now_us() + 10 * kUsecsPerSec);
+  EXPECT(sim.connected());
+
+  const ReconnectStateMachine::Stats stats = machine.GetStats(sim.now_us());
+  EXPECT(stats.disconnects == 2);
+  EXPECT(stats.attempts == 3);
+  EXPECT(stats.connected_us + stats.retrying_us + stats.offline_us ==
+         sim.now_us());
+}
+
+}  // namespace
+
+int main() {
+  TestConnects();
+  TestBackoffDelays();
+  TestRetriesForever();
+  TestStrayDisconnectKeepsRetry();
+  TestLostConnection();
+  std::printf("reconnect_state_machine_test passed.\n");
+  return 0;
+}
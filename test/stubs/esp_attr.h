@@ -0,0 +1,5 @@
+#pragma once
+
+// Host stand-in for ESP-IDF's esp_attr.h.
+
+#define IRAM_ATTR
@@ -0,0 +1,14 @@
+#pragma once
+
+// Host stand-in for ESP-IDF's esp_log.h: everything goes to stdout.
+
+#include <cstdio>
+
+#define ESP_LOG_HOST(letter, tag, format, ...) \
+  std::printf(letter " %s: " format "\n", tag, ##__VA_ARGS__)
+
+#define ESP_LOGE(tag, format, ...) ESP_LOG_HOST("E", tag, format, ##__VA_ARGS__)
+#define ESP_LOGW(tag, format, ...) ESP_LOG_HOST("W", tag, format, ##__VA_ARGS__)
+#define ESP_LOGI(tag, format, ...) ESP_LOG_HOST("I", tag, format, ##__VA_ARGS__)
+#define ESP_LOGD(tag, format, ...) ESP_LOG_HOST("D", tag, format, ##__VA_ARGS__)
+#define ESP_LOGV(tag, format, ...) ESP_LOG_HOST("V", tag, format, ##__VA_ARGS__)
@@ -0,0 +1,39 @@
+#pragma once
+
+// Host stand-in for the subset of FreeRTOS used by tested code. Critical
+// sections are spin locks, and a tick is a millisecond.
+
+#include <atomic>
+#include <cstdint>
+#include <thread>
+
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef unsigned UBaseType_t;
+
+#define pdFALSE 0
+#define pdTRUE 1
+#define pdPASS 1
+#define portMAX_DELAY 0xffffffffu
+#define pdMS_TO_TICKS(ms) (static_cast<TickType_t>(ms))
+
+struct portMUX_TYPE {
+  std::atomic<bool> locked;
+};
+
+#define portMUX_INITIALIZER_UNLOCKED \
+  { false }
+
+inline void portEnterCritical(portMUX_TYPE* mux) {
+  while (mux->locked.exchange(true, std::memory_order_acquire))
+    std::this_thread::yield();
+}
+
+inline void portExitCritical(portMUX_TYPE* mux) {
+  mux->locked.store(false, std::memory_order_release);
+}
+
+#define portENTER_CRITICAL(mux) portEnterCritical(mux)
+#define portEXIT_CRITICAL(mux) portExitCritical(mux)
+#define portENTER_CRITICAL_SAFE(mux) portEnterCritical(mux)
+#define portEXIT_CRITICAL_SAFE(mux) portExitCritical(mux)
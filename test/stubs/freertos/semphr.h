@@ -0,0 +1,58 @@
+#pragma once
+
+// Host stand-in for FreeRTOS counting semaphores.
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+
+#include "FreeRTOS.h"
+
+struct StaticSemaphore_t {
+  std::mutex mutex;
+  std::condition_variable cv;
+  UBaseType_t count;
+  UBaseType_t max_count;
+};
+
+typedef StaticSemaphore_t* SemaphoreHandle_t;
+
+inline SemaphoreHandle_t xSemaphoreCreateCountingStatic(
+    UBaseType_t max_count,
+    UBaseType_t initial_count,
+    StaticSemaphore_t* buffer) {
+  buffer->count = initial_count;
+  buffer->max_count = max_count;
+  return buffer;
+}
+
+inline void vSemaphoreDelete(SemaphoreHandle_t) {}
+
+inline BaseType_t xSemaphoreGive(SemaphoreHandle_t sem) {
+  std::lock_guard<std::mutex> lock(sem->mutex);
+  if (sem->count == sem->max_count)
+    return pdFALSE;
+  sem->count++;
+  sem->cv.notify_one();
+  return pdTRUE;
+}
+
+inline BaseType_t xSemaphoreGiveFromISR(SemaphoreHandle_t sem,
+                                        BaseType_t* higher_priority_woken) {
+  if (higher_priority_woken)
+    *higher_priority_woken = pdFALSE;
+  return xSemaphoreGive(sem);
+}
+
+inline BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, TickType_t timeout) {
+  std::unique_lock<std::mutex> lock(sem->mutex);
+  auto available = [sem] { return sem->count > 0; };
+  if (timeout == portMAX_DELAY) {
+    sem->cv.wait(lock, available);
+  } else if (!sem->cv.wait_for(lock, std::chrono::milliseconds(timeout),
+                               available)) {
+    return pdFALSE;
+  }
+  sem->count--;
+  return pdTRUE;
+}
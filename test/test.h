@@ -0,0 +1,16 @@
+#pragma once
+
+#include <cstdio>
+#include <cstdlib>
+
+// Minimal checks for the host tests. Unlike assert() these are never
+// compiled out, and a failure is reported with its location before exiting.
+
+#define EXPECT(cond)                                                   \
+  do {                                                                 \
+    if (!(cond)) {                                                     \
+      std::fprintf(stderr, "%s:%d: EXPECT(%s) failed\n", __FILE__,     \
+                   __LINE__, #cond);                                   \
+      std::exit(EXIT_FAILURE);                                         \
+    }                                                                  \
+  } while (0)
@@ -0,0 +1,82 @@
+#include "url_encode.h"
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+#include "test.h"
+
+namespace {
+
+using url::Mode;
+
+// The RFC 3986 unreserved set, written out independently of url_encode.cc.
+bool IsUnreserved(int c) {
+  return std::strchr(
+             "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789"
+             "-._~",
+             c) != nullptr &&
+         c != '\0';
+}
+
+// Every byte value must be classified as in the RFC.
+void TestClassification() {
+  for (int c = 0; c < 256; c++) {
+    const std::string str(1, static_cast<char>(c));
+    char expected[4];
+    std::snprintf(expected, sizeof(expected), "%%%02X", c);
+
+    const std::string component = url::Encode(str, Mode::Component);
+    const std::string form = url::Encode(str, Mode::Form);
+    if (IsUnreserved(c)) {
+      EXPECT(component == str);
+      EXPECT(form == str);
+    } else if (c == ' ') {
+      EXPECT(component == "%20");
+      EXPECT(form == "+");
+    } else {
+      EXPECT(component == expected);
+      EXPECT(form == expected);
+    }
+  }
+}
+
+void TestStrings() {
+  EXPECT(url::Encode("") == "");
+  EXPECT(url::Encode("abcXYZ019-._~") == "abcXYZ019-._~");
+  EXPECT(url::Encode("http://h/cb/") == "http%3A%2F%2Fh%2Fcb%2F");
+  EXPECT(url::Encode("a b") == "a%20b");
+  EXPECT(url::Encode("a b", Mode::Form) == "a+b");
+  EXPECT(url::Encode("a+b", Mode::Form) == "a%2Bb");
+  EXPECT(url::Encode(std::string("\xff\x00", 2)) == "%FF%00");
+}
+
+// EncodedLength() is the exact size the encoder writes, so a buffer one
+// byte larger (for the terminator) is the smallest accepted.
+void TestExactSize() {
+  const char str[] = "user id=a/b?c&d~";
+  const size_t len = std::strlen(str);
+  for (Mode mode : {Mode::Component, Mode::Form}) {
+    const size_t encoded_len = url::EncodedLength(str, len, mode);
+    EXPECT(url::Encode(std::string(str), mode).length() == encoded_len);
+
+    char buf[64];
+    size_t written = 0;
+    EXPECT(url::Encode(str, len, mode, buf, encoded_len, &written) ==
+           ESP_ERR_INVALID_SIZE);
+    EXPECT(url::Encode(str, len, mode, buf, encoded_len + 1, &written) ==
+           ESP_OK);
+    EXPECT(written == encoded_len);
+    EXPECT(std::strlen(buf) == encoded_len);
+  }
+}
+
+}  // namespace
+
+int main() {
+  TestClassification();
+  TestStrings();
+  TestExactSize();
+  std::printf("url_encode_test passed.\n");
+  return 0;
+}
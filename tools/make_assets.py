@@ -0,0 +1,202 @@
+#!/usr/bin/env python3
+
+"""Convert images into a pre-decoded asset pack.
+
+The pack is flashed to its own partition and memory-mapped at runtime.
+
+Each image is converted to LVGL's native 16-bit (RGB565) true-color format,
+with a per-pixel alpha byte if the image has any transparency, so that it
+can be drawn without decoding at runtime. Pixel data is run-length encoded
+when that makes it smaller. All images are written into a single indexed
+file read by main/asset_pack.cc.
+
+File layout (all values little-endian):
+
+  Header:
+    char[4]  magic         "KBAP"
+    uint16   version       2
+    uint16   num_entries
+  Entry (num_entries of):
+    char[24] name          Image file name without extension, NUL padded.
+    uint8    color_format  LVGL lv_img_cf_t value.
+    uint8    encoding      0 = raw, 1 = RLE.
+    uint16   reserved
+    uint16   width
+    uint16   height
+    uint32   offset        Offset of the (encoded) data from file start.
+    uint32   size          Size of the (encoded) data.
+    uint32   data_size     Size of the decoded data.
+  Data (num_entries of, each starting on a 4 byte boundary):
+    uint32   lv_header     LVGL lv_img_header_t for the image.
+    uint8[]  data          Image data, at the entry's offset.
+
+A raw image's header and data are therefore laid out as an LVGL binary
+image file, which can be read without copying through an LVGL drive.
+
+RLE data is a sequence of packets, each a control byte followed by pixels
+(2 or 3 bytes each). If bit 7 of the control byte is set the single pixel
+that follows is repeated (control & 0x7f) + 1 times, otherwise
+(control + 1) literal pixels follow.
+"""
+
+import argparse
+import os
+import struct
+import sys
+
+from PIL import Image
+
+MAGIC = b'KBAP'
+VERSION = 2
+MAX_NAME_LEN = 23
+
+# From LVGL's lv_img_cf_t.
+LV_IMG_CF_TRUE_COLOR = 4
+LV_IMG_CF_TRUE_COLOR_ALPHA = 5
+
+ENCODING_RAW = 0
+ENCODING_RLE = 1
+
+HEADER_FORMAT = '<4sHH'
+LV_HEADER_FORMAT = '<I'
+ENTRY_FORMAT = '<24sBBHHHIII'
+MAX_RUN = 128
+
+
+class Converter(object):
+
+    def __init__(self, swap16):
+        self.__swap16 = swap16
+
+    def __PackColor(self, r, g, b):
+        rgb565 = ((r & 0xf8) << 8) | ((g & 0xfc) << 3) | (b >> 3)
+        # LV_COLOR_16_SWAP stores the color big-endian.
+        return struct.pack('>H' if self.__swap16 else '<H', rgb565)
+
+    def Convert(self, path):
+        """Return (color_format, width, height, pixel_size, data)."""
+        im = Image.open(path)
+        has_alpha = False
+        if im.mode in ('RGBA', 'LA') or 'transparency' in im.info:
+            im = im.convert('RGBA')
+            has_alpha = im.getextrema()[3][0] < 255
+        im = im.convert('RGBA' if has_alpha else 'RGB')
+
+        src = im.tobytes()
+        data = bytearray()
+        if has_alpha:
+            for i in range(0, len(src), 4):
+                data += self.__PackColor(src[i], src[i + 1], src[i + 2])
+                data.append(src[i + 3])
+            return (LV_IMG_CF_TRUE_COLOR_ALPHA, im.width, im.height, 3,
+                    bytes(data))
+        for i in range(0, len(src), 3):
+            data += self.__PackColor(src[i], src[i + 1], src[i + 2])
+        return (LV_IMG_CF_TRUE_COLOR, im.width, im.height, 2, bytes(data))
+
+
+def RLEEncode(data, pixel_size):
+    pixels = [data[i:i + pixel_size] for i in range(0, len(data), pixel_size)]
+    out = bytearray()
+    literals = []
+
+    def FlushLiterals():
+        while literals:
+            chunk = literals[:MAX_RUN]
+            del literals[:MAX_RUN]
+            out.append(len(chunk) - 1)
+            for pixel in chunk:
+                out.extend(pixel)
+
+    i = 0
+    while i < len(pixels):
+        run = 1
+        while (i + run < len(pixels) and run < MAX_RUN and
+               pixels[i + run] == pixels[i]):
+            run += 1
+        if run > 1:
+            FlushLiterals()
+            out.append(0x80 | (run - 1))
+            out.extend(pixels[i])
+        else:
+            literals.append(pixels[i])
+        i += run
+    FlushLiterals()
+    return bytes(out)
+
+
+def Align4(value):
+    return (value + 3) & ~3
+
+
+def MakeLVHeader(cf, width, height):
+    # lv_img_header_t: cf:5, always_zero:3, reserved:2, w:11, h:11.
+    return struct.pack(LV_HEADER_FORMAT, cf | (width << 10) | (height << 21))
+
+
+def MakePack(images, converter, allow_rle):
+    entries = []
+    blobs = []
+    offset = Align4(struct.calcsize(HEADER_FORMAT) +
+                    len(images) * struct.calcsize(ENTRY_FORMAT))
+    lv_header_size = struct.calcsize(LV_HEADER_FORMAT)
+    names = set()
+    for path in images:
+        name = os.path.splitext(os.path.basename(path))[0]
+        if len(name) > MAX_NAME_LEN:
+            sys.exit('Asset name "%s" is too long' % name)
+        if name in names:
+            sys.exit('Duplicate asset name "%s"' % name)
+        names.add(name)
+        cf, width, height, pixel_size, data = converter.Convert(path)
+        encoding = ENCODING_RAW
+        encoded = data
+        if allow_rle:
+            rle = RLEEncode(data, pixel_size)
+            if len(rle) < len(data):
+                encoding = ENCODING_RLE
+                encoded = rle
+        offset += lv_header_size
+        entries.append(struct.pack(ENTRY_FORMAT, name.encode('ascii'), cf,
+                                   encoding, 0, width, height, offset,
+                                   len(encoded), len(data)))
+        blobs.append(MakeLVHeader(cf, width, height) + encoded)
+        print('%s: %dx%d %s, %d bytes' %
+              (name, width, height, 'rle' if encoding else 'raw',
+               len(encoded)))
+        offset = Align4(offset + len(encoded))
+
+    pack = bytearray(struct.pack(HEADER_FORMAT, MAGIC, VERSION, len(images)))
+    for entry in entries:
+        pack += entry
+    for blob in blobs:
+        pack += b'\0' * (Align4(len(pack)) - len(pack))
+        pack += blob
+    return bytes(pack)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument('--output', required=True, help='Asset pack to write')
+    parser.add_argument('--swap16', action='store_true',
+                        help='Byte swap colors (CONFIG_LV_COLOR_16_SWAP)')
+    parser.add_argument('--no-rle', action='store_true',
+                        help='Never run-length encode images')
+    parser.add_argument('--max-size', type=lambda x: int(x, 0),
+                        help='Fail if the pack is larger (partition size)')
+    parser.add_argument('images', nargs='+', help='Images to pack')
+    args = parser.parse_args()
+
+    pack = MakePack(sorted(args.images), Converter(args.swap16),
+                    not args.no_rle)
+    if args.max_size is not None and len(pack) > args.max_size:
+        sys.exit('Asset pack is %d bytes, but the limit is %d' %
+                 (len(pack), args.max_size))
+    os.makedirs(os.path.dirname(os.path.abspath(args.output)), exist_ok=True)
+    with open(args.output, 'wb') as f:
+        f.write(pack)
+    print('Wrote %s (%d bytes)' % (args.output, len(pack)))
+
+
+if __name__ == '__main__':
+    main()